@@ -1,6 +1,7 @@
 // Calculation of PI using Leibniz formula for OpenCL
 // author: Schuchardt Martin, csap9442
 // compile: gcc -O3 -std=c99 -Wall -Werror -lm leibniz.c leibnizCL.c -lOpenCL -o leibnizCL_D2_double -DNUMBER_TYPE=2 -DWORKSIZE=32768 -DACC_DEVICE=2 -DCL_OPTIMIZATIONS=\"\"
+// run: leibnizCL_D2_double STEPS [tune], tuned parameters are kept in cl_tuning.db and read at startup
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,9 +37,12 @@ typedef struct {
 
 ocl_parameters cl_param;
 
+// steps per work-item, overridden by the tuning database (see tuneCL), as is REDUCTION_WORKGROUP
+int workSize = WORKSIZE;
+
 
 REAL leibnizCL(unsigned long long STEPS) {
-    int NBRTHREADS = STEPS / WORKSIZE;
+    int NBRTHREADS = STEPS / workSize;
 
     // initialize ocl device
     cl.id = cluInitDevice(ACC_DEVICE, &cl.ctx, &cl.queue);
@@ -46,7 +50,7 @@ REAL leibnizCL(unsigned long long STEPS) {
 
     // create kernels from source
     char tmp[1024];
-    sprintf(tmp, "%s -DREAL=%s -DWORKSIZE=%d", CL_OPTIMIZATIONS, REAL_STRING, WORKSIZE);
+    sprintf(tmp, "%s -DREAL=%s -DWORKSIZE=%d", CL_OPTIMIZATIONS, REAL_STRING, workSize);
     cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
     cl.kernel_leibniz = clCreateKernel(cl.prog, "leibniz", &err);
     CLU_ERRCHECK(err, "could not create kernel");
@@ -106,31 +110,118 @@ REAL leibnizCL(unsigned long long STEPS) {
     return result * 4;
 }
 
+// autotuning: sweeps steps per work-item and work group size of the reduction for STEPS on this device, timed with profiling events.
+// The fastest values are applied and stored in the tuning database, later runs with the same STEPS read them at startup.
+void tuneCL(unsigned long long STEPS, const char* shape) {
+    cl_int err;
+    size_t maxWorkGroupSize;
+    CLU_ERRCHECK(clGetDeviceInfo(cl.id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL), "Error getting \"max work group size\" info");
+
+    cl_ulong best = ~0ull;
+    int bestWorkSize = workSize, bestReductionWorkGroup = REDUCTION_WORKGROUP;
+    for (int ws = 256; ws <= 65536; ws *= 4) {
+        unsigned long long steps = (STEPS + ws - 1) / ws * ws;
+        if (steps / ws > INT_MAX / 2)
+            continue;
+        int NBRTHREADS = steps / ws;
+
+        char tmp[1024];
+        sprintf(tmp, "%s -DREAL=%s -DWORKSIZE=%d", CL_OPTIMIZATIONS, REAL_STRING, ws);
+        cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
+        cl.kernel_leibniz = clCreateKernel(cl.prog, "leibniz", &err);
+        CLU_ERRCHECK(err, "could not create kernel");
+        cl.kernel_reduction = clCreateKernel(cl.prog, "reduction", &err);
+        CLU_ERRCHECK(err, "could not create kernel");
+        cl_param.subSums = clCreateBuffer(cl.ctx, CL_MEM_READ_WRITE, NBRTHREADS*SIZEOF_CL_REAL, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer");
+        cl_param.results = clCreateBuffer(cl.ctx, CL_MEM_WRITE_ONLY, NBRTHREADS*SIZEOF_CL_REAL, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer");
+        cl_param.globalWorkGroupSize[0] = NBRTHREADS;
+
+        for (int rwg = 32; rwg <= 256; rwg *= 2) {
+            if ((size_t)rwg > maxWorkGroupSize || NBRTHREADS % rwg != 0)
+                continue;
+            cl_param.localWorkGroupSize[0] = rwg;
+            cluSetKernelArguments(cl.kernel_leibniz, 1, sizeof(cl_mem), (void*)&cl_param.subSums);
+            cluSetKernelArguments(cl.kernel_reduction, 3, sizeof(cl_mem), (void*)&cl_param.subSums, rwg*SIZEOF_CL_REAL, NULL, sizeof(cl_mem), (void*)&cl_param.results);
+
+            // best of 3 runs after a warm-up
+            cl_ulong time = ~0ull;
+            for (int run = 0; run < 4; ++run) {
+                cl_event events[2];
+                CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, cl.kernel_leibniz, 1, NULL, cl_param.globalWorkGroupSize, NULL, 0, NULL, &events[0]), "Failed to enqueue kernel");
+                CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, cl.kernel_reduction, 1, NULL, cl_param.globalWorkGroupSize, cl_param.localWorkGroupSize, 0, NULL, &events[1]), "Failed to enqueue kernel");
+                CLU_ERRCHECK(clWaitForEvents(2, events), "Failed to wait for kernels");
+                cl_ulong duration = cluEventDurationNs(events[0]) + cluEventDurationNs(events[1]);
+                if (run > 0 && duration < time)
+                    time = duration;
+                err = clReleaseEvent(events[0]);
+                err |= clReleaseEvent(events[1]);
+                CLU_ERRCHECK(err, "Failed to release events");
+            }
+            printf("  worksize %5d, reduction work group size %3d: %12llu ns\n", ws, rwg, (unsigned long long)time);
+            if (time < best) {
+                best = time;
+                bestWorkSize = ws;
+                bestReductionWorkGroup = rwg;
+            }
+        }
+
+        err = clReleaseKernel(cl.kernel_leibniz);
+        err |= clReleaseKernel(cl.kernel_reduction);
+        err |= clReleaseProgram(cl.prog);
+        err |= clReleaseMemObject(cl_param.subSums);
+        err |= clReleaseMemObject(cl_param.results);
+        CLU_ERRCHECK(err, "Failed during ocl cleanup");
+    }
+
+    workSize = bestWorkSize;
+    REDUCTION_WORKGROUP = bestReductionWorkGroup;
+    char params[128];
+    sprintf(params, "WORKSIZE=%d REDUCTION_WORKGROUP=%d", workSize, REDUCTION_WORKGROUP);
+    cluTuningStore(CLU_TUNING_DATABASE, cl.id, "leibniz", shape, params, best);
+    printf("  tuned: %s\n\n", params);
+}
+
 int main(int argc, char** argv) {
     unsigned long long start_time = time_ms();
-    if (argc == 2) {
+    if (argc >= 2)
         STEPS = atol(argv[1]);
-        if (STEPS % WORKSIZE != 0)
-            STEPS += WORKSIZE - (STEPS % WORKSIZE);
+    int tune = argc >= 3 && strcmp(argv[2], "tune") == 0; // usage: leibnizCL STEPS tune
+
+	cl.id = cluInitDevice(ACC_DEVICE, &cl.ctx, &cl.queue);
+    char shape[128], params[256];
+    sprintf(shape, "STEPS=%llu REAL=%s", STEPS, REAL_STRING);
+    if (cluTuningLookup(CLU_TUNING_DATABASE, cl.id, "leibniz", shape, params, sizeof(params))) {
+        workSize = cluTuningParameter(params, "WORKSIZE", WORKSIZE);
+        REDUCTION_WORKGROUP = cluTuningParameter(params, "REDUCTION_WORKGROUP", REDUCTION_WORKGROUP);
+    }
+    if (tune) {
+        printf("Autotuning for %llu steps (%s):\n", STEPS, REAL_STRING);
+        tuneCL(STEPS, shape);
+    }
+
+    if (argc >= 2) {
+        if (STEPS % workSize != 0)
+            STEPS += workSize - (STEPS % workSize);
         if (STEPS <= 0)
-            STEPS = WORKSIZE;
+            STEPS = workSize;
 
-        if (STEPS/WORKSIZE > INT_MAX/2) {
-            printf("worksize too small: %d\n", WORKSIZE);
+        if (STEPS/workSize > INT_MAX/2) {
+            printf("worksize too small: %d\n", workSize);
             return EXIT_FAILURE;
         }
 
         printf("Leibniz forumula, using userspecified number of steps: %llu, data type %s, %s\n", STEPS, REAL_STRING, strcmp(CL_OPTIMIZATIONS, "") == 0 ? "with optimizations (-O3)" : "without optimizations (-O0)");
-        printf("  (adjusted to be a multiple of Worksize %d)\n", WORKSIZE);
+        printf("  (adjusted to be a multiple of Worksize %d)\n", workSize);
     } else {
         printf("Leibniz formula, using default number of steps: %llu, data type %s, %s\n", STEPS, REAL_STRING, strcmp(CL_OPTIMIZATIONS, "") == 0 ? "with optimizations (-O3)" : "without optimizations (-O0)");
     }
     initLogging(__FILE__, argv[0], "executable,number_type,STEPS,WORKSIZE,first_init_ms,second_ms,total_ms");
     writeCSV(REAL_STRING);
     writeCSVllu(STEPS);
-    writeCSVllu(WORKSIZE);
+    writeCSVllu(workSize);
 
-	cl.id = cluInitDevice(ACC_DEVICE, &cl.ctx, &cl.queue);
 	printf("\n%s\n\n", cluPrintDeviceAndVendor(cl.id));
 
 
@@ -3,6 +3,7 @@
 //  -tiled version
 // author: Schuchardt Martin, csap9442
 // compile: gcc -O3 -std=c99 -Wall -Werror -lm mmul.c mmulCL.c -I../include -lOpenCL -o mmulCL_D1_int -DNUMBER_TYPE=0 -DWORKGROUPSIZE=64 -DTILESIZE=16  -DACC_DEVICE=1 -DVERIFY=1 -DCL_OPTIMIZATIONS=\"\"
+// run: mmulCL_D1_int N [tune], tuned parameters are kept in cl_tuning.db and read at startup
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,10 @@ typedef struct {
 
 ocl_parameters cl_param;
 
+// kernel parameters, overridden by the tuning database (see tuneCL)
+int tileSize = TILESIZE;
+int naiveWorkGroupSize = 0; // local work size of matrix_mulNaive, 0 lets the implementation decide
+
 
 
 void multiplyStupidCL(REAL *A, REAL *B, REAL *C) {
@@ -47,7 +52,7 @@ void multiplyStupidCL(REAL *A, REAL *B, REAL *C) {
 
 	// create kernels from source
 	char tmp[1024];
-	sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, TILESIZE); // TILESIZE unused for naive matrix multiplication
+	sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, tileSize); // TILESIZE unused for naive matrix multiplication
 
 	cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
 	cl.kernel = clCreateKernel(cl.prog, "matrix_mulStupid", &err);
@@ -102,7 +107,7 @@ void multiplyNaiveCL(REAL *A, REAL *B, REAL *C) {
 
 	// create kernels from source
 	char tmp[1024];
-	sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, TILESIZE); // TILESIZE unused for naive matrix multiplication
+	sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, tileSize); // TILESIZE unused for naive matrix multiplication
 
 	cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
 	cl.kernel = clCreateKernel(cl.prog, "matrix_mulNaive", &err);
@@ -127,7 +132,9 @@ void multiplyNaiveCL(REAL *A, REAL *B, REAL *C) {
 
 	// prepare kernel
 	cluSetKernelArguments(cl.kernel, 3, sizeof(cl_mem), (void*)&cl_param.A, sizeof(cl_mem), (void*)&cl_param.B, sizeof(cl_mem),(void*)&cl_param.C);
-	CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, cl.kernel, 2, NULL, cl_param.globalWorkGroupSize, NULL, 0, NULL, NULL), "Failed to enqueue scan kernel");
+	cl_param.localWorkGroupSize[0] = naiveWorkGroupSize;
+	cl_param.localWorkGroupSize[1] = 1;
+	CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, cl.kernel, 2, NULL, cl_param.globalWorkGroupSize, naiveWorkGroupSize ? cl_param.localWorkGroupSize : NULL, 0, NULL, NULL), "Failed to enqueue scan kernel");
 
 	// readback data
 	CLU_ERRCHECK(clEnqueueReadBuffer(cl.queue, cl_param.C, CL_TRUE, 0, N*N*SIZEOF_REAL, C, 0, NULL, NULL), "Failed to read new positions");
@@ -157,14 +164,14 @@ void multiplyTilingCL(REAL *A, REAL *B, REAL *C) {
 
     // create kernels from source
     char tmp[1024];
-    sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, TILESIZE);
+    sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, tileSize);
 
     cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
     cl.kernel = clCreateKernel(cl.prog, "matrix_mulTiling", &err);
     CLU_ERRCHECK(err, "could not create kernel");
 
     cl_param.globalWorkGroupSize[0] = cl_param.globalWorkGroupSize[1] = N;
-    cl_param.localWorkGroupSize[0] = cl_param.localWorkGroupSize[1] = TILESIZE;
+    cl_param.localWorkGroupSize[0] = cl_param.localWorkGroupSize[1] = tileSize;
 
     // measuring time for calculation only, no prerequisites
     unsigned long long start_time = time_ms();
@@ -206,42 +213,144 @@ void multiplyTilingCL(REAL *A, REAL *B, REAL *C) {
     CLU_ERRCHECK(err, "Failed during ocl cleanup");
 }
 
+// best of 3 runs after a warm-up, device time measured with profiling events
+cl_ulong timeKernelCL(cl_kernel kernel, size_t *local) {
+    cl_ulong best = ~0ull;
+    for (int run = 0; run < 4; ++run) {
+        cl_event event;
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, kernel, 2, NULL, cl_param.globalWorkGroupSize, local, 0, NULL, &event), "Failed to enqueue kernel");
+        CLU_ERRCHECK(clWaitForEvents(1, &event), "Failed to wait for kernel");
+        if (run > 0 && cluEventDurationNs(event) < best)
+            best = cluEventDurationNs(event);
+        CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
+    }
+    return best;
+}
+
+// autotuning: sweeps the local work size of matrix_mulNaive and the tile size of matrix_mulTiling for N on this device.
+// The fastest values are applied and stored in the tuning database, later runs with the same N read them at startup.
+void tuneCL(REAL *A, REAL *B) {
+    cl_int err;
+    size_t maxWorkGroupSize;
+    CLU_ERRCHECK(clGetDeviceInfo(cl.id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL), "Error getting \"max work group size\" info");
+
+    cl_param.A = clCreateBuffer(cl.ctx, CL_MEM_READ_ONLY, N*N*SIZEOF_CL_REAL, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer");
+    cl_param.B = clCreateBuffer(cl.ctx, CL_MEM_READ_ONLY, N*N*SIZEOF_CL_REAL, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer");
+    cl_param.C = clCreateBuffer(cl.ctx, CL_MEM_WRITE_ONLY, N*N*SIZEOF_CL_REAL, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer");
+    err = clEnqueueWriteBuffer(cl.queue, cl_param.A, CL_FALSE, 0, N*N*SIZEOF_CL_REAL, A, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(cl.queue, cl_param.B, CL_TRUE, 0, N*N*SIZEOF_CL_REAL, B, 0, NULL, NULL);
+    CLU_ERRCHECK(err, "Failed to write buffers");
+    cl_param.globalWorkGroupSize[0] = cl_param.globalWorkGroupSize[1] = N;
+
+    char tmp[1024];
+    cl_ulong bestNaive = ~0ull, bestTiling = ~0ull;
+    int bestWorkGroupSize = naiveWorkGroupSize, bestTileSize = tileSize;
+    for (int ts = 4; ts <= 32; ts *= 2) {
+        if (N % ts != 0 || ts >= N || (size_t)(ts*ts) > maxWorkGroupSize)
+            continue;
+        sprintf(tmp, "%s -DREAL=%s -DN=%i -DTILESIZE=%i", CL_OPTIMIZATIONS, REAL_STRING, N, ts);
+        cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME, tmp);
+
+        // the naive kernel does not depend on the tile size, measure it once
+        if (bestNaive == ~0ull) {
+            cl.kernel = clCreateKernel(cl.prog, "matrix_mulNaive", &err);
+            CLU_ERRCHECK(err, "could not create kernel");
+            cluSetKernelArguments(cl.kernel, 3, sizeof(cl_mem), (void*)&cl_param.A, sizeof(cl_mem), (void*)&cl_param.B, sizeof(cl_mem), (void*)&cl_param.C);
+            for (int wg = 0; wg <= 256; wg = wg ? wg * 2 : 8) {
+                if ((size_t)wg > maxWorkGroupSize || (wg && N % wg != 0))
+                    continue;
+                cl_param.localWorkGroupSize[0] = wg;
+                cl_param.localWorkGroupSize[1] = 1;
+                cl_ulong time = timeKernelCL(cl.kernel, wg ? cl_param.localWorkGroupSize : NULL);
+                printf("  matrix_mulNaive,  work group size %3d: %10llu ns\n", wg, (unsigned long long)time);
+                if (time < bestNaive) {
+                    bestNaive = time;
+                    bestWorkGroupSize = wg;
+                }
+            }
+            CLU_ERRCHECK(clReleaseKernel(cl.kernel), "Failed to release kernel");
+        }
+
+        cl.kernel = clCreateKernel(cl.prog, "matrix_mulTiling", &err);
+        CLU_ERRCHECK(err, "could not create kernel");
+        cluSetKernelArguments(cl.kernel, 3, sizeof(cl_mem), (void*)&cl_param.A, sizeof(cl_mem), (void*)&cl_param.B, sizeof(cl_mem), (void*)&cl_param.C);
+        cl_param.localWorkGroupSize[0] = cl_param.localWorkGroupSize[1] = ts;
+        cl_ulong time = timeKernelCL(cl.kernel, cl_param.localWorkGroupSize);
+        printf("  matrix_mulTiling, tile size %2d:        %10llu ns\n", ts, (unsigned long long)time);
+        if (time < bestTiling) {
+            bestTiling = time;
+            bestTileSize = ts;
+        }
+        err = clReleaseKernel(cl.kernel);
+        err |= clReleaseProgram(cl.prog);
+        CLU_ERRCHECK(err, "Failed to release kernel");
+    }
+
+    err = clReleaseMemObject(cl_param.A);
+    err |= clReleaseMemObject(cl_param.B);
+    err |= clReleaseMemObject(cl_param.C);
+    CLU_ERRCHECK(err, "Failed during ocl cleanup");
+
+    naiveWorkGroupSize = bestWorkGroupSize;
+    tileSize = bestTileSize;
+    sprintf(tmp, "N=%d REAL=%s", N, REAL_STRING);
+    char params[128];
+    sprintf(params, "TILESIZE=%d WORKGROUPSIZE=%d", tileSize, naiveWorkGroupSize);
+    cluTuningStore(CLU_TUNING_DATABASE, cl.id, "matrix_mul", tmp, params, bestTiling);
+    printf("  tuned: %s\n\n", params);
+}
+
 int main(int argc, char** argv) {
     unsigned long long start_time = time_ms();
-    if (argc == 2) {
+    if (argc >= 2) {
         N = atoi(argv[1]);
         if (N % WORKGROUPSIZE != 0)
             N += WORKGROUPSIZE - (N % WORKGROUPSIZE);
         if (N <= 0)
             N = WORKGROUPSIZE;
     }
-    if (N % TILESIZE != 0 || TILESIZE >= N) {
-        printf("ERROR: tilesize (%d) has to be an integer divisor of N(%d).\n", TILESIZE, N);
+    int tune = argc >= 3 && strcmp(argv[2], "tune") == 0; // usage: mmulCL N tune
+
+	cl.id = cluInitDevice(ACC_DEVICE, &cl.ctx, &cl.queue);
+    char shape[128], params[256];
+    sprintf(shape, "N=%d REAL=%s", N, REAL_STRING);
+    if (cluTuningLookup(CLU_TUNING_DATABASE, cl.id, "matrix_mul", shape, params, sizeof(params))) {
+        tileSize = cluTuningParameter(params, "TILESIZE", TILESIZE);
+        naiveWorkGroupSize = cluTuningParameter(params, "WORKGROUPSIZE", 0);
+    }
+
+    REAL *A = malloc(SIZEOF_REAL*N*N);
+    REAL *B = malloc(SIZEOF_REAL*N*N);
+    REAL *C = malloc(SIZEOF_REAL*N*N);
+	initMatrices(A, B);
+    if (tune) {
+        printf("Autotuning for %dx%d matrice (%s):\n", N, N, REAL_STRING);
+        tuneCL(A, B);
+    }
+
+    if (N % tileSize != 0 || tileSize >= N) {
+        printf("ERROR: tilesize (%d) has to be an integer divisor of N(%d).\n", tileSize, N);
         return EXIT_FAILURE;
     }
-    if (TILESIZE*TILESIZE > 1024) {
-        printf("ERROR: tilesize*tilesize (%d*%d) may not exceed 1024.\n", TILESIZE, TILESIZE);
+    if (tileSize*tileSize > 1024) {
+        printf("ERROR: tilesize*tilesize (%d*%d) may not exceed 1024.\n", tileSize, tileSize);
         return EXIT_FAILURE;
     }
     initLogging(__FILE__, argv[0], "executable,number_type,N_dimension,WORKGROUPSIZE,TILESIZE,stupid_first_init_ms,stupid_second_ms,naive_first_init_ms,naive_second_ms,tiling_init_first_ms,tiling_second_ms,total_ms");
     writeCSV(REAL_STRING);
     writeCSVllu((unsigned long long) N);
     writeCSVllu(WORKGROUPSIZE);
-    writeCSVllu(TILESIZE);
+    writeCSVllu(tileSize);
 
     printf("Matrix multiplication, using %dx%d matrice (%s), %s\n", N, N, REAL_STRING, strcmp(CL_OPTIMIZATIONS, "")==0?"with optimizations (-O3)":"without optimizations (-O0)");
     printf("  (adjusted to be a multiple of Workgroupsize %d)\n", WORKGROUPSIZE);
-    printf("Tilesize: %d\n\n", TILESIZE);
-	cl.id = cluInitDevice(ACC_DEVICE, &cl.ctx, &cl.queue);
+    printf("Tilesize: %d, work group size of naive kernel: %d%s\n\n", tileSize, naiveWorkGroupSize, naiveWorkGroupSize ? "" : " (implementation defined)");
 	printf("%s\n\n", cluPrintDeviceAndVendor(cl.id));
 
-
-    REAL *A = malloc(SIZEOF_REAL*N*N);
-    REAL *B = malloc(SIZEOF_REAL*N*N);
-    REAL *C = malloc(SIZEOF_REAL*N*N);
-
 	printf("Stupid-naive matrix-multiplication:\n");
-	initMatrices(A, B);
 
 	printf("  first run - init\n");
 	multiplyStupidCL(A, B, C);
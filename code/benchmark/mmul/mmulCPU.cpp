@@ -0,0 +1,88 @@
+// Matrix multiplication on the CPU.
+//  -naive version (formerly multiplyChunkCPU of the distributor)
+//  -cache-blocked, vectorized and multithreaded engine of the distributor (see ../../distributor/mmulCPU.h)
+// author: Schuchardt Martin, csap9442
+// compile: gcc -O3 -std=c99 -Wall -Werror mmul.c -c -DNUMBER_TYPE=0 -DVERIFY=1 && g++ -O3 -std=c++11 -Wall -Werror -pthread mmul.o mmulCPU.cpp -o mmulCPU_int -DNUMBER_TYPE=0 -DVERIFY=1
+// run: mmulCPU_int N [threads], threads defaults to all cores
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "mmul.h"
+}
+#include "../../utils/time_ms.h"
+#include "../../distributor/mmulCPU.h"
+
+
+void multiplyNaive(REAL *A, REAL *B, REAL *C) {
+    for (int i = 0; i < N; ++i) {
+        for (int j = 0; j < N; ++j) {
+            REAL sum = 0;
+            for (int k = 0; k < N; ++k) {
+                sum += *(A + i*N + k) * *(B + k*N + j);
+            }
+            *(C + i*N + j) = sum;
+        }
+    }
+}
+
+void multiplyEngine(REAL *A, REAL *B, REAL *C) {
+    gemmCPU(N, N, N, A, N, B, N, C, N);
+}
+
+// runs 'multiply' twice (the first run includes thread start and page faults), logs both durations and the throughput of the second run
+void measure(const char* name, void (*multiply)(REAL*, REAL*, REAL*), REAL *A, REAL *B, REAL *C) {
+    printf("%s:\n", name);
+    for (int run = 0; run < 2; ++run) {
+        zeroMatrix(C);
+        unsigned long long start = time_ms();
+        multiply(A, B, C);
+        unsigned long long duration = time_ms() - start;
+        writeCSVllu(duration);
+        printf("  %s run: %6llu ms", run == 0 ? "first " : "second", duration);
+        if (run == 1 && duration > 0)
+            printf(", %.2f GFLOP/s", 2.0 * N * N * N / duration / 1e6);
+        printf("\n");
+        if (run == 0)
+            testResults(A, C);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned long long start_time = time_ms();
+    if (argc >= 2)
+        N = atoi(argv[1]);
+    if (N <= 0)
+        N = 1024;
+    if (argc >= 3)
+        mmulCPUThreads = atoi(argv[2]);
+
+    REAL *A = (REAL*)malloc(SIZEOF_REAL*N*N);
+    REAL *B = (REAL*)malloc(SIZEOF_REAL*N*N);
+    REAL *C = (REAL*)malloc(SIZEOF_REAL*N*N);
+    initMatrices(A, B);
+
+    char codeFileName[] = __FILE__;
+    char header[] = "executable,number_type,N_dimension,engine,threads,naive_first_ms,naive_second_ms,engine_first_ms,engine_second_ms,total_ms";
+    initLogging(codeFileName, argv[0], header);
+    writeCSV(REAL_STRING);
+    writeCSVllu((unsigned long long) N);
+    writeCSV(MMUL_CPU_ENGINE_NAMES[gemmCPUEngine<REAL>()]);
+    writeCSVllu(CPUThreadPool::get().size());
+
+    printf("Matrix multiplication on the CPU, using %dx%d matrice (%s)\n", N, N, REAL_STRING);
+    printf("Engine: %s micro-kernel, %u threads\n\n", MMUL_CPU_ENGINE_NAMES[gemmCPUEngine<REAL>()], CPUThreadPool::get().size());
+
+    measure("Naive matrix-multiplication", multiplyNaive, A, B, C);
+    measure("\nBlocked matrix-multiplication", multiplyEngine, A, B, C);
+
+    free(A);
+    free(B);
+    free(C);
+    unsigned long long duration = time_ms()-start_time;
+    printf("total runtime: \t%6llu ms \n", duration);
+    writeCSVllu(duration);
+    writeCSV("\n");
+    return EXIT_SUCCESS;
+}
@@ -6,6 +6,20 @@
 
 const std::string CHECKPOINT_FILE("checkpoint.sav");
 
+// atomics (shared with concurrently running nodes) are stored by value
+template<typename T>
+void saveAtomic(const std::atomic<T> &value, std::ofstream &ofs) {
+	const T v = value;
+	ofs.write((char*)&v, sizeof(v));
+}
+
+template<typename T>
+void readAtomic(std::atomic<T> &value, std::ifstream &ifs) {
+	T v;
+	ifs.read((char*)&v, sizeof(v));
+	value = v;
+}
+
 void saveArgument(std::pair<const std::string, Data*> &param, std::ofstream &ofs) {
 	size_t key_length = param.first.length();
 	ofs.write((char*)&key_length, sizeof(size_t));
@@ -13,15 +27,21 @@ void saveArgument(std::pair<const std::string, Data*> &param, std::ofstream &ofs
 
 	size_t data_size_vector = param.second->size().size();
 	ofs.write((char*)&data_size_vector, sizeof(data_size_vector));
-	unsigned sizeTotal = 1;
+	std::size_t sizeTotal = 1;
 	for (auto size : param.second->size()) {
 		sizeTotal *= size;
 	}
-	ofs.write((char*)&param.second->size()[0], data_size_vector * sizeof(unsigned));
+	ofs.write((char*)&param.second->size()[0], data_size_vector * sizeof(std::size_t));
 
 	unsigned data_size_t = param.second->sizeOfData();
 	ofs.write((char*)&data_size_t, sizeof(data_size_t));
 
+	if (param.second->isView()) { // restored as contiguous data object
+		std::vector<char> packed(sizeTotal*data_size_t);
+		param.second->copyTo(packed.data());
+		ofs.write(packed.data(), packed.size());
+		return;
+	}
 	void *data = param.second->get();
 	ofs.write((char*)data, sizeTotal*data_size_t);
 }
@@ -37,11 +57,11 @@ std::pair<char*, Data*> readArgument(std::ifstream &ifs) {
 	size_t data_size_vector;
 	ifs.read((char*)&data_size_vector, sizeof(data_size_vector));
 
-	std::vector<unsigned> sizes;
+	std::vector<std::size_t> sizes;
 	sizes.resize(data_size_vector);
 
-	unsigned sizeTotal = 1;
-	ifs.read((char*)&sizes[0], data_size_vector * sizeof(unsigned));
+	std::size_t sizeTotal = 1;
+	ifs.read((char*)&sizes[0], data_size_vector * sizeof(std::size_t));
 	for (auto size : sizes) {
 		sizeTotal *= size;
 	}
@@ -79,14 +99,14 @@ bool Checkpoint::save(Distributor *distributor) { // IMPLEMENT use save methods
 	ofs.write((char*)&distributor->clusterCreation, sizeof(distributor->clusterCreation));
 	ofs.write((char*)&distributor->cluster_restart_block_time_unit, sizeof(distributor->cluster_restart_block_time_unit));
 	
-	ofs.write((char*)&Data::duration_bcast_M_to_W, sizeof(Data::duration_bcast_M_to_W));
-	ofs.write((char*)&Data::duration_bcast_W_to_W, sizeof(Data::duration_bcast_W_to_W));
-	ofs.write((char*)&Data::duration_send_M_to_W, sizeof(Data::duration_send_M_to_W));
-	ofs.write((char*)&Data::duration_send_W_to_M, sizeof(Data::duration_send_W_to_M));
-	ofs.write((char*)&Data::duration_send_W_to_W, sizeof(Data::duration_send_W_to_W));
-	ofs.write((char*)&Data::duration_recv_W_from_M, sizeof(Data::duration_recv_W_from_M));
-	ofs.write((char*)&Data::duration_recv_M_from_W, sizeof(Data::duration_recv_M_from_W));
-	ofs.write((char*)&Data::duration_recv_W_from_W, sizeof(Data::duration_recv_W_from_W));
+	saveAtomic(Data::duration_bcast_M_to_W, ofs);
+	saveAtomic(Data::duration_bcast_W_to_W, ofs);
+	saveAtomic(Data::duration_send_M_to_W, ofs);
+	saveAtomic(Data::duration_send_W_to_M, ofs);
+	saveAtomic(Data::duration_send_W_to_W, ofs);
+	saveAtomic(Data::duration_recv_W_from_M, ofs);
+	saveAtomic(Data::duration_recv_M_from_W, ofs);
+	saveAtomic(Data::duration_recv_W_from_W, ofs);
 
 	size_t arguments_size = distributor->getArguments().size();
 	ofs.write((char*)&arguments_size, sizeof(size_t));
@@ -98,7 +118,7 @@ bool Checkpoint::save(Distributor *distributor) { // IMPLEMENT use save methods
 		ofs.write((char*)&node->start, sizeof(node->start));
 		ofs.write((char*)&node->end, sizeof(node->end));
 
-		ofs.write((char*)&node->finished, sizeof(bool));
+		saveAtomic(node->finished, ofs);
 
 		ofs.write((char*)&node->LOOP_COUNTER, sizeof(node->LOOP_COUNTER));
 		ofs.write((char*)&node->TOTAL_COUNT, sizeof(node->TOTAL_COUNT));
@@ -145,14 +165,14 @@ bool Checkpoint::read(Distributor *distributor) {
 		ifs.read((char*)&distributor->clusterCreation, sizeof(distributor->clusterCreation));
 		ifs.read((char*)&distributor->cluster_restart_block_time_unit, sizeof(distributor->cluster_restart_block_time_unit));
 
-		ifs.read((char*)&Data::duration_bcast_M_to_W, sizeof(Data::duration_bcast_M_to_W));
-		ifs.read((char*)&Data::duration_bcast_W_to_W, sizeof(Data::duration_bcast_W_to_W));
-		ifs.read((char*)&Data::duration_send_M_to_W, sizeof(Data::duration_send_M_to_W));
-		ifs.read((char*)&Data::duration_send_W_to_M, sizeof(Data::duration_send_W_to_M));
-		ifs.read((char*)&Data::duration_send_W_to_W, sizeof(Data::duration_send_W_to_W));
-		ifs.read((char*)&Data::duration_recv_W_from_M, sizeof(Data::duration_recv_W_from_M));
-		ifs.read((char*)&Data::duration_recv_M_from_W, sizeof(Data::duration_recv_M_from_W));
-		ifs.read((char*)&Data::duration_recv_W_from_W, sizeof(Data::duration_recv_W_from_W));
+		readAtomic(Data::duration_bcast_M_to_W, ifs);
+		readAtomic(Data::duration_bcast_W_to_W, ifs);
+		readAtomic(Data::duration_send_M_to_W, ifs);
+		readAtomic(Data::duration_send_W_to_M, ifs);
+		readAtomic(Data::duration_send_W_to_W, ifs);
+		readAtomic(Data::duration_recv_W_from_M, ifs);
+		readAtomic(Data::duration_recv_M_from_W, ifs);
+		readAtomic(Data::duration_recv_W_from_W, ifs);
 
 		size_t arguments_size;
 		ifs.read((char*)&arguments_size, sizeof(size_t));
@@ -166,7 +186,7 @@ bool Checkpoint::read(Distributor *distributor) {
 			ifs.read((char*)&node->start, sizeof(node->start));
 			ifs.read((char*)&node->end, sizeof(node->end));
 
-			ifs.read((char*)&node->finished, sizeof(bool));
+			readAtomic(node->finished, ifs);
 
 			ifs.read((char*)&node->LOOP_COUNTER, sizeof(node->LOOP_COUNTER));
 			ifs.read((char*)&node->TOTAL_COUNT, sizeof(node->TOTAL_COUNT));
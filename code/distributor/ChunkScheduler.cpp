@@ -0,0 +1,157 @@
+// chunk scheduler: splits the items of a node's loop into chunks for the workers, static, guided, factoring or adaptive to the measured throughput of each worker
+// author: Schuchardt Martin, csap9442
+
+#include "ChunkScheduler.h"
+#include "Distributor.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+const char* const ChunkScheduler::POLICY_NAMES[POLICIES] = { "static", "guided", "factoring", "adaptive" };
+
+
+ChunkScheduler::POLICY ChunkScheduler::parsePolicy(const std::string &name) {
+	for (unsigned p = 0; p < POLICIES; ++p)
+		if (name == POLICY_NAMES[p])
+			return static_cast<POLICY>(p);
+	return GUIDED;
+}
+
+ChunkScheduler::ChunkScheduler(Node &n, Distributor &d, unsigned _total, POLICY _policy, unsigned _minChunk, unsigned _maxChunk)
+	: node(n), distributor(d), total(_total), policy(_policy), workers(std::max(d.getSize(), 1u)), minChunk(std::max(_minChunk, 1u)), maxChunk(std::max(_maxChunk, std::max(_minChunk, 1u))) {
+	node.activateAutoResize(total);
+}
+
+ChunkScheduler::~ChunkScheduler() {
+	distributor.waitForWorkers(cancels);
+	for (auto data : cancelData)
+		delete data;
+}
+
+unsigned ChunkScheduler::chunkSize(int worker) {
+	const unsigned remaining = total - *node.getLoopCounter();
+	unsigned result = 0;
+	switch (policy) {
+	case STATIC:
+		result = total / workers;
+		break;
+	case GUIDED:
+		result = (remaining + workers - 1) / workers;
+		break;
+	case FACTORING:
+		if (batchLeft == 0) {
+			batchChunk = (remaining + 2 * workers - 1) / (2 * workers);
+			batchLeft = workers;
+		}
+		--batchLeft;
+		result = batchChunk;
+		break;
+	case ADAPTIVE: {
+		// half of the remaining items per batch, shared by throughput. Workers without measurement count as average
+		double sum = 0;
+		unsigned measured = 0;
+		for (unsigned w = 0; w < workers; ++w)
+			if (distributor.getThroughput(w) > 0) {
+				sum += distributor.getThroughput(w);
+				++measured;
+			}
+		double share = 1.0 / workers;
+		if (measured > 0) {
+			const double average = sum / measured;
+			const double own = distributor.getThroughput(worker) > 0 ? distributor.getThroughput(worker) : average;
+			share = own / (sum + average * (workers - measured));
+		}
+		result = static_cast<unsigned>(remaining / 2.0 * share + 0.5);
+		break;
+	}
+	default:
+		assert(false);
+	}
+	if (policy != STATIC)
+		result = std::max(result, minChunk);
+	return std::min(std::min(std::max(result, 1u), maxChunk), remaining);
+}
+
+ChunkScheduler::Chunk ChunkScheduler::next(int worker) {
+	assert(!done() && worker >= 0 && static_cast<unsigned>(worker) < workers);
+	if (!retry.empty()) {
+		Chunk result = retry.front();
+		retry.pop_front();
+		workersOf[result.first] = { worker };
+		node.addOutput(indentLogText("rows " + std::to_string(result.first) + "-" + std::to_string(result.first + result.count - 1) + " of a lost worker handed out again to worker " + std::to_string(worker)));
+		return result;
+	}
+	Chunk result = { position(), chunkSize(worker) };
+	*node.getLoopCounter() += result.count;
+	pending[result.first] = result.count;
+	workersOf[result.first] = { worker };
+	return result;
+}
+
+void ChunkScheduler::lost(int worker, const std::vector<unsigned> &chunks) {
+	for (auto first : chunks) {
+		auto pendingChunk = pending.find(first);
+		if (pendingChunk == pending.end())
+			continue;
+		auto &holders = workersOf[first];
+		holders.erase(std::remove(holders.begin(), holders.end(), worker), holders.end());
+		if (holders.empty())
+			retry.push_back({ first, pendingChunk->second });
+	}
+	for (auto duplicate = duplicates.begin(); duplicate != duplicates.end(); )
+		duplicate = duplicate->second == worker ? duplicates.erase(duplicate) : std::next(duplicate);
+}
+
+bool ChunkScheduler::speculate(Chunk &chunk, int &worker) {
+	if (speculation <= 0 || !done())
+		return false;
+
+	std::map<unsigned, unsigned> candidates; // not duplicated yet
+	for (auto &p : pending)
+		if (workersOf[p.first].size() == 1)
+			candidates.insert(p);
+	if (candidates.empty())
+		return false;
+
+	worker = distributor.speculativeWorker(&node, candidates, speculation, chunk.first);
+	if (worker == Distributor::NO_IDLE_WORKERS_AVAILABLE)
+		return false;
+	chunk.count = pending.at(chunk.first);
+	workersOf[chunk.first].push_back(worker);
+	node.addOutput(indentLogText("speculating: rows " + std::to_string(chunk.first) + "-" + std::to_string(chunk.first + chunk.count - 1) + " overdue on worker " + std::to_string(workersOf[chunk.first].front()) + ", duplicated to worker " + std::to_string(worker)));
+	return true;
+}
+
+bool ChunkScheduler::completed(unsigned first, int worker) {
+	auto range = duplicates.equal_range(first);
+	for (auto duplicate = range.first; duplicate != range.second; ++duplicate)
+		if (duplicate->second == worker) {
+			duplicates.erase(duplicate);
+			return false;
+		}
+
+	if (pending.erase(first) == 0) // the late result of a lost worker
+		return false;
+	retry.erase(std::remove_if(retry.begin(), retry.end(), [first](const Chunk &c) { return c.first == first; }), retry.end());
+	for (auto other : workersOf[first])
+		if (other != worker && !distributor.isLost(other)) {
+			duplicates.insert(std::make_pair(first, other));
+			cancelIds.push_back(first);
+			cancelData.push_back(new Data(&cancelIds.back(), { 1 }, sizeof(unsigned)));
+			cancels.push_back(cancelData.back()->isend_M_to_W(other, Data::TAGS::CANCEL_CHUNK_TAG));
+		}
+	workersOf.erase(first);
+	return true;
+}
+
+bool ChunkScheduler::Cancellations::cancelled(unsigned first) {
+	unsigned id;
+	Data id_(&id, { 1 }, sizeof(unsigned));
+	while (Data::probe_W_from_M(Data::TAGS::CANCEL_CHUNK_TAG)) {
+		id_.setSize({ 1 });
+		id_.recv_W_from_M(Data::TAGS::CANCEL_CHUNK_TAG);
+		ids.insert(id);
+	}
+	return ids.erase(first) > 0;
+}
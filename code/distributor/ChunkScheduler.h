@@ -0,0 +1,174 @@
+// chunk scheduler: splits the items of a node's loop into chunks for the workers, static, guided, factoring or adaptive to the measured throughput of each worker
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+
+#include "Distributor.h"
+
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+
+class ChunkScheduler {
+public:
+	enum POLICY {
+		STATIC,    // equal chunks of min(items/workers, maxChunk), the former fixed split
+		GUIDED,    // remaining/workers: large chunks early, shrinking toward the end
+		FACTORING, // batches of one chunk per worker, every batch hands out half of the remaining items
+		ADAPTIVE,  // factoring, but every worker gets a share of the batch proportional to its measured throughput
+		POLICIES
+	};
+	static const char* const POLICY_NAMES[POLICIES];
+	/// <returns>policy named 'name' (see POLICY_NAMES), GUIDED for unknown names</returns>
+	static POLICY parsePolicy(const std::string &name);
+
+	struct Chunk {
+		unsigned first; // first item, unique for every chunk: use it as chunk-id
+		unsigned count;
+	};
+
+private:
+	Node &node;
+	Distributor &distributor;
+	const unsigned total;
+	const POLICY policy;
+	const unsigned workers, minChunk, maxChunk;
+	unsigned batchChunk = 0, batchLeft = 0; // factoring: size and number of the chunks left in the current batch
+
+	// speculative re-execution
+	double speculation = 0;
+	std::map<unsigned, unsigned> pending; // chunks handed out without result yet: first -> count
+	std::map<unsigned, std::vector<int>> workersOf; // workers computing each pending chunk, two once it has been duplicated
+	std::multimap<unsigned, int> duplicates; // chunks with a result, still computed by another worker
+	std::deque<Chunk> retry; // chunks of lost workers, handed out again first
+	std::deque<unsigned> cancelIds; // stay in place while being sent
+	std::vector<Data*> cancelData;
+	std::vector<Data::Request> cancels;
+	static const unsigned POLL_US = 500; // checks for overdue chunks and lost workers while waiting for a result
+	std::chrono::steady_clock::time_point lastPoll;
+
+	unsigned chunkSize(int worker);
+	// while waiting for a result, every POLL_US: hands out the chunks of a newly lost worker again and sends duplicates of overdue chunks, see receiveResult
+	template<typename Send>
+	void poll(Send send) {
+		if (std::chrono::steady_clock::now() - lastPoll < std::chrono::microseconds(POLL_US)) {
+			std::this_thread::yield();
+			return;
+		}
+		lastPoll = std::chrono::steady_clock::now();
+
+		std::vector<unsigned> chunks;
+		const int lostWorker = distributor.detectLostWorker(chunks);
+		if (lostWorker != Distributor::NO_IDLE_WORKERS_AVAILABLE)
+			lost(lostWorker, chunks);
+		Chunk chunk;
+		int worker;
+		while (!retry.empty() && (worker = distributor.nextWorker(&node, position())) != Distributor::NO_IDLE_WORKERS_AVAILABLE)
+			send(next(worker), worker);
+		while (speculate(chunk, worker))
+			send(chunk, worker);
+	}
+
+public:
+	/// <summary>
+	/// Schedules 'total' items of node 'n' on the workers of 'd'. Activates the node's auto resize with 'total' and continues at its loop counter, which counts handed out items:
+	/// after a cluster restart the remaining items are scheduled only (all chunks in flight have completed before a restart).
+	/// Return chunks with Distributor::addToIdleQueue(n, worker, first, count), the adaptive policy uses the distributor's throughput estimates.
+	/// </summary>
+	/// <param name="minChunk">smallest chunk, except the last one. Large enough to keep the per message overhead low</param>
+	/// <param name="maxChunk">largest chunk, eg. the buffer size of the workers</param>
+	ChunkScheduler(Node &n, Distributor &d, unsigned total, POLICY policy, unsigned minChunk, unsigned maxChunk);
+	~ChunkScheduler();
+
+	bool done() { return *node.getLoopCounter() >= total && retry.empty(); }
+	/// <returns>true while chunks handed out have not returned a result</returns>
+	bool resultsPending() { return !pending.empty(); }
+	/// <returns>first item of the next chunk, the chunk-id to pass to Distributor::nextWorker</returns>
+	unsigned position() { return retry.empty() ? *node.getLoopCounter() : retry.front().first; }
+	/// <summary>
+	/// Hands out the next chunk, sized for 'worker', and advances the node's loop counter. Chunks of lost workers come first, they keep their size.
+	/// </summary>
+	Chunk next(int worker);
+	/// <summary>
+	/// Puts the pending chunks of a lost worker (see Distributor::detectLostWorker) back, unless another worker computes a duplicate of them.
+	/// </summary>
+	void lost(int worker, const std::vector<unsigned> &chunks);
+
+	/// <summary>
+	/// Speculative re-execution of stragglers: once all items are handed out, a chunk running longer than 'factor' times its expected duration goes to a second worker with a free slot (see Distributor::speculativeWorker).
+	/// The first result is kept, the other worker gets a cancel message (CANCEL_CHUNK_TAG with the chunk-id, see Cancellations) and its result is dropped. Chunks are computed at most twice. 0: off (default)
+	/// The chunk function has to be free of side effects then: it may run twice and the result of either run is kept.
+	/// </summary>
+	void setSpeculation(double factor) { speculation = factor; }
+	/// <returns>true and the overdue chunk and the worker for its duplicate, the worker's slot is taken already (like Distributor::nextWorker)</returns>
+	bool speculate(Chunk &chunk, int &worker);
+	/// <summary>
+	/// Receives the id of the next result from any worker into 'chunkId'. With failure detection (Distributor::setWorkerTimeout) or while chunks may be speculated it polls
+	/// and calls send(chunk, worker) in the meantime for every chunk of a lost worker handed out again and for every duplicate, otherwise it blocks.
+	/// </summary>
+	template<typename Send>
+	MPI_Status receiveResult(Data &chunkId, Send send) {
+		auto received = chunkId.irecv_M_from_W(MPI_ANY_SOURCE, Data::TAGS::CHUNK_ID_TAG);
+		MPI_Status status;
+		while (!received.test(&status)) {
+			if (distributor.getWorkerTimeout() <= 0 && (speculation <= 0 || !done()))
+				return received.wait();
+			poll(send);
+		}
+		return status;
+	}
+	/// <summary>
+	/// Waits for 'received', the result of 'worker' following its chunk-id (see receiveResult). With failure detection it polls like receiveResult: a worker may die while sending.
+	/// </summary>
+	/// <returns>false if the worker has been lost: the request is abandoned (see Distributor::abandon) and the result dropped, its chunks are handed out again. Do not call completed then</returns>
+	template<typename Send>
+	bool receiveFrom(int worker, Data::Request &received, Send send) {
+		while (!received.test()) {
+			if (distributor.getWorkerTimeout() <= 0) {
+				received.wait();
+				return true;
+			}
+			if (distributor.isLost(worker)) {
+				distributor.abandon(received);
+				return false;
+			}
+			poll(send);
+		}
+		return true;
+	}
+	/// <summary>
+	/// Records the result of chunk 'first' from 'worker' before it is passed to Distributor::addToIdleQueue, cancels its duplicate.
+	/// </summary>
+	/// <returns>false for the result of a duplicate arriving after the first one (or of a lost worker after the chunk's result): drop it and pass 0 items to addToIdleQueue</returns>
+	bool completed(unsigned first, int worker);
+	/// <summary>
+	/// Hands the duplicates still computed to Distributor::dropResult, the node does not wait for them. 'result' gives the result of a chunk as data object, one row per item (nullptr if only ids are sent).
+	/// Cancel messages to lost workers are abandoned (see Distributor::abandon).
+	/// </summary>
+	template<typename Result>
+	void dropDuplicates(Result result) {
+		for (auto &duplicate : duplicates)
+			distributor.dropResult(duplicate.second, duplicate.first, result(duplicate.first), maxChunk);
+		duplicates.clear();
+		distributor.releaseLost(cancels);
+	}
+
+	/// <summary>
+	/// Worker side of speculative re-execution: chunks the master has cancelled because another worker returned them first.
+	/// </summary>
+	class Cancellations {
+		std::set<unsigned> ids;
+	public:
+		/// <summary>
+		/// Records a cancel message received in place of a chunk-id (any tag receive, Data::getLastTag() == CANCEL_CHUNK_TAG).
+		/// </summary>
+		void add(unsigned first) { ids.insert(first); }
+		/// <returns>true if chunk 'first' has been cancelled: skip it and return its id and an empty result</returns>
+		bool cancelled(unsigned first);
+	};
+};
@@ -0,0 +1,207 @@
+// fast lossless codec for on-the-wire compression of Data transfers: byte-plane shuffle by element size followed by LZ77 (LZ4-like token format)
+// author: Schuchardt Martin, csap9442
+
+#include "Compression.h"
+#include <cstring>
+#include <cassert>
+
+// sequence: token (literal length << 4 | match length - MIN_MATCH, 15 = more length bytes follow), length bytes, literals, 2 byte offset, length bytes.
+// The last sequence has literals only.
+static const unsigned MIN_MATCH = 4;
+static const unsigned MAX_OFFSET = 65535;
+static const unsigned HASH_BITS = 14;
+
+
+static inline std::uint32_t read32(const unsigned char *p) {
+	std::uint32_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+static inline unsigned hash(std::uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// appends the extra bytes of a length that did not fit into its nibble
+static inline bool writeLength(unsigned char *&op, const unsigned char *limit, std::size_t length) {
+	for (; length >= 255; length -= 255) {
+		if (op >= limit)
+			return false;
+		*op++ = 255;
+	}
+	if (op >= limit)
+		return false;
+	*op++ = static_cast<unsigned char>(length);
+	return true;
+}
+
+static inline std::size_t readLength(const unsigned char *&ip, const unsigned char *end, std::size_t length) {
+	if (length != 15)
+		return length;
+	unsigned char b;
+	do {
+		if (ip >= end)
+			return 0;
+		b = *ip++;
+		length += b;
+	} while (b == 255);
+	return length;
+}
+
+// emits literals [anchor, ip) and, if matchLength > 0, a match. false if the output would exceed limit
+static bool emitSequence(unsigned char *&op, const unsigned char *limit, const unsigned char *anchor, const unsigned char *ip, std::size_t offset, std::size_t matchLength) {
+	const std::size_t literals = ip - anchor;
+	if (op >= limit)
+		return false;
+	unsigned char *token = op++;
+	*token = static_cast<unsigned char>((literals >= 15 ? 15 : literals) << 4);
+	if (literals >= 15 && !writeLength(op, limit, literals - 15))
+		return false;
+	if (op + literals > limit)
+		return false;
+	if (literals > 0)
+		memcpy(op, anchor, literals);
+	op += literals;
+
+	if (matchLength == 0)
+		return true;
+	if (op + 2 > limit)
+		return false;
+	*op++ = static_cast<unsigned char>(offset & 0xff);
+	*op++ = static_cast<unsigned char>(offset >> 8);
+	const std::size_t length = matchLength - MIN_MATCH;
+	*token |= static_cast<unsigned char>(length >= 15 ? 15 : length);
+	return length < 15 || writeLength(op, limit, length - 15);
+}
+
+// compresses in into out (at most outCapacity bytes), returns the compressed size or 0 if it does not fit
+static std::size_t compressLZ(const unsigned char *in, std::size_t bytes, unsigned char *out, std::size_t outCapacity) {
+	std::vector<std::uint32_t> table(1u << HASH_BITS, 0); // position + 1 of the last occurrence of a hash, 0 for none
+	const unsigned char *ip = in, *anchor = in, *end = in + bytes;
+	unsigned char *op = out;
+	const unsigned char *limit = out + outCapacity;
+
+	if (bytes >= MIN_MATCH) {
+		const unsigned char *matchLimit = end - MIN_MATCH;
+		while (ip <= matchLimit) {
+			const std::uint32_t sequence = read32(ip);
+			const unsigned h = hash(sequence);
+			const unsigned char *ref = table[h] ? in + table[h] - 1 : nullptr;
+			table[h] = static_cast<std::uint32_t>(ip - in + 1);
+			if (!ref || static_cast<std::size_t>(ip - ref) > MAX_OFFSET || read32(ref) != sequence) {
+				++ip;
+				continue;
+			}
+
+			std::size_t length = MIN_MATCH;
+			while (ip + length < end && ref[length] == ip[length])
+				++length;
+			if (!emitSequence(op, limit, anchor, ip, ip - ref, length))
+				return 0;
+			ip += length;
+			anchor = ip;
+		}
+	}
+	if (!emitSequence(op, limit, anchor, end, 0, 0))
+		return 0;
+	return op - out;
+}
+
+static bool decompressLZ(const unsigned char *in, std::size_t bytes, unsigned char *out, std::size_t rawBytes) {
+	const unsigned char *ip = in, *end = in + bytes;
+	unsigned char *op = out, *oend = out + rawBytes;
+	while (ip < end) {
+		const unsigned token = *ip++;
+		const std::size_t literals = readLength(ip, end, token >> 4);
+		if (ip + literals > end || op + literals > oend)
+			return false;
+		if (literals > 0)
+			memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+		if (op == oend)
+			break; // last sequence
+
+		if (ip + 2 > end)
+			return false;
+		const std::size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		const std::size_t length = readLength(ip, end, token & 15) + MIN_MATCH;
+		if (offset == 0 || offset > static_cast<std::size_t>(op - out) || op + length > oend)
+			return false;
+		const unsigned char *ref = op - offset;
+		for (std::size_t i = 0; i < length; ++i) // byte by byte, source and destination may overlap
+			op[i] = ref[i];
+		op += length;
+	}
+	return op == oend;
+}
+
+bool Compression::compress(const void *src, std::size_t bytes, unsigned elementSize, std::size_t maxPayload, std::vector<char> &frame) {
+	if (elementSize <= 1 || bytes % elementSize != 0)
+		elementSize = 1;
+
+	const unsigned char *in = static_cast<const unsigned char*>(src);
+	std::vector<unsigned char> shuffled;
+	if (elementSize > 1) {
+		shuffled.resize(bytes);
+		const std::size_t elements = bytes / elementSize;
+		for (std::size_t e = 0; e < elements; ++e)
+			for (unsigned b = 0; b < elementSize; ++b)
+				shuffled[b * elements + e] = in[e * elementSize + b];
+		in = shuffled.data();
+	}
+
+	frame.resize(sizeof(Header) + maxPayload);
+	const std::size_t payload = compressLZ(in, bytes, reinterpret_cast<unsigned char*>(&frame[sizeof(Header)]), maxPayload);
+	if (payload == 0)
+		return false;
+
+	Header header = { bytes, CODEC_LZ, elementSize };
+	memcpy(&frame[0], &header, sizeof(header));
+	frame.resize(sizeof(Header) + payload);
+	return true;
+}
+
+void Compression::store(const void *src, std::size_t bytes, std::vector<char> &frame) {
+	frame.resize(sizeof(Header) + bytes);
+	Header header = { bytes, CODEC_RAW, 1 };
+	memcpy(&frame[0], &header, sizeof(header));
+	if (bytes > 0)
+		memcpy(&frame[sizeof(Header)], src, bytes);
+}
+
+std::size_t Compression::decompress(const char *frame, std::size_t frameBytes, void *dst, std::size_t capacity) {
+	assert(frameBytes >= sizeof(Header));
+	Header header;
+	memcpy(&header, frame, sizeof(header));
+	assert(header.rawBytes <= capacity);
+	const std::size_t rawBytes = static_cast<std::size_t>(header.rawBytes);
+	const unsigned char *payload = reinterpret_cast<const unsigned char*>(frame + sizeof(Header));
+	const std::size_t payloadBytes = frameBytes - sizeof(Header);
+
+	if (header.codec == CODEC_RAW) {
+		if (rawBytes > 0)
+			memcpy(dst, payload, rawBytes);
+		return rawBytes;
+	}
+
+	unsigned char *out = static_cast<unsigned char*>(dst);
+	std::vector<unsigned char> shuffled;
+	if (header.elementSize > 1) {
+		shuffled.resize(rawBytes);
+		out = shuffled.data();
+	}
+	const bool ok = decompressLZ(payload, payloadBytes, out, rawBytes);
+	assert(ok);
+	(void)ok;
+
+	if (header.elementSize > 1) {
+		const std::size_t elements = rawBytes / header.elementSize;
+		unsigned char *result = static_cast<unsigned char*>(dst);
+		for (std::size_t e = 0; e < elements; ++e)
+			for (unsigned b = 0; b < header.elementSize; ++b)
+				result[e * header.elementSize + b] = shuffled[b * elements + e];
+	}
+	return rawBytes;
+}
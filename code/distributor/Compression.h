@@ -0,0 +1,38 @@
+// fast lossless codec for on-the-wire compression of Data transfers: byte-plane shuffle by element size followed by LZ77 (LZ4-like token format)
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+class Compression {
+public:
+	enum CODEC { CODEC_RAW = 0, CODEC_LZ = 1 };
+
+	// every frame starts with this header, followed by the payload
+	struct Header {
+		std::uint64_t rawBytes;
+		std::uint32_t codec;
+		std::uint32_t elementSize; // bytes were shuffled into planes of this element size before compressing, 1 for no shuffle
+	};
+
+	/// <summary>
+	/// Compresses 'bytes' bytes of 'src' into 'frame' (header and payload).
+	/// </summary>
+	/// <param name="elementSize">size of one element of src, its bytes are grouped by significance first, so eg. the zero high bytes of small integers form long runs</param>
+	/// <param name="maxPayload">gives up if the payload would get larger</param>
+	/// <returns>false if compression does not pay off, the content of 'frame' is undefined then</returns>
+	static bool compress(const void *src, std::size_t bytes, unsigned elementSize, std::size_t maxPayload, std::vector<char> &frame);
+	/// <summary>
+	/// Stores 'bytes' bytes of 'src' uncompressed into 'frame', for data not worth compressing.
+	/// </summary>
+	static void store(const void *src, std::size_t bytes, std::vector<char> &frame);
+	/// <summary>
+	/// Decodes a frame of 'compress' or 'store' into 'dst', which has room for 'capacity' bytes.
+	/// </summary>
+	/// <returns>number of bytes written to dst</returns>
+	static std::size_t decompress(const char *frame, std::size_t frameBytes, void *dst, std::size_t capacity);
+};
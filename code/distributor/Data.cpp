@@ -2,38 +2,81 @@
 // author: Schuchardt Martin, csap9442
 
 #include "Data.h"
-
-long long unsigned Data::duration_bcast_M_to_W = 0;
-long long unsigned Data::duration_bcast_W_to_W = 0;
-long long unsigned Data::duration_send_M_to_W = 0;
-long long unsigned Data::duration_send_W_to_M = 0;
-long long unsigned Data::duration_send_W_to_W = 0;
-long long unsigned Data::duration_recv_W_from_M = 0;
-long long unsigned Data::duration_recv_M_from_W = 0;
-long long unsigned Data::duration_recv_W_from_W = 0;
-long long unsigned Data::duration_gather_W_to_M = 0;
-long long unsigned Data::duration_allGather_W_to_W = 0;
-long long unsigned Data::duration_reduce_W_to_M = 0;
-long long unsigned Data::duration_allReduce_W_to_W = 0;
-
-Data::TAGS Data::tag = Data::TAGS::UNDEFINED_TAG;
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
+std::atomic<long long unsigned> Data::duration_bcast_M_to_W(0);
+std::atomic<long long unsigned> Data::duration_bcast_W_to_W(0);
+std::atomic<long long unsigned> Data::duration_send_M_to_W(0);
+std::atomic<long long unsigned> Data::duration_send_W_to_M(0);
+std::atomic<long long unsigned> Data::duration_send_W_to_W(0);
+std::atomic<long long unsigned> Data::duration_recv_W_from_M(0);
+std::atomic<long long unsigned> Data::duration_recv_M_from_W(0);
+std::atomic<long long unsigned> Data::duration_recv_W_from_W(0);
+std::atomic<long long unsigned> Data::duration_gather_W_to_M(0);
+std::atomic<long long unsigned> Data::duration_allGather_W_to_W(0);
+std::atomic<long long unsigned> Data::duration_reduce_W_to_M(0);
+std::atomic<long long unsigned> Data::duration_allReduce_W_to_W(0);
+std::atomic<long long unsigned> Data::duration_put_W_to_M(0);
+std::atomic<long long unsigned> Data::duration_compress(0);
+std::atomic<long long unsigned> Data::duration_decompress(0);
+std::atomic<long long unsigned> Data::compression_rawBytes(0);
+std::atomic<long long unsigned> Data::compression_wireBytes(0);
+std::atomic<long long unsigned> Data::compression_skipped(0);
+
+thread_local Data::TAGS Data::tag = Data::TAGS::UNDEFINED_TAG;
+std::atomic<unsigned long long> Data::versionCounter(0);
+
+// committed subarray datatypes of strided views, key: element size, pitch and size of the view. Freed by MPI_Finalize
+static std::map<std::vector<std::size_t>, MPI_Datatype> viewTypes;
+static std::mutex viewTypesMutex;
+
+static void contiguousType(const std::size_t bytes, int &count, MPI_Datatype &type);
+
+// workers of this host and one leader worker per host (MPI_COMM_NULL on the others), created by the first allocateShared. Freed by MPI_Finalize
+static MPI_Comm hostComm = MPI_COMM_NULL;
+static MPI_Comm leaderComm = MPI_COMM_NULL;
+static MPI_Comm hostCommParent = MPI_COMM_NULL; // MPI_COMM_WORKER_TO_WORKER they were split from
+// master (rank 0) and all workers in one intracommunicator, windows cannot be created on the intercommunicator. Created by the first openWindow_M, freed by MPI_Finalize
+static MPI_Comm windowComm = MPI_COMM_NULL;
+static MPI_Comm windowCommParent = MPI_COMM_NULL; // MPI_COMM_CLUSTER it was merged from
+
+// the communicators above are created once, for the whole cluster: a node running on a part of it (see Node::setWorkers) would use the wrong processes
+static void assertCachedCommunicator(const MPI_Comm parent, const MPI_Comm current) {
+	assert(parent == current && "shared data and windows need the whole cluster, see Node::setWorkers");
+}
 
 
-const unsigned Data::sizeTotal() {
-	unsigned result = 1;
+const std::size_t Data::sizeTotal() {
+	std::size_t result = 1;
 	for (auto &s : sz)
 		result *= s;
 	return result;
 }
 
-std::vector<Data*> Data::sliceSize(unsigned size) {
+// adds the time since 'start' to 'duration' and records the transfer in the telemetry
+static void account(std::atomic<long long unsigned> &duration, Telemetry::OPERATION operation, int peer, int tag, std::size_t bytes, std::chrono::steady_clock::time_point start) {
+	const long long unsigned ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	duration += ns;
+	Telemetry::record(operation, peer, tag, bytes, ns);
+}
+
+// the master is root of the collectives between master and workers, its peers are all workers
+static int collectivePeer() {
+	return MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL ? Telemetry::ALL : Telemetry::MASTER;
+}
+
+std::vector<Data*> Data::sliceSize(std::size_t size) {
+	assert(!isView());
 	std::vector<Data*> result;
 
-	unsigned count = 0;
+	std::size_t count = 0;
 	const auto sizeTotal = this->sizeTotal();
 	while (count < sizeTotal) {
 		char* chunkPtr = static_cast<char*>(data) + (count * this->sizeOf);
-		unsigned chunkSize = (count + size) <= sizeTotal ? size : (sizeTotal - count);
+		std::size_t chunkSize = (count + size) <= sizeTotal ? size : (sizeTotal - count);
 		result.push_back(new Data(chunkPtr, { chunkSize }, sizeOf));
 		count += size;
 	}
@@ -42,14 +85,15 @@ std::vector<Data*> Data::sliceSize(unsigned size) {
 }
 
 std::vector<Data*> Data::sliceParts(unsigned parts) {
+	assert(!isView());
 	std::vector<Data*> result;
 
-	unsigned count = 0;
+	std::size_t count = 0;
 	const auto sizeTotal = this->sizeTotal();
-	const unsigned partSize = (sizeTotal % parts == 0) ? sizeTotal / parts : (sizeTotal / parts) + 1;
+	const std::size_t partSize = (sizeTotal % parts == 0) ? sizeTotal / parts : (sizeTotal / parts) + 1;
 	while (count < sizeTotal) {
 		char* chunkPtr = static_cast<char*>(data) + (count * this->sizeOf);
-		unsigned chunkSize = (count + partSize) <= sizeTotal ? partSize : (sizeTotal - count);
+		std::size_t chunkSize = (count + partSize) <= sizeTotal ? partSize : (sizeTotal - count);
 		result.push_back(new Data(chunkPtr, { chunkSize }, sizeOf));
 		count += partSize;
 	}
@@ -57,75 +101,127 @@ std::vector<Data*> Data::sliceParts(unsigned parts) {
 	return result;
 }
 
+std::vector<Data*> Data::sliceTiles(const std::vector<std::size_t> &tileSize) {
+	assert(tileSize.size() == sz.size());
+	std::vector<Data*> result;
+	if (sizeTotal() == 0)
+		return result;
+
+	const std::vector<std::size_t> &enclosing = isView() ? pitch : sz;
+	std::vector<std::size_t> first(sz.size(), 0); // first element of the current tile, per dimension
+	while (first[0] < sz[0]) {
+		std::vector<std::size_t> tile(sz.size());
+		std::size_t offset = 0;
+		bool contiguous = true; // row blocks of contiguous data stay contiguous
+		for (std::size_t i = 0; i < sz.size(); ++i) {
+			tile[i] = std::min(tileSize[i], sz[i] - first[i]);
+			offset = offset * enclosing[i] + first[i];
+			if (i > 0 && tile[i] != enclosing[i])
+				contiguous = false;
+		}
+		Data *part = new Data(static_cast<char*>(data) + offset * sizeOf, tile, sizeOf);
+		if (!contiguous)
+			part->pitch = enclosing;
+		result.push_back(part);
+
+		// next tile, last dimension first
+		for (std::size_t i = sz.size(); i-- > 0; ) {
+			first[i] += tileSize[i];
+			if (first[i] < sz[i] || i == 0)
+				break;
+			first[i] = 0;
+		}
+	}
+
+	return result;
+}
+
+void Data::copyTo(void *dst) {
+	if (!isView()) {
+		memcpy(dst, data, sizeOf*sizeTotal());
+		return;
+	}
+	const std::size_t rowBytes = sz.back() * sizeOf;
+	const std::size_t rows = sz.back() == 0 ? 0 : sizeTotal() / sz.back();
+	for (std::size_t row = 0; row < rows; ++row)
+		memcpy(static_cast<char*>(dst) + row * rowBytes, static_cast<char*>(data) + offsetOf(row) * sizeOf, rowBytes);
+}
+
 int Data::bcast_M_to_W() {
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	auto err = bcast(DISTRIBUTOR_ROOT_NODE, MPI_COMM_CLUSTER);
-	duration_bcast_M_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	int err;
+	if (shared)
+		err = bcastShared();
+	else if (broadcast == BROADCAST_MPI || isView())
+		err = bcast(DISTRIBUTOR_ROOT_NODE, MPI_COMM_CLUSTER);
+	else
+		err = bcastPipelined(MPI_COMM_WORKER_TO_WORKER, broadcast);
+	account(duration_bcast_M_to_W, Telemetry::BCAST_M_TO_W, collectivePeer(), MPI_ANY_TAG, sizeOf*sizeTotal(), start);
 	return err;
 }
 
 int Data::bcast_W_to_W(const int source) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	auto err = bcast(source, MPI_COMM_WORLD);
-	duration_bcast_W_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	auto err = bcast(source, MPI_COMM_WORKER_TO_WORKER);
+	account(duration_bcast_W_to_W, Telemetry::BCAST_W_TO_W, source, MPI_ANY_TAG, sizeOf*sizeTotal(), start);
 	return err;
 }
 int Data::send_M_to_W(const int receiver, const int tag) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	auto err = send(receiver, tag, MPI_COMM_CLUSTER);
-	duration_send_M_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_send_M_to_W, Telemetry::SEND_M_TO_W, receiver, tag, sizeOf*sizeTotal(), start);
 	return err;
 }
 int Data::send_W_to_M(const int tag) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	auto err = send(DISTRIBUTOR_ROOT_NODE, tag, MPI_COMM_CLUSTER);
-	duration_send_W_to_M += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_send_W_to_M, Telemetry::SEND_W_TO_M, Telemetry::MASTER, tag, sizeOf*sizeTotal(), start);
 	return err;
 }
 int Data::send_W_to_W(const int receiver, const int tag) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	auto err = send(receiver, tag, MPI_COMM_WORLD);
-	duration_send_W_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	auto err = send(receiver, tag, MPI_COMM_WORKER_TO_WORKER);
+	account(duration_send_W_to_W, Telemetry::SEND_W_TO_W, receiver, tag, sizeOf*sizeTotal(), start);
 	return err;
 }
 MPI_Status Data::recv_W_from_M(const int tag) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	auto result = recv(DISTRIBUTOR_ROOT_NODE, tag, MPI_COMM_CLUSTER);
-	duration_recv_W_from_M += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_recv_W_from_M, Telemetry::RECV_W_FROM_M, Telemetry::MASTER, result.MPI_TAG, sizeOf*sizeTotal(), start);
 	return result;
 }
 MPI_Status Data::recv_M_from_W(const int source, const int tag) { 
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	auto result = recv(source, tag, MPI_COMM_CLUSTER);
-	duration_recv_M_from_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_recv_M_from_W, Telemetry::RECV_M_FROM_W, result.MPI_SOURCE, result.MPI_TAG, sizeOf*sizeTotal(), start);
 	return result;
 }
 MPI_Status Data::recv_W_from_W(const int source, const int tag) {
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-	auto result = recv(source, tag, MPI_COMM_WORLD);
-	duration_recv_W_from_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	auto result = recv(source, tag, MPI_COMM_WORKER_TO_WORKER);
+	account(duration_recv_W_from_W, Telemetry::RECV_W_FROM_W, result.MPI_SOURCE, result.MPI_TAG, sizeOf*sizeTotal(), start);
 	return result;
 }
 
 int Data::gather_W_to_M(void* result) {
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-	int nbrItems = sizeTotal();
+	std::size_t nbrItems = sizeTotal();
 	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
 		nbrItems = sizeTotal() / DISTRIBUTOR_MPI_SIZE;
 
 	auto err = gather(result, nbrItems, DISTRIBUTOR_ROOT_NODE, MPI_COMM_CLUSTER);
-	duration_gather_W_to_M += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_gather_W_to_M, Telemetry::GATHER_W_TO_M, collectivePeer(), MPI_ANY_TAG, sizeOf*sizeTotal(), start);
 	return err;
 }
 
 int Data::allGather_W_to_W(void* result) {
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-	int nbrItems = sizeTotal() / DISTRIBUTOR_MPI_SIZE;
+	std::size_t nbrItems = sizeTotal() / DISTRIBUTOR_MPI_SIZE;
 	auto err = allGather(result, nbrItems, MPI_COMM_WORKER_TO_WORKER);
 
-	duration_allGather_W_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_allGather_W_to_W, Telemetry::ALLGATHER_W_TO_W, Telemetry::ALL, MPI_ANY_TAG, sizeOf*sizeTotal(), start);
 	return err;
 }
 
@@ -134,7 +230,7 @@ int Data::reduce_W_to_M(MPI_Datatype datatype, MPI_Op op) {
 
 	auto err = reduce(sizeTotal(), DISTRIBUTOR_ROOT_NODE, datatype, op, MPI_COMM_CLUSTER);
 	
-	duration_reduce_W_to_M += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_reduce_W_to_M, Telemetry::REDUCE_W_TO_M, collectivePeer(), MPI_ANY_TAG, sizeOf*sizeTotal(), start);
 	return err;
 }
 
@@ -143,81 +239,757 @@ int Data::allReduce_W_to_W(void* result, MPI_Datatype datatype, MPI_Op op) {
 
 	auto err = allReduce(result, datatype, op, MPI_COMM_WORKER_TO_WORKER);
 	
-	duration_allReduce_W_to_W += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	account(duration_allReduce_W_to_W, Telemetry::ALLREDUCE_W_TO_W, Telemetry::ALL, MPI_ANY_TAG, sizeOf*sizeTotal(), start);
+	return err;
+}
+
+int Data::openWindow_M() {
+	const bool isMaster = MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL;
+	if (windowComm == MPI_COMM_NULL) {
+		assert(isMaster || MPI_COMM_WORKER_TO_WORKER == MPI_COMM_WORLD);
+		MPI_Intercomm_merge(MPI_COMM_CLUSTER, isMaster ? 0 : 1, &windowComm);
+		windowCommParent = MPI_COMM_CLUSTER;
+	}
+	assertCachedCommunicator(windowCommParent, MPI_COMM_CLUSTER);
+
+	assert(masterWindow == MPI_WIN_NULL && (!isMaster || !isView()));
+	const std::size_t bytes = isMaster ? sizeOf*sizeTotal() : 0;
+	return MPI_Win_create(isMaster ? data : nullptr, static_cast<MPI_Aint>(bytes), sizeOf, MPI_INFO_NULL, windowComm, &masterWindow);
+}
+
+int Data::closeWindow_M() {
+	auto err = MPI_Win_free(&masterWindow);
+	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
+		modified();
 	return err;
 }
 
+int Data::put_W_to_M(Data &target, const std::size_t offset) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	assert(target.masterWindow != MPI_WIN_NULL && target.sizeOf == sizeOf);
+
+	int targetCount;
+	MPI_Datatype targetType;
+	contiguousType(sizeOf*sizeTotal(), targetCount, targetType);
+	// passive target: the master does not take part, unlock returns when the data is in its memory
+	auto err = MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, target.masterWindow);
+	err |= MPI_Put(data, count(), datatype(), 0, static_cast<MPI_Aint>(offset), targetCount, targetType, target.masterWindow);
+	err |= MPI_Win_unlock(0, target.masterWindow);
+
+	account(duration_put_W_to_M, Telemetry::PUT_W_TO_M, Telemetry::MASTER, MPI_ANY_TAG, sizeOf*sizeTotal(), start);
+	return err;
+}
+
+Data::Request Data::ibcast_M_to_W() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::MODIFY, &duration_bcast_M_to_W, Telemetry::BCAST_M_TO_W, collectivePeer(), MPI_ANY_TAG);
+	result.err = ibcast(DISTRIBUTOR_ROOT_NODE, MPI_COMM_CLUSTER, &result.request);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::ibcast_W_to_W(const int source) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::MODIFY, &duration_bcast_W_to_W, Telemetry::BCAST_W_TO_W, source, MPI_ANY_TAG);
+	result.err = ibcast(source, MPI_COMM_WORKER_TO_WORKER, &result.request);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::isend_M_to_W(const int receiver, const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::SEND, &duration_send_M_to_W, Telemetry::SEND_M_TO_W, receiver, tag);
+	result.err = isend(receiver, tag, MPI_COMM_CLUSTER, result);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::isend_W_to_M(const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::SEND, &duration_send_W_to_M, Telemetry::SEND_W_TO_M, Telemetry::MASTER, tag);
+	result.err = isend(DISTRIBUTOR_ROOT_NODE, tag, MPI_COMM_CLUSTER, result);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::isend_W_to_W(const int receiver, const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::SEND, &duration_send_W_to_W, Telemetry::SEND_W_TO_W, receiver, tag);
+	result.err = isend(receiver, tag, MPI_COMM_WORKER_TO_WORKER, result);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::irecv_W_from_M(const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::RECEIVE, &duration_recv_W_from_M, Telemetry::RECV_W_FROM_M, Telemetry::MASTER, tag);
+	result.err = irecv(DISTRIBUTOR_ROOT_NODE, tag, MPI_COMM_CLUSTER, result);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::irecv_M_from_W(const int source, const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::RECEIVE, &duration_recv_M_from_W, Telemetry::RECV_M_FROM_W, source, tag);
+	result.err = irecv(source, tag, MPI_COMM_CLUSTER, result);
+	result.elapsed(start);
+	return result;
+}
+Data::Request Data::irecv_W_from_W(const int source, const int tag) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Request result(this, Request::RECEIVE, &duration_recv_W_from_W, Telemetry::RECV_W_FROM_W, source, tag);
+	result.err = irecv(source, tag, MPI_COMM_WORKER_TO_WORKER, result);
+	result.elapsed(start);
+	return result;
+}
+
+Data::Request Data::igather_W_to_M(void* result) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::size_t nbrItems = sizeTotal();
+	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
+		nbrItems = sizeTotal() / DISTRIBUTOR_MPI_SIZE;
+
+	Request request(this, Request::SEND, &duration_gather_W_to_M, Telemetry::GATHER_W_TO_M, collectivePeer(), MPI_ANY_TAG);
+	request.err = igather(result, nbrItems, DISTRIBUTOR_ROOT_NODE, MPI_COMM_CLUSTER, &request.request);
+	request.elapsed(start);
+	return request;
+}
+
+Data::Request Data::iallGather_W_to_W(void* result) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::size_t nbrItems = sizeTotal() / DISTRIBUTOR_MPI_SIZE;
+	Request request(this, Request::SEND, &duration_allGather_W_to_W, Telemetry::ALLGATHER_W_TO_W, Telemetry::ALL, MPI_ANY_TAG);
+	request.err = iallGather(result, nbrItems, MPI_COMM_WORKER_TO_WORKER, &request.request);
+
+	request.elapsed(start);
+	return request;
+}
+
+Data::Request Data::ireduce_W_to_M(MPI_Datatype datatype, MPI_Op op) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// the master receives the reduced values into the data object
+	Request request(this, MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL ? Request::MODIFY : Request::SEND, &duration_reduce_W_to_M, Telemetry::REDUCE_W_TO_M, collectivePeer(), MPI_ANY_TAG);
+	request.err = ireduce(sizeTotal(), DISTRIBUTOR_ROOT_NODE, datatype, op, MPI_COMM_CLUSTER, &request.request);
+
+	request.elapsed(start);
+	return request;
+}
+
+Data::Request Data::iallReduce_W_to_W(void* result, MPI_Datatype datatype, MPI_Op op) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	Request request(this, Request::SEND, &duration_allReduce_W_to_W, Telemetry::ALLREDUCE_W_TO_W, Telemetry::ALL, MPI_ANY_TAG);
+	request.err = iallReduce(result, datatype, op, MPI_COMM_WORKER_TO_WORKER, &request.request);
+
+	request.elapsed(start);
+	return request;
+}
+
+
+Data::Request::Request(Request &&other) noexcept : request(other.request), target(other.target), kind(other.kind), duration(other.duration), err(other.err),
+	operation(other.operation), peer(other.peer), tag(other.tag), nanoseconds(other.nanoseconds), frame(std::move(other.frame)) {
+	other.request = MPI_REQUEST_NULL;
+}
+
+Data::Request& Data::Request::operator=(Request &&other) {
+	assert(done()); // an outstanding operation would be lost
+	request = other.request;
+	target = other.target;
+	kind = other.kind;
+	duration = other.duration;
+	err = other.err;
+	operation = other.operation;
+	peer = other.peer;
+	tag = other.tag;
+	nanoseconds = other.nanoseconds;
+	frame = std::move(other.frame); // moving keeps the buffer MPI works on
+	other.request = MPI_REQUEST_NULL;
+	return *this;
+}
+
+void Data::Request::elapsed(std::chrono::steady_clock::time_point start) {
+	const long long unsigned ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	*duration += ns;
+	nanoseconds += ns;
+}
+
+// updates the data object once the operation has completed and records it in the telemetry
+void Data::Request::completed(const MPI_Status &status) {
+	if (kind == RECEIVE) {
+		target->received(status, frame.empty() ? nullptr : &frame);
+		if (operation != Telemetry::RECV_W_FROM_M) // the source might have been MPI_ANY_SOURCE
+			peer = status.MPI_SOURCE;
+		tag = status.MPI_TAG;
+	} else if (kind == MODIFY)
+		target->modified();
+	Telemetry::record(operation, peer, tag, target->sizeOf*target->sizeTotal(), nanoseconds);
+	std::vector<char>().swap(frame);
+}
+
+bool Data::Request::test(MPI_Status *status) {
+	if (done())
+		return true;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int flag = 0;
+	MPI_Status result;
+	MPI_Test(&request, &flag, &result);
+	elapsed(start);
+
+	if (flag) {
+		completed(result);
+		if (status != MPI_STATUS_IGNORE)
+			*status = result;
+	}
+	return flag != 0;
+}
+
+void Data::Request::release() {
+	if (done())
+		return;
+	MPI_Request_free(&request);
+}
+
+MPI_Status Data::Request::wait() {
+	MPI_Status result;
+	if (done()) {
+		result.MPI_SOURCE = MPI_ANY_SOURCE;
+		result.MPI_TAG = MPI_ANY_TAG;
+		result.MPI_ERROR = MPI_SUCCESS;
+		return result;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	MPI_Wait(&request, &result);
+	elapsed(start);
+
+	completed(result);
+	return result;
+}
+
+int Data::Request::waitAny(std::vector<Request> &requests, MPI_Status *status) {
+	std::vector<MPI_Request> handles;
+	for (auto &r : requests)
+		handles.push_back(r.request);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int index = MPI_UNDEFINED;
+	MPI_Status result;
+	MPI_Waitany(static_cast<int>(handles.size()), handles.data(), &index, &result);
+	if (index == MPI_UNDEFINED)
+		return index;
+
+	// the time waited is accounted to the operation that completed
+	auto &r = requests[index];
+	r.request = handles[index];
+	r.elapsed(start);
+	r.completed(result);
+	if (status != MPI_STATUS_IGNORE)
+		*status = result;
+	return index;
+}
+
+void Data::Request::waitAll(std::vector<Request> &requests) {
+	// one by one: every operation gets the time waited for it, all of them have to complete anyway
+	for (auto &r : requests)
+		r.wait();
+}
+
 
 std::vector<std::pair<std::string, long long unsigned>> Data::getDurationDetails() {
 	std::vector<std::pair<std::string, unsigned long long>> result;
 
-	result.push_back(std::pair<std::string, unsigned long long>("bcast M_to_W (ms)    ", duration_bcast_M_to_W));
-	result.push_back(std::pair<std::string, unsigned long long>("bcast W_to_W (ms)    ", duration_bcast_W_to_W));
-	result.push_back(std::pair<std::string, unsigned long long>("send M_to_W (ms)     ", duration_send_M_to_W));
-	result.push_back(std::pair<std::string, unsigned long long>("send W_to_M (ms)     ", duration_send_W_to_M));
-	result.push_back(std::pair<std::string, unsigned long long>("send W_to_W (ms)     ", duration_send_W_to_W));
-	result.push_back(std::pair<std::string, unsigned long long>("recv W_from_M (ms)   ", duration_recv_W_from_M));
-	result.push_back(std::pair<std::string, unsigned long long>("recv M_from_W (ms)   ", duration_recv_M_from_W));
-	result.push_back(std::pair<std::string, unsigned long long>("recv W_from_W (ms)   ", duration_recv_W_from_W));
-	result.push_back(std::pair<std::string, unsigned long long>("gather W_to_M (ms)   ", duration_gather_W_to_M));
-	result.push_back(std::pair<std::string, unsigned long long>("allGather W_to_W (ms)", duration_allGather_W_to_W));
-	result.push_back(std::pair<std::string, unsigned long long>("reduce W_to_M (ms)   ", duration_reduce_W_to_M));
-	result.push_back(std::pair<std::string, unsigned long long>("allReduce W_to_W (ms)", duration_allReduce_W_to_W));
+	result.push_back(std::pair<std::string, unsigned long long>("bcast M_to_W (ms)    ", duration_bcast_M_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("bcast W_to_W (ms)    ", duration_bcast_W_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("send M_to_W (ms)     ", duration_send_M_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("send W_to_M (ms)     ", duration_send_W_to_M / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("send W_to_W (ms)     ", duration_send_W_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("recv W_from_M (ms)   ", duration_recv_W_from_M / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("recv M_from_W (ms)   ", duration_recv_M_from_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("recv W_from_W (ms)   ", duration_recv_W_from_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("gather W_to_M (ms)   ", duration_gather_W_to_M / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("allGather W_to_W (ms)", duration_allGather_W_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("reduce W_to_M (ms)   ", duration_reduce_W_to_M / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("allReduce W_to_W (ms)", duration_allReduce_W_to_W / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("put W_to_M (ms)      ", duration_put_W_to_M / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("compress (ms)        ", duration_compress / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("decompress (ms)      ", duration_decompress / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("compressed raw (kB)  ", compression_rawBytes / 1024));
+	result.push_back(std::pair<std::string, unsigned long long>("compressed wire (kB) ", compression_wireBytes / 1024));
+	result.push_back(std::pair<std::string, unsigned long long>("compression ratio (%)", compression_rawBytes == 0 ? 0 : 100 * compression_wireBytes / compression_rawBytes));
+	result.push_back(std::pair<std::string, unsigned long long>("uncompressed sends   ", compression_skipped));
 
 	return result;
 }
 
 int Data::bcast(const int source, const MPI_Comm comm) {
-	auto err = MPI_Bcast(data, sizeOf*sizeTotal(), MPI_BYTE, source, comm);
+	const std::size_t bytes = sizeOf*sizeTotal();
+	if (compressed()) {
+		// the root is MPI_ROOT on an intercommunicator, the frame size is broadcast first
+		int isInter = 0, rank = MPI_PROC_NULL;
+		MPI_Comm_test_inter(comm, &isInter);
+		if (!isInter)
+			MPI_Comm_rank(comm, &rank);
+		const bool root = source == MPI_ROOT || (!isInter && rank == source);
+		std::vector<char> frame;
+		if (root)
+			pack(frame);
+		unsigned long long frameBytes = frame.size();
+		auto err = MPI_Bcast(&frameBytes, 1, MPI_UNSIGNED_LONG_LONG, source, comm);
+		if (!root && source != MPI_PROC_NULL)
+			frame.resize(static_cast<std::size_t>(frameBytes));
+		int count;
+		MPI_Datatype type;
+		contiguousType(frame.size(), count, type);
+		err |= MPI_Bcast(frame.data(), count, type, source, comm);
+		if (!root && source != MPI_PROC_NULL)
+			unpack(frame, frame.size());
+		modified();
+		return err;
+	}
+	if (isView() || bytes <= DATA_MAX_MESSAGE_BYTES) {
+		auto err = MPI_Bcast(data, count(), datatype(), source, comm);
+		modified();
+		return err;
+	}
+
+	// all segments are posted at once, so the next segment travels while the previous one is forwarded
+	std::vector<MPI_Request> segments;
+	int err = 0;
+	for (std::size_t offset = 0; offset < bytes; offset += DATA_SEGMENT_BYTES) {
+		segments.push_back(MPI_REQUEST_NULL);
+		err |= MPI_Ibcast(static_cast<char*>(data) + offset, static_cast<int>(std::min<std::size_t>(DATA_SEGMENT_BYTES, bytes - offset)), MPI_BYTE, source, comm, &segments.back());
+	}
+	err |= MPI_Waitall(static_cast<int>(segments.size()), segments.data(), MPI_STATUSES_IGNORE);
+	modified();
+	return err;
+}
+
+// pipelined broadcast of 'bytes' bytes of 'buffer' from the master: the master sends the segments once to worker 0 (rank 0 of 'workers' as well),
+// every worker of 'workers' posts the receives of all segments up front and forwards each segment to its successors as soon as it arrived
+static int relay(char *buffer, const std::size_t bytes, const MPI_Comm workers, const Data::BROADCAST mode) {
+	const std::size_t segments = std::max<std::size_t>((bytes + DATA_BCAST_SEGMENT_BYTES - 1) / DATA_BCAST_SEGMENT_BYTES, 1);
+	auto length = [&](std::size_t segment) { return static_cast<int>(std::min<std::size_t>(DATA_BCAST_SEGMENT_BYTES, bytes - segment * DATA_BCAST_SEGMENT_BYTES)); };
+	int err = 0;
+	std::vector<MPI_Request> sends;
+
+	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL) { // master
+		sends.resize(segments);
+		for (std::size_t s = 0; s < segments; ++s)
+			err |= MPI_Isend(buffer + s * DATA_BCAST_SEGMENT_BYTES, length(s), MPI_BYTE, 0, Data::TAGS::BCAST_SEGMENT_TAG, MPI_COMM_CLUSTER, &sends[s]);
+		err |= MPI_Waitall(static_cast<int>(sends.size()), sends.data(), MPI_STATUSES_IGNORE);
+		return err;
+	}
+
+	int rank, size;
+	MPI_Comm_rank(workers, &rank);
+	MPI_Comm_size(workers, &size);
+	int parent = rank - 1;
+	std::vector<int> children;
+	if (mode == Data::BROADCAST_CHAIN) {
+		if (rank + 1 < size)
+			children.push_back(rank + 1);
+	} else { // binomial tree rooted at worker 0: the parent has the highest bit cleared, children add higher powers of two
+		int mask = 1;
+		while (mask <= rank)
+			mask <<= 1;
+		parent = rank - (mask >> 1);
+		for (int m = mask; rank + m < size; m <<= 1)
+			children.insert(children.begin(), rank + m); // largest subtree first
+	}
+
+	std::vector<MPI_Request> receives(segments);
+	for (std::size_t s = 0; s < segments; ++s) {
+		if (rank == 0)
+			err |= MPI_Irecv(buffer + s * DATA_BCAST_SEGMENT_BYTES, length(s), MPI_BYTE, 0, Data::TAGS::BCAST_SEGMENT_TAG, MPI_COMM_CLUSTER, &receives[s]);
+		else
+			err |= MPI_Irecv(buffer + s * DATA_BCAST_SEGMENT_BYTES, length(s), MPI_BYTE, parent, Data::TAGS::BCAST_SEGMENT_TAG, workers, &receives[s]);
+	}
+	for (std::size_t s = 0; s < segments; ++s) {
+		err |= MPI_Wait(&receives[s], MPI_STATUS_IGNORE);
+		for (auto child : children) {
+			sends.push_back(MPI_REQUEST_NULL);
+			err |= MPI_Isend(buffer + s * DATA_BCAST_SEGMENT_BYTES, length(s), MPI_BYTE, child, Data::TAGS::BCAST_SEGMENT_TAG, workers, &sends.back());
+		}
+	}
+	err |= MPI_Waitall(static_cast<int>(sends.size()), sends.data(), MPI_STATUSES_IGNORE);
+	return err;
+}
+
+int Data::bcastPipelined(const MPI_Comm workers, const BROADCAST mode) {
+	const bool isMaster = MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL;
+	int err;
+	if (compressed()) { // the frame size travels first
+		std::vector<char> frame;
+		if (isMaster)
+			pack(frame);
+		unsigned long long frameBytes = frame.size();
+		err = relay(reinterpret_cast<char*>(&frameBytes), sizeof(frameBytes), workers, mode);
+		frame.resize(static_cast<std::size_t>(frameBytes));
+		err |= relay(frame.data(), frame.size(), workers, mode);
+		if (!isMaster)
+			unpack(frame, frame.size());
+	} else
+		err = relay(static_cast<char*>(data), sizeOf*sizeTotal(), workers, mode);
+	modified();
 	return err;
 }
 
+// only the host leaders receive, the fence makes the data visible to the other workers of the host
+int Data::bcastShared() {
+	if (MPI_COMM_WORKER_TO_WORKER != MPI_COMM_NULL)
+		assertCachedCommunicator(hostCommParent, MPI_COMM_WORKER_TO_WORKER);
+	int err = MPI_SUCCESS;
+	if (isHostLeader())
+		err = bcastPipelined(leaderComm, broadcast == BROADCAST_CHAIN ? BROADCAST_CHAIN : BROADCAST_TREE);
+	if (window != MPI_WIN_NULL)
+		err |= MPI_Win_fence(0, window);
+	modified();
+	return err;
+}
+
+Data* Data::allocateShared(const std::vector<std::size_t> &size, unsigned sizeOf) {
+	std::size_t bytes = sizeOf;
+	for (auto s : size)
+		bytes *= s;
+
+	Data *result;
+	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL) { // the master has no other processes on its host
+		result = new Data(new char[bytes], size, sizeOf);
+	} else {
+		if (hostComm == MPI_COMM_NULL) { // worker 0 is leader of its host and rank 0 of the leaders, like the relay expects
+			assert(MPI_COMM_WORKER_TO_WORKER == MPI_COMM_WORLD);
+			hostCommParent = MPI_COMM_WORKER_TO_WORKER;
+			int rank, hostRank;
+			MPI_Comm_rank(MPI_COMM_WORKER_TO_WORKER, &rank);
+			MPI_Comm_split_type(MPI_COMM_WORKER_TO_WORKER, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &hostComm);
+			MPI_Comm_rank(hostComm, &hostRank);
+			MPI_Comm_split(MPI_COMM_WORKER_TO_WORKER, hostRank == 0 ? 0 : MPI_UNDEFINED, rank, &leaderComm);
+		}
+		assertCachedCommunicator(hostCommParent, MPI_COMM_WORKER_TO_WORKER);
+
+		// the leader allocates the whole data object, the others map its segment
+		const bool leader = leaderComm != MPI_COMM_NULL;
+		void *base = nullptr;
+		MPI_Win window;
+		MPI_Win_allocate_shared(static_cast<MPI_Aint>(leader ? bytes : 0), sizeOf, MPI_INFO_NULL, hostComm, &base, &window);
+		if (!leader) {
+			MPI_Aint segmentBytes;
+			int displacementUnit;
+			MPI_Win_shared_query(window, 0, &segmentBytes, &displacementUnit, &base);
+		}
+		result = new Data(base, size, sizeOf);
+		result->window = window;
+	}
+	result->shared = true;
+	return result;
+}
+
+void Data::freeShared(Data *data) {
+	assert(data->shared);
+	int finalized;
+	MPI_Finalized(&finalized);
+	if (data->window != MPI_WIN_NULL) {
+		if (!finalized) // after Distributor::run the memory goes with the process
+			MPI_Win_free(&data->window);
+	} else
+		delete[] static_cast<char*>(data->data);
+	delete data;
+}
+
+bool Data::isHostLeader() {
+	return window == MPI_WIN_NULL || leaderComm != MPI_COMM_NULL;
+}
+
 int Data::send(const int receiver, const int tag, const MPI_Comm comm) {
-	auto err = MPI_Send(data, sizeOf*sizeTotal(), MPI_BYTE, receiver, tag, comm);
+	if (compressed()) {
+		std::vector<char> frame;
+		pack(frame);
+		int count;
+		MPI_Datatype type;
+		contiguousType(frame.size(), count, type);
+		return MPI_Send(frame.data(), count, type, receiver, tag, comm);
+	}
+	auto err = MPI_Send(data, count(), datatype(), receiver, tag, comm);
 	return err;
 }
 
 MPI_Status Data::recv(const int source, const int tag, const MPI_Comm comm) {
 	MPI_Status status;
-	MPI_Recv(data, sizeOf*sizeTotal(), MPI_BYTE, source, tag, comm, &status);
+	if (compressed()) {
+		std::vector<char> frame(sizeof(Compression::Header) + sizeOf*sizeTotal()); // room for an uncompressed frame
+		int count;
+		MPI_Datatype type;
+		contiguousType(frame.size(), count, type);
+		MPI_Recv(frame.data(), count, type, source, tag, comm, &status);
+		received(status, &frame);
+		return status;
+	}
+	MPI_Recv(data, count(), datatype(), source, tag, comm, &status);
+	received(status);
+
+	return status;
+}
 
-	int iReceived;
-	MPI_Get_count(&status, MPI_BYTE, &iReceived);
-	iReceived /= sizeOf;
+int Data::ibcast(const int source, const MPI_Comm comm, MPI_Request *request) {
+	assert(!compressed()); // the receivers cannot know the frame size in advance
+	auto err = MPI_Ibcast(data, count(), datatype(), source, comm, request);
+	return err;
+}
 
-	sz.clear();
-	sz.push_back(iReceived);
+int Data::isend(const int receiver, const int tag, const MPI_Comm comm, Request &request) {
+	if (compressed()) {
+		pack(request.frame);
+		int count;
+		MPI_Datatype type;
+		contiguousType(request.frame.size(), count, type);
+		return MPI_Isend(request.frame.data(), count, type, receiver, tag, comm, &request.request);
+	}
+	auto err = MPI_Isend(data, count(), datatype(), receiver, tag, comm, &request.request);
+	return err;
+}
+
+int Data::irecv(const int source, const int tag, const MPI_Comm comm, Request &request) {
+	if (compressed()) {
+		request.frame.resize(sizeof(Compression::Header) + sizeOf*sizeTotal());
+		int count;
+		MPI_Datatype type;
+		contiguousType(request.frame.size(), count, type);
+		return MPI_Irecv(request.frame.data(), count, type, source, tag, comm, &request.request);
+	}
+	auto err = MPI_Irecv(data, count(), datatype(), source, tag, comm, &request.request);
+	return err;
+}
+
+// compresses the data object into 'frame' according to its compression mode, or stores it uncompressed
+void Data::pack(std::vector<char> &frame) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const std::size_t bytes = sizeOf*sizeTotal();
+
+	bool tryCompression = compression == COMPRESSION_ON;
+	if (compression == COMPRESSION_AUTO) {
+		if (compressionBackoff > 0)
+			--compressionBackoff;
+		else
+			tryCompression = bytes >= DATA_COMPRESSION_MIN_BYTES;
+	}
+
+	if (tryCompression && Compression::compress(data, bytes, sizeOf, static_cast<std::size_t>(bytes * DATA_COMPRESSION_MAX_RATIO), frame)) {
+		compression_rawBytes += bytes;
+		compression_wireBytes += frame.size();
+	} else {
+		if (tryCompression && compression == COMPRESSION_AUTO)
+			compressionBackoff = DATA_COMPRESSION_BACKOFF;
+		Compression::store(data, bytes, frame);
+		++compression_skipped;
+	}
+	duration_compress += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// decodes the first 'frameBytes' bytes of 'frame' into the data object, returns the number of bytes decoded
+std::size_t Data::unpack(const std::vector<char> &frame, std::size_t frameBytes) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	auto result = Compression::decompress(frame.data(), frameBytes, data, sizeOf*sizeTotal());
+	duration_decompress += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+// updates size and last tag after data has been received, decodes 'frame' first if the data was received compressed
+void Data::received(const MPI_Status &status, const std::vector<char> *frame) {
+	if (frame) {
+		int count;
+		MPI_Datatype type;
+		contiguousType(frame->size(), count, type);
+		MPI_Count frameBytes;
+		MPI_Get_elements_x(&status, type, &frameBytes);
+
+		const std::size_t bytes = unpack(*frame, static_cast<std::size_t>(frameBytes));
+		sz.clear();
+		sz.push_back(bytes / sizeOf);
+	} else if (!isView()) { // views keep their shape
+		MPI_Count bytes; // basic elements, correct for the large message datatype as well
+		MPI_Get_elements_x(&status, datatype(), &bytes);
+
+		sz.clear();
+		sz.push_back(static_cast<std::size_t>(bytes) / sizeOf);
+	}
+	modified();
 
 	setLastTag(status.MPI_TAG);
+}
 
-	return status;
+// 'count' and 'type' to transfer 'bytes' contiguous bytes. Above DATA_MAX_MESSAGE_BYTES one element of DATA_SEGMENT_BYTES blocks and the remainder, its extent is 'bytes'
+static void contiguousType(const std::size_t bytes, int &count, MPI_Datatype &type) {
+	if (bytes <= DATA_MAX_MESSAGE_BYTES) {
+		count = static_cast<int>(bytes);
+		type = MPI_BYTE;
+		return;
+	}
+
+	count = 1;
+	const std::vector<std::size_t> key = { 0, bytes }; // element size 0 never occurs for views
+	std::lock_guard<std::mutex> lock(viewTypesMutex);
+	auto cached = viewTypes.find(key);
+	if (cached != viewTypes.end()) {
+		type = cached->second;
+		return;
+	}
+
+	const std::size_t blocks = bytes / DATA_SEGMENT_BYTES, remainder = bytes % DATA_SEGMENT_BYTES;
+	MPI_Datatype segment, segments;
+	MPI_Type_contiguous(DATA_SEGMENT_BYTES, MPI_BYTE, &segment);
+	MPI_Type_contiguous(static_cast<int>(blocks), segment, &segments);
+	int lengths[2] = { 1, static_cast<int>(remainder) };
+	MPI_Aint displacements[2] = { 0, static_cast<MPI_Aint>(blocks * DATA_SEGMENT_BYTES) };
+	MPI_Datatype types[2] = { segments, MPI_BYTE };
+	MPI_Type_create_struct(2, lengths, displacements, types, &type);
+	MPI_Type_commit(&type);
+	MPI_Type_free(&segments);
+	MPI_Type_free(&segment);
+
+	viewTypes[key] = type;
+}
+
+// number of elements of datatype() to transfer: bytes of contiguous data, one strided view or one large message
+int Data::count() {
+	int result = 1;
+	MPI_Datatype type;
+	if (!isView())
+		contiguousType(sizeOf*sizeTotal(), result, type);
+	return result;
+}
+
+MPI_Datatype Data::datatype() {
+	if (!isView()) {
+		int count;
+		MPI_Datatype result;
+		contiguousType(sizeOf*sizeTotal(), count, result);
+		return result;
+	}
+
+	std::vector<std::size_t> key(1, sizeOf);
+	key.insert(key.end(), pitch.begin(), pitch.end());
+	key.insert(key.end(), sz.begin(), sz.end());
+	std::lock_guard<std::mutex> lock(viewTypesMutex);
+	auto cached = viewTypes.find(key);
+	if (cached != viewTypes.end())
+		return cached->second;
+
+	// data points to the first element of the view, so the enclosing array starts there as well
+	std::vector<int> sizes(pitch.begin(), pitch.end()), subsizes(sz.begin(), sz.end()), starts(sz.size(), 0);
+	sizes[0] = sz[0];
+	MPI_Datatype element, result;
+	MPI_Type_contiguous(sizeOf, MPI_BYTE, &element);
+	MPI_Type_create_subarray(static_cast<int>(sz.size()), sizes.data(), subsizes.data(), starts.data(), MPI_ORDER_C, element, &result);
+	MPI_Type_commit(&result);
+	MPI_Type_free(&element);
+
+	viewTypes[key] = result;
+	return result;
+}
+
+// element offset of the row-th innermost row of a view
+std::size_t Data::offsetOf(std::size_t row) {
+	std::size_t offset = 0, stride = pitch.back();
+	for (std::size_t i = sz.size() - 1; i-- > 0; ) {
+		offset += (row % sz[i]) * stride;
+		row /= sz[i];
+		stride *= pitch[i];
+	}
+	return offset;
 }
 
-int Data::gather(void* result, const int nbrItems, const int receiver, const MPI_Comm comm) {
-	auto err = MPI_Gather(data, nbrItems*sizeOf, MPI_BYTE, result, nbrItems*sizeOf, MPI_BYTE, receiver, comm);
+int Data::gather(void* result, const std::size_t nbrItems, const int receiver, const MPI_Comm comm) {
+	assert(!isView());
+	int count;
+	MPI_Datatype type;
+	contiguousType(nbrItems*sizeOf, count, type); // the extent of the large message datatype is its size, so the parts of all processes line up in 'result'
+	auto err = MPI_Gather(data, count, type, result, count, type, receiver, comm);
 	return err;
 }
 
-int Data::allGather(void* result, const int nbrItems, const MPI_Comm comm) {
-	auto err = MPI_Allgather(data, nbrItems*sizeOf, MPI_BYTE, result, nbrItems*sizeOf, MPI_BYTE, comm);
+int Data::allGather(void* result, const std::size_t nbrItems, const MPI_Comm comm) {
+	assert(!isView());
+	int count;
+	MPI_Datatype type;
+	contiguousType(nbrItems*sizeOf, count, type);
+	auto err = MPI_Allgather(data, count, type, result, count, type, comm);
 	return err;
 }
 
-int Data::reduce(const int nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, MPI_Comm comm) {
-	auto err = 0;
+// reductions are elementwise, huge ones are split into segments of about DATA_SEGMENT_BYTES
+static std::size_t reduceSegment(const MPI_Datatype datatype) {
+	int typeSize;
+	MPI_Type_size(datatype, &typeSize);
+	return std::max<std::size_t>(DATA_SEGMENT_BYTES / typeSize, 1);
+}
+
+int Data::reduce(const std::size_t nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, MPI_Comm comm) {
+	assert(!isView());
+	int err = 0;
+	const std::size_t segment = nbrItems <= INT_MAX ? std::max<std::size_t>(nbrItems, 1) : reduceSegment(datatype);
+	MPI_Aint lowerBound, extent;
+	MPI_Type_get_extent(datatype, &lowerBound, &extent);
+	for (std::size_t offset = 0; offset < nbrItems || offset == 0; offset += segment) {
+		char *part = static_cast<char*>(data) + offset * extent;
+		const int items = static_cast<int>(std::min(segment, nbrItems - offset));
+		if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
+			err |= MPI_Reduce(nullptr, part, items, datatype, op, receiver, comm);
+		else
+			err |= MPI_Reduce(part, nullptr, items, datatype, op, receiver, comm);
+	}
 	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
-		err = MPI_Reduce(nullptr, data, nbrItems, datatype, op, receiver, comm);
-	else
-		err = MPI_Reduce(data, nullptr, nbrItems, datatype, op, receiver, comm);
+		modified();
 
 	return err;
 }
 
 int Data::allReduce(void* result, const MPI_Datatype datatype, const MPI_Op op, MPI_Comm comm) {
-	auto err = MPI_Allreduce(data, result, sizeTotal(), datatype, op, comm);
+	assert(!isView());
+	int err = 0;
+	const std::size_t nbrItems = sizeTotal();
+	const std::size_t segment = nbrItems <= INT_MAX ? std::max<std::size_t>(nbrItems, 1) : reduceSegment(datatype);
+	MPI_Aint lowerBound, extent;
+	MPI_Type_get_extent(datatype, &lowerBound, &extent);
+	for (std::size_t offset = 0; offset < nbrItems || offset == 0; offset += segment)
+		err |= MPI_Allreduce(static_cast<char*>(data) + offset * extent, static_cast<char*>(result) + offset * extent, static_cast<int>(std::min(segment, nbrItems - offset)), datatype, op, comm);
+	return err;
+}
+
+int Data::igather(void* result, const std::size_t nbrItems, const int receiver, const MPI_Comm comm, MPI_Request *request) {
+	assert(!isView());
+	int count;
+	MPI_Datatype type;
+	contiguousType(nbrItems*sizeOf, count, type);
+	auto err = MPI_Igather(data, count, type, result, count, type, receiver, comm, request);
+	return err;
+}
+
+int Data::iallGather(void* result, const std::size_t nbrItems, const MPI_Comm comm, MPI_Request *request) {
+	assert(!isView());
+	int count;
+	MPI_Datatype type;
+	contiguousType(nbrItems*sizeOf, count, type);
+	auto err = MPI_Iallgather(data, count, type, result, count, type, comm, request);
+	return err;
+}
+
+int Data::ireduce(const std::size_t nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, MPI_Comm comm, MPI_Request *request) {
+	assert(!isView() && nbrItems <= INT_MAX);
+	if (MPI_COMM_WORKER_TO_WORKER == MPI_COMM_NULL)
+		return MPI_Ireduce(nullptr, data, static_cast<int>(nbrItems), datatype, op, receiver, comm, request);
+	return MPI_Ireduce(data, nullptr, static_cast<int>(nbrItems), datatype, op, receiver, comm, request);
+}
+
+int Data::iallReduce(void* result, const MPI_Datatype datatype, const MPI_Op op, MPI_Comm comm, MPI_Request *request) {
+	assert(!isView() && sizeTotal() <= INT_MAX);
+	auto err = MPI_Iallreduce(data, result, static_cast<int>(sizeTotal()), datatype, op, comm, request);
 	return err;
 }
 
+bool Data::probe_W_from_M(const int tag) {
+	int flag = 0;
+	MPI_Iprobe(DISTRIBUTOR_ROOT_NODE, tag, MPI_COMM_CLUSTER, &flag, MPI_STATUS_IGNORE);
+	return flag != 0;
+}
+
 Data::TAGS Data::expectTerminate() {
 
 	int foo = 815;
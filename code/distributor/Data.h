@@ -6,12 +6,45 @@
 #include <vector>
 #include <utility>
 #include <chrono>
+#include <cassert>
+#include <climits>
+#include <atomic>
 #include <mpi.h>
+#include "Telemetry.h"
+#include "Compression.h"
 
-extern MPI_Comm MPI_COMM_CLUSTER;
-extern MPI_Comm MPI_COMM_WORKER_TO_WORKER;
-extern int DISTRIBUTOR_ROOT_NODE;
-extern int DISTRIBUTOR_MPI_SIZE;
+// messages above DATA_MAX_MESSAGE_BYTES do not fit the int count of MPI: they are sent as one element of a cached datatype made of DATA_SEGMENT_BYTES blocks,
+// broadcasts and reductions are split into pipelined segments of DATA_SEGMENT_BYTES
+#ifndef DATA_MAX_MESSAGE_BYTES
+#define DATA_MAX_MESSAGE_BYTES INT_MAX
+#endif
+#ifndef DATA_SEGMENT_BYTES
+#define DATA_SEGMENT_BYTES (1u << 30)
+#endif
+
+// COMPRESSION_AUTO (see Data::setCompression) only tries data objects of at least DATA_COMPRESSION_MIN_BYTES. Data not shrinking below DATA_COMPRESSION_MAX_RATIO is sent uncompressed,
+// COMPRESSION_AUTO then skips the next DATA_COMPRESSION_BACKOFF transfers of that data object
+#ifndef DATA_COMPRESSION_MIN_BYTES
+#define DATA_COMPRESSION_MIN_BYTES 4096
+#endif
+#ifndef DATA_COMPRESSION_MAX_RATIO
+#define DATA_COMPRESSION_MAX_RATIO 0.9
+#endif
+#ifndef DATA_COMPRESSION_BACKOFF
+#define DATA_COMPRESSION_BACKOFF 8
+#endif
+
+// segment size of the pipelined broadcasts (see Data::setBroadcast): workers forward a segment as soon as it arrived, so all of them are busy after a few segments
+#ifndef DATA_BCAST_SEGMENT_BYTES
+#define DATA_BCAST_SEGMENT_BYTES (1u << 20)
+#endif
+
+// thread local: nodes running concurrently on the master (see Node::setWorkers) communicate with their own workers.
+// Set by the Distributor in the threads running nodes only, a thread started by a kernel has to get them from the thread of its node
+extern thread_local MPI_Comm MPI_COMM_CLUSTER;
+extern thread_local MPI_Comm MPI_COMM_WORKER_TO_WORKER;
+extern thread_local int DISTRIBUTOR_ROOT_NODE;
+extern thread_local int DISTRIBUTOR_MPI_SIZE;
 
 class Data {
 	friend class Checkpoint;
@@ -19,62 +52,219 @@ class Data {
 private:
 public:
 	enum TAGS {
-		UNDEFINED_TAG = -1, SEND_CHUNK_TAG = 0, RECEIVE_CHUNK_TAG = 1, RESTART_TAG = 2, TERMINATE_TAG = 3, STD_OUT_TAG = 4, STD_ERR_TAG = 5
+		UNDEFINED_TAG = -1, SEND_CHUNK_TAG = 0, RECEIVE_CHUNK_TAG = 1, RESTART_TAG = 2, TERMINATE_TAG = 3, STD_OUT_TAG = 4, STD_ERR_TAG = 5, CHUNK_ID_TAG = 6, BCAST_SEGMENT_TAG = 7, CANCEL_CHUNK_TAG = 8, FINALIZE_TAG = 9
 	};
+	enum COMPRESSION {
+		COMPRESSION_OFF, COMPRESSION_AUTO, COMPRESSION_ON
+	};
+	enum BROADCAST {
+		BROADCAST_MPI, BROADCAST_CHAIN, BROADCAST_TREE
+	};
+	class Request;
 
 private:
-	static TAGS tag;
+	static thread_local TAGS tag;
+
+	static std::atomic<unsigned long long> versionCounter;
 
 	void* data;
-	std::vector<unsigned> sz;
+	std::vector<std::size_t> sz;
+	std::vector<std::size_t> pitch; // size of the enclosing array if this is a strided view (see sliceTiles), empty if data is contiguous
 	const unsigned sizeOf;
+	unsigned long long version; // unique across all data objects, changes whenever the host copy changes
+	COMPRESSION compression = COMPRESSION_OFF;
+	unsigned compressionBackoff = 0; // transfers COMPRESSION_AUTO still sends uncompressed
+	BROADCAST broadcast = BROADCAST_MPI;
+	bool shared = false; // allocated by allocateShared
+	MPI_Win window = MPI_WIN_NULL; // shared memory window of the host, workers only
+	MPI_Win masterWindow = MPI_WIN_NULL; // opened by openWindow_M
 
-	static long long unsigned duration_bcast_M_to_W;
-	static long long unsigned duration_bcast_W_to_W;
-	static long long unsigned duration_send_M_to_W;
-	static long long unsigned duration_send_W_to_M;
-	static long long unsigned duration_send_W_to_W;
-	static long long unsigned duration_recv_W_from_M;
-	static long long unsigned duration_recv_M_from_W;
-	static long long unsigned duration_recv_W_from_W;
-	static long long unsigned duration_gather_W_to_M;
-	static long long unsigned duration_allGather_W_to_W;
-	static long long unsigned duration_reduce_W_to_M;
-	static long long unsigned duration_allReduce_W_to_W;
+	// nanoseconds, reported in ms by getDurationDetails. Telemetry has the details per transfer. Atomic: concurrent nodes transfer from several threads of the master
+	static std::atomic<long long unsigned> duration_bcast_M_to_W;
+	static std::atomic<long long unsigned> duration_bcast_W_to_W;
+	static std::atomic<long long unsigned> duration_send_M_to_W;
+	static std::atomic<long long unsigned> duration_send_W_to_M;
+	static std::atomic<long long unsigned> duration_send_W_to_W;
+	static std::atomic<long long unsigned> duration_recv_W_from_M;
+	static std::atomic<long long unsigned> duration_recv_M_from_W;
+	static std::atomic<long long unsigned> duration_recv_W_from_W;
+	static std::atomic<long long unsigned> duration_gather_W_to_M;
+	static std::atomic<long long unsigned> duration_allGather_W_to_W;
+	static std::atomic<long long unsigned> duration_reduce_W_to_M;
+	static std::atomic<long long unsigned> duration_allReduce_W_to_W;
+	static std::atomic<long long unsigned> duration_put_W_to_M;
+	static std::atomic<long long unsigned> duration_compress;
+	static std::atomic<long long unsigned> duration_decompress;
+	static std::atomic<long long unsigned> compression_rawBytes; // bytes of all data sent compressed
+	static std::atomic<long long unsigned> compression_wireBytes; // bytes of their frames
+	static std::atomic<long long unsigned> compression_skipped; // transfers with compression enabled sent uncompressed
 
 	int bcast(const int source, const MPI_Comm comm);
+	int bcastPipelined(const MPI_Comm workers, const BROADCAST mode);
+	int bcastShared();
 	int send(const int receiver, const int tag, const MPI_Comm comm);
 	MPI_Status recv(const int source, const int tag, const MPI_Comm comm);
-	int gather(void* result, const int nbrItems, const int receiver, const MPI_Comm comm);
-	int allGather(void *result, const int nbrItems, const MPI_Comm comm);
-	int reduce(const int nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, const MPI_Comm comm);
+	int ibcast(const int source, const MPI_Comm comm, MPI_Request *request);
+	int isend(const int receiver, const int tag, const MPI_Comm comm, Request &request);
+	int irecv(const int source, const int tag, const MPI_Comm comm, Request &request);
+	void received(const MPI_Status &status, const std::vector<char> *frame = nullptr);
+	bool compressed() { return compression != COMPRESSION_OFF && !isView(); }
+	void pack(std::vector<char> &frame);
+	std::size_t unpack(const std::vector<char> &frame, std::size_t frameBytes);
+	int count();
+	MPI_Datatype datatype();
+	std::size_t offsetOf(std::size_t row);
+	int gather(void* result, const std::size_t nbrItems, const int receiver, const MPI_Comm comm);
+	int allGather(void *result, const std::size_t nbrItems, const MPI_Comm comm);
+	int reduce(const std::size_t nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, const MPI_Comm comm);
 	int allReduce(void* result, const MPI_Datatype datatype, const MPI_Op op, const MPI_Comm comm);
+	int igather(void* result, const std::size_t nbrItems, const int receiver, const MPI_Comm comm, MPI_Request *request);
+	int iallGather(void *result, const std::size_t nbrItems, const MPI_Comm comm, MPI_Request *request);
+	int ireduce(const std::size_t nbrItems, const int receiver, const MPI_Datatype datatype, const MPI_Op op, const MPI_Comm comm, MPI_Request *request);
+	int iallReduce(void* result, const MPI_Datatype datatype, const MPI_Op op, const MPI_Comm comm, MPI_Request *request);
 
 public:
-	Data(void* _data, std::vector<unsigned> _size, unsigned _sizeOf) : data(_data), sz(_size), sizeOf(_sizeOf) {};
+	/// <summary>
+	/// Handle of an outstanding non-blocking operation, returned by the i-functions of Data. Finish it with test(), wait(), waitAny() or waitAll() before touching the data (or result buffer) again.
+	/// A completed receive updates size and last tag of its data object like the blocking counterpart (decompressing the data if needed), a completed bcast or reduce into the data object marks it modified.
+	/// Durations of posting and completing are added to the duration counter of the blocking counterpart and recorded as one transfer in the Telemetry. Requests can be moved but not copied; a default constructed or completed request is done.
+	/// </summary>
+	class Request {
+		friend class Data;
+		enum KIND { SEND, RECEIVE, MODIFY };
+
+		MPI_Request request = MPI_REQUEST_NULL;
+		Data *target = nullptr;
+		KIND kind = SEND;
+		std::atomic<long long unsigned> *duration = nullptr;
+		int err = MPI_SUCCESS;
+		Telemetry::OPERATION operation = Telemetry::SEND_M_TO_W;
+		int peer = Telemetry::MASTER;
+		int tag = MPI_ANY_TAG;
+		long long unsigned nanoseconds = 0; // posting and completing so far
+		std::vector<char> frame; // staging buffer of compressed transfers
+
+		Request(Data *_target, KIND _kind, std::atomic<long long unsigned> *_duration, Telemetry::OPERATION _operation, int _peer, int _tag)
+			: target(_target), kind(_kind), duration(_duration), operation(_operation), peer(_peer), tag(_tag) {}
+		void elapsed(std::chrono::steady_clock::time_point start);
+		void completed(const MPI_Status &status);
+
+	public:
+		Request() {}
+		Request(Request &&other) noexcept;
+		Request& operator=(Request &&other);
+		Request(const Request&) = delete;
+		Request& operator=(const Request&) = delete;
+		~Request() { assert(done()); }
+
+		/// <returns>return code of posting the operation</returns>
+		int error() const { return err; }
+		bool done() const { return request == MPI_REQUEST_NULL; }
+		/// <returns>receiver or source of the operation</returns>
+		int getPeer() const { return peer; }
+		/// <summary>
+		/// Gives up on the operation without waiting for it (eg. a send to a worker that has been lost, see Distributor::abandon). MPI may still use its buffers until MPI_Finalize:
+		/// the data object's buffer must not be reused and the request has to be kept if it has a compression frame.
+		/// </summary>
+		void release();
+		/// <summary>
+		/// Tests for completion without blocking.
+		/// </summary>
+		/// <returns>true if the operation has completed (or there is none)</returns>
+		bool test(MPI_Status *status = MPI_STATUS_IGNORE);
+		/// <summary>
+		/// Waits for completion, returns immediately if the request is done already.
+		/// </summary>
+		MPI_Status wait();
+		/// <summary>
+		/// Waits until one of the requests completes.
+		/// </summary>
+		/// <returns>index of the completed request, MPI_UNDEFINED if all requests were done already</returns>
+		static int waitAny(std::vector<Request> &requests, MPI_Status *status = MPI_STATUS_IGNORE);
+		/// <summary>
+		/// Waits until all requests have completed.
+		/// </summary>
+		static void waitAll(std::vector<Request> &requests);
+	};
+
+	Data(void* _data, std::vector<std::size_t> _size, unsigned _sizeOf) : data(_data), sz(_size), sizeOf(_sizeOf), version(++versionCounter) {};
 
 	void* get() { return data; }
-	Data* set(void* _data) { data = _data; return this; }
-	const std::vector<unsigned>& size() { return sz; };
-	const unsigned sizeTotal();
+	Data* set(void* _data) { data = _data; modified(); return this; }
+	const std::vector<std::size_t>& size() { return sz; };
+	const std::size_t sizeTotal();
 	const unsigned sizeOfData() { return sizeOf; }
-	void setSize(const std::vector<unsigned> new_sz) { sz = new_sz; }
+	void setSize(const std::vector<std::size_t> new_sz) { sz = new_sz; modified(); }
+
+	/// <summary>
+	/// Marks the host copy as changed, so device-resident copies (see DeviceRuntime::getResidentBuffer) are uploaded again before their next use.
+	/// Receiving and broadcasting into the data object, set and setSize mark it automatically; call this after writing to get() directly.
+	/// </summary>
+	void modified() { version = ++versionCounter; }
+	unsigned long long getVersion() { return version; }
 
 	/// <summary>
 	/// Splits the data object into parts with at most 'size' size. If the source data object is not divisible into a chunks of 'size' without remainder, the last part will be smaller and contain the remaining objects. The original data is not duplicated or destroyed.
 	/// </summary>
 	/// <param name="size">Size of one data chunk. The last chunk might be smaller</param>
 	/// <returns>Vector of data objects, containing pointers to parts the original data</returns>
-	std::vector<Data*> sliceSize(unsigned size);
+	std::vector<Data*> sliceSize(std::size_t size);
 	/// <summary>
 	/// Splits the data object into 'parts' pieces. If the source data object is not divisible into a number of 'parts' without remainder, the last part will be smaller and contain the remaining objects. The original data is not duplicated or destroyed.
 	/// </summary>
 	/// <param name="parts">Number of parts to split the data object into</param>
 	/// <returns>Vector of data objects, containing pointers to parts the original data</returns>
 	std::vector<Data*> sliceParts(unsigned parts);
+	/// <summary>
+	/// Splits the data object into tiles of at most 'tileSize' elements per dimension, in row-major order of the tiles. Tiles at the upper edges might be smaller. The original data is not duplicated or destroyed.
+	/// Tiles not spanning full rows are strided views: they are sent and received in place through a cached MPI subarray datatype, no packing needed. Tiles of tiles are possible.
+	/// sliceSize/sliceParts, gather and reduce need contiguous data objects.
+	/// </summary>
+	/// <param name="tileSize">Size of one tile per dimension, needs as many dimensions as the data object</param>
+	/// <returns>Vector of data objects, viewing parts the original data</returns>
+	std::vector<Data*> sliceTiles(const std::vector<std::size_t> &tileSize);
+	/// <summary>
+	/// 2D version of sliceTiles, tiles of at most rows*cols elements.
+	/// </summary>
+	std::vector<Data*> sliceTiles(std::size_t rows, std::size_t cols) { return sliceTiles(std::vector<std::size_t>{ rows, cols }); }
+	/// <returns>true if the data object is a strided view into a larger array</returns>
+	bool isView() { return !pitch.empty(); }
+	/// <summary>
+	/// Copies the elements into the contiguous buffer 'dst' (sizeTotal()*sizeOfData() bytes), row by row for strided views.
+	/// </summary>
+	void copyTo(void *dst);
+
+	/// <summary>
+	/// Compresses the data object on the wire for send/recv/bcast and their non-blocking counterparts (except ibcast): COMPRESSION_ON always tries, COMPRESSION_AUTO only data of at least DATA_COMPRESSION_MIN_BYTES and backs off after data that does not compress.
+	/// Pays off for data with many repeated or small values on slow networks. Sender and receiver both need compression enabled (any mode). Strided views are always sent uncompressed.
+	/// Ratio and time are reported by getDurationDetails.
+	/// </summary>
+	void setCompression(COMPRESSION mode) { compression = mode; compressionBackoff = 0; }
+	COMPRESSION getCompression() { return compression; }
+	/// <summary>
+	/// Selects how bcast_M_to_W distributes the data object. BROADCAST_MPI is MPI_Bcast over the intercommunicator, the master's uplink carries the data to every worker.
+	/// BROADCAST_CHAIN and BROADCAST_TREE send it once to worker 0 in segments of DATA_BCAST_SEGMENT_BYTES, the workers relay every segment as soon as it arrived along a chain or a binomial tree over MPI_COMM_WORKER_TO_WORKER.
+	/// Large data objects then take about the same time for any number of workers: the chain for very large ones, the tree has fewer hops for medium sizes. Master and workers need the same mode, strided views always use MPI_Bcast.
+	/// </summary>
+	void setBroadcast(BROADCAST mode) { broadcast = mode; }
+	BROADCAST getBroadcast() { return broadcast; }
+
+	/// <summary>
+	/// Allocates a data object once per host: all workers of a host map the same MPI shared memory window (MPI_Win_allocate_shared), the master gets ordinary memory.
+	/// bcast_M_to_W only sends it to one leader worker per host (relayed among the leaders as chain or tree, BROADCAST_MPI acts as BROADCAST_TREE), the other workers of the host see the data once bcast_M_to_W returns.
+	/// Meant for read-only arguments like B: only the leader may write to it. Collective on all workers, free it with freeShared (collective as well, or a no-op on the window once Distributor::run has finalized MPI).
+	/// </summary>
+	static Data* allocateShared(const std::vector<std::size_t> &size, unsigned sizeOf);
+	static void freeShared(Data *data);
+	bool isShared() { return shared; }
+	/// <returns>true if this process receives and owns the host's copy of a shared data object, always true on the master and for data objects not shared</returns>
+	bool isHostLeader();
 
 	static std::vector<std::pair<std::string, long long unsigned>> getDurationDetails();
 
+	/// <summary>
+	/// Blocking communication between master and workers (over MPI_COMM_CLUSTER) and among the workers (over MPI_COMM_WORKER_TO_WORKER). Worker ids, ranks and collectives refer to the workers of the current node, see Node::setWorkers.
+	/// </summary>
 	int bcast_M_to_W();
 	int bcast_W_to_W(const int source);
 	int send_M_to_W(const int receiver, const int tag);
@@ -83,14 +273,51 @@ public:
 	MPI_Status recv_W_from_M(const int tag = MPI_ANY_TAG);
 	MPI_Status recv_M_from_W(const int source = MPI_ANY_SOURCE, const int tag = MPI_ANY_TAG);
 	MPI_Status recv_W_from_W(const int source = MPI_ANY_SOURCE, const int tag = MPI_ANY_TAG);
+
 	int gather_W_to_M(void* result);
 	int allGather_W_to_W(void* result);
 	int reduce_W_to_M(MPI_Datatype datatype, MPI_Op op);
 	int allReduce_W_to_W(void* result, MPI_Datatype datatype, MPI_Op op);
 
+	/// <summary>
+	/// Non-blocking counterparts of the functions above, see Request. Several operations on one data object may be outstanding as long as MPI allows it (eg. sending the same data to several workers).
+	/// Collectives need MPI 3.0 and have to be called in the same order on all processes, like their blocking counterparts. Non-blocking reductions are limited to INT_MAX elements.
+	/// </summary>
+	Request ibcast_M_to_W();
+	Request ibcast_W_to_W(const int source);
+	Request isend_M_to_W(const int receiver, const int tag);
+	Request isend_W_to_M(const int tag);
+	Request isend_W_to_W(const int receiver, const int tag);
+	Request irecv_W_from_M(const int tag = MPI_ANY_TAG);
+	Request irecv_M_from_W(const int source = MPI_ANY_SOURCE, const int tag = MPI_ANY_TAG);
+	Request irecv_W_from_W(const int source = MPI_ANY_SOURCE, const int tag = MPI_ANY_TAG);
+	Request igather_W_to_M(void* result);
+	Request iallGather_W_to_W(void* result);
+	Request ireduce_W_to_M(MPI_Datatype datatype, MPI_Op op);
+	Request iallReduce_W_to_W(void* result, MPI_Datatype datatype, MPI_Op op);
+
+	/// <summary>
+	/// One-sided result collection: opens an MPI window exposing the master's data object, the workers call it on a data object of the same element size without memory (eg. Data(nullptr, { N, N }, sizeof(T))).
+	/// Workers then write their results directly into it with put_W_to_M, the master does no receive work per byte; a small notice (eg. the chunk-id) tells it which part has arrived.
+	/// Collective on master and all workers, like closeWindow_M.
+	/// </summary>
+	int openWindow_M();
+	/// <summary>
+	/// Closes the window of openWindow_M, the master's data object is guaranteed to contain all puts afterwards. Collective on master and all workers.
+	/// </summary>
+	int closeWindow_M();
+	/// <summary>
+	/// Writes this data object into the master's data object, whose window is open in 'target' (see openWindow_M), starting at element 'offset'. Returns once the data has arrived at the master.
+	/// </summary>
+	int put_W_to_M(Data &target, const std::size_t offset);
+
 	static TAGS getLastTag() { return tag; }
 	static void setLastTag(TAGS t) { tag = t; }
 	static void setLastTag(int i) { tag = static_cast<TAGS>(i); }
 	static Data::TAGS expectTerminate();
+	/// <summary>
+	/// Checks without blocking whether a message with 'tag' from the master is waiting. Messages sent before it with other tags do not hold it back.
+	/// </summary>
+	static bool probe_W_from_M(const int tag);
 
 };
@@ -0,0 +1,154 @@
+// OpenCL device runtime, kept alive for the lifetime of a worker process
+// author: Schuchardt Martin, csap9442
+
+#include "DeviceRuntime.h"
+#include "../utils/Utils.h"
+
+std::map<unsigned, DeviceRuntime*> DeviceRuntime::runtimes;
+
+long long unsigned DeviceRuntime::count_programBuilds = 0;
+long long unsigned DeviceRuntime::count_programLookups = 0;
+long long unsigned DeviceRuntime::duration_programBuild = 0;
+long long unsigned DeviceRuntime::count_residentUploads = 0;
+
+
+DeviceRuntime::DeviceRuntime(unsigned _acc_device) : acc_device(_acc_device) {
+	id = cluInitDevice(acc_device, &ctx, &queue);
+}
+
+DeviceRuntime::~DeviceRuntime() {
+	int err = clFinish(queue);
+
+	for (auto &b : buffers)
+		err |= clReleaseMemObject(b.second.first);
+	for (auto &r : residents)
+		err |= clReleaseMemObject(std::get<0>(r.second));
+	for (auto &k : kernels)
+		err |= clReleaseKernel(k.second);
+	for (auto &p : programs)
+		err |= clReleaseProgram(p.second);
+
+	err |= clReleaseCommandQueue(queue);
+	err |= clReleaseContext(ctx);
+	CLU_ERRCHECK(err, "Failed during ocl cleanup");
+}
+
+DeviceRuntime& DeviceRuntime::get(unsigned acc_device) {
+	auto runtime = runtimes.find(acc_device);
+	if (runtime != runtimes.end())
+		return *runtime->second;
+
+	DeviceRuntime* newRuntime = new DeviceRuntime(acc_device);
+	runtimes[acc_device] = newRuntime;
+	return *newRuntime;
+}
+
+void DeviceRuntime::releaseAll() {
+	for (auto &runtime : runtimes)
+		delete runtime.second;
+	runtimes.clear();
+}
+
+cl_program DeviceRuntime::getProgram(const std::string &code, const std::string &options) {
+	++count_programLookups;
+	auto key = std::make_pair(code, options);
+	auto program = programs.find(key);
+	if (program != programs.end())
+		return program->second;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	// reading kernel from string spares erroneous mpi --preload-files, the binary cache in WORKDIR spares rebuilds after restarts
+	cl_program newProgram = cluBuildProgramFromStringCached(ctx, id, code.c_str(), options.c_str(), WORKDIR);
+	duration_programBuild += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	++count_programBuilds;
+
+	programs[key] = newProgram;
+	return newProgram;
+}
+
+cl_kernel DeviceRuntime::getKernel(const std::string &code, const std::string &options, const std::string &name) {
+	cl_program program = getProgram(code, options);
+
+	auto key = std::make_pair(program, name);
+	auto kernel = kernels.find(key);
+	if (kernel != kernels.end())
+		return kernel->second;
+
+	int err = 0;
+	cl_kernel newKernel = clCreateKernel(program, name.c_str(), &err);
+	CLU_ERRCHECK(err, "could not create kernel %s", name.c_str());
+
+	kernels[key] = newKernel;
+	return newKernel;
+}
+
+cl_mem DeviceRuntime::getBuffer(const std::string &name, cl_mem_flags flags, std::size_t size) {
+	auto buffer = buffers.find(name);
+	if (buffer != buffers.end()) {
+		if (buffer->second.second >= size)
+			return buffer->second.first;
+
+		CLU_ERRCHECK(clFinish(queue), "Failed to wait for pending commands");
+		CLU_ERRCHECK(clReleaseMemObject(buffer->second.first), "Failed to release buffer");
+		buffers.erase(buffer);
+	}
+
+	int err = 0;
+	cl_mem newBuffer = clCreateBuffer(ctx, flags, size, NULL, &err);
+	CLU_ERRCHECK(err, "Failed to create buffer");
+
+	buffers[name] = std::make_pair(newBuffer, size);
+	return newBuffer;
+}
+
+cl_mem DeviceRuntime::getResidentBuffer(Data *data) {
+	const std::size_t size = data->sizeTotal() * data->sizeOfData();
+	auto resident = residents.find(data);
+	if (resident != residents.end()) {
+		if (std::get<2>(resident->second) == data->getVersion() && std::get<1>(resident->second) == size)
+			return std::get<0>(resident->second);
+		releaseResidentBuffer(data);
+	}
+
+	int err = 0;
+	cl_mem newBuffer = clCreateBuffer(ctx, CL_MEM_READ_ONLY, size, NULL, &err);
+	CLU_ERRCHECK(err, "Failed to create resident buffer");
+	// blocking, as the host copy might change right after returning
+	if (data->isView()) { // device buffers are contiguous
+		std::vector<char> packed(size);
+		data->copyTo(packed.data());
+		CLU_ERRCHECK(clEnqueueWriteBuffer(queue, newBuffer, CL_TRUE, 0, size, packed.data(), 0, NULL, NULL), "Failed to write resident buffer");
+	} else {
+		CLU_ERRCHECK(clEnqueueWriteBuffer(queue, newBuffer, CL_TRUE, 0, size, data->get(), 0, NULL, NULL), "Failed to write resident buffer");
+	}
+	++count_residentUploads;
+
+	residents[data] = std::make_tuple(newBuffer, size, data->getVersion());
+	return newBuffer;
+}
+
+void DeviceRuntime::releaseResidentBuffer(Data *data) {
+	auto resident = residents.find(data);
+	if (resident == residents.end())
+		return;
+
+	CLU_ERRCHECK(clFinish(queue), "Failed to wait for pending commands");
+	CLU_ERRCHECK(clReleaseMemObject(std::get<0>(resident->second)), "Failed to release resident buffer");
+	residents.erase(resident);
+}
+
+std::vector<std::pair<std::string, long long unsigned>> DeviceRuntime::getDurationDetails() {
+	std::vector<std::pair<std::string, unsigned long long>> result;
+
+	result.push_back(std::pair<std::string, unsigned long long>("program lookups      ", count_programLookups));
+	result.push_back(std::pair<std::string, unsigned long long>("program builds       ", count_programBuilds));
+	result.push_back(std::pair<std::string, unsigned long long>("program build (ms)   ", duration_programBuild));
+	result.push_back(std::pair<std::string, unsigned long long>("resident uploads     ", count_residentUploads));
+
+	unsigned long long hits, misses;
+	cluGetBinaryCacheStatistics(&hits, &misses);
+	result.push_back(std::pair<std::string, unsigned long long>("binary cache hits    ", hits));
+	result.push_back(std::pair<std::string, unsigned long long>("binary cache misses  ", misses));
+
+	return result;
+}
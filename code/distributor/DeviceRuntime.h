@@ -0,0 +1,82 @@
+// OpenCL device runtime, kept alive for the lifetime of a worker process
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+
+#include "../utils/cl_utils.h"
+#include "Data.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <chrono>
+
+
+class DeviceRuntime {
+	static std::map<unsigned, DeviceRuntime*> runtimes; // one runtime per acc_device
+
+	static long long unsigned count_programBuilds;
+	static long long unsigned count_programLookups;
+	static long long unsigned duration_programBuild;
+	static long long unsigned count_residentUploads;
+
+	const unsigned acc_device;
+	cl_device_id id;
+	cl_context ctx;
+	cl_command_queue queue;
+
+	std::map<std::pair<std::string, std::string>, cl_program> programs; // (source, build options) -> program
+	std::map<std::pair<cl_program, std::string>, cl_kernel> kernels; // (program, kernel name) -> kernel
+	std::map<std::string, std::pair<cl_mem, std::size_t>> buffers; // name -> (buffer, size in bytes)
+	std::map<Data*, std::tuple<cl_mem, std::size_t, unsigned long long>> residents; // data object -> (buffer, size in bytes, uploaded version)
+
+	DeviceRuntime(unsigned acc_device);
+	~DeviceRuntime();
+	DeviceRuntime(const DeviceRuntime&) = delete;
+	DeviceRuntime& operator=(const DeviceRuntime&) = delete;
+
+public:
+	/// <summary>
+	/// Returns the runtime for OpenCL device 'acc_device'. Context and command queue are created on the first call only and reused afterwards, until DeviceRuntime::releaseAll() is called.
+	/// </summary>
+	/// <param name="acc_device">OpenCL device, numbered sequentially across all platforms (see cluInitDevice)</param>
+	/// <returns>runtime bound to the device</returns>
+	static DeviceRuntime& get(unsigned acc_device);
+	/// <summary>
+	/// Releases all kernels, programs, buffers, command queues and contexts of all devices. Called by Distributor::instanceFinalize.
+	/// </summary>
+	static void releaseAll();
+
+	cl_device_id getDevice() { return id; }
+	cl_context getContext() { return ctx; }
+	cl_command_queue getQueue() { return queue; }
+	unsigned getAccDevice() { return acc_device; }
+
+	/// <summary>
+	/// Returns the program built from 'code' with build options 'options'. The program is built only once per device and option string, program binaries are cached on disk in WORKDIR across process restarts.
+	/// </summary>
+	cl_program getProgram(const std::string &code, const std::string &options);
+	/// <summary>
+	/// Returns kernel 'name' of the program built from 'code' with 'options'. Program and kernel are created on first use only.
+	/// Kernel arguments are not reset between lookups, so set all arguments before each enqueue.
+	/// </summary>
+	cl_kernel getKernel(const std::string &code, const std::string &options, const std::string &name);
+	/// <summary>
+	/// Returns a device buffer with at least 'size' bytes, identified by 'name'. The buffer is reallocated only if a larger size is requested, the content is undefined afterwards.
+	/// </summary>
+	cl_mem getBuffer(const std::string &name, cl_mem_flags flags, std::size_t size);
+	/// <summary>
+	/// Returns a read-only device buffer holding the content of 'data'. The data object is uploaded on first use only and again after its host copy has changed (see Data::modified), so arguments like matrix B are transferred once per worker instead of once per chunk.
+	/// </summary>
+	/// <param name="data">data object, e.g. an argument after it has been broadcasted to the workers</param>
+	/// <returns>device buffer with the current content of 'data'</returns>
+	cl_mem getResidentBuffer(Data *data);
+	/// <summary>
+	/// Releases the device-resident copy of 'data', if there is any.
+	/// </summary>
+	void releaseResidentBuffer(Data *data);
+
+	static std::vector<std::pair<std::string, long long unsigned>> getDurationDetails();
+};
@@ -3,10 +3,12 @@
 
 #include "Distributor.h"
 
-MPI_Comm MPI_COMM_CLUSTER;
-MPI_Comm MPI_COMM_WORKER_TO_WORKER;
-int DISTRIBUTOR_ROOT_NODE;
-int DISTRIBUTOR_MPI_SIZE;
+#include <csignal>
+
+thread_local MPI_Comm MPI_COMM_CLUSTER;
+thread_local MPI_Comm MPI_COMM_WORKER_TO_WORKER;
+thread_local int DISTRIBUTOR_ROOT_NODE;
+thread_local int DISTRIBUTOR_MPI_SIZE;
 std::string CREATE_INSTANCES_CMD("./createInstances.sh");
 const std::string MPI_HOSTFILE("mpi.hostfile");
 
@@ -22,6 +24,8 @@ const float Distributor::CLUSTER_TIME_UNIT_MAINTENANCE_BUFFER = 0.75f;
 #else
 const float Distributor::CLUSTER_TIME_UNIT_MAINTENANCE_BUFFER = 0.9f;
 #endif // DEBUG_REDUCE_RESTART_CLUSTER_TIME_UNIT
+const double Distributor::THROUGHPUT_WEIGHT = 0.3;
+const double Distributor::WORKER_TIMEOUT_FACTOR = 10;
 
 
 const char DOT_GRAPH_HEADER[] = "digraph graphname{\n  graph [ ranksep=\"0.2\", nodesep=\"0.08\"];\n";
@@ -29,11 +33,16 @@ const char DOT_GRAPH_FOOTER[] = "}";
 
 
 int Distributor::instanceInit() {
-	int err = MPI_Init(&ARGC, &ARGV);
+	int err;
+	if (hasConcurrentNodes()) // the master runs them in threads
+		err = MPI_Init_thread(&ARGC, &ARGV, MPI_THREAD_MULTIPLE, &threadLevel);
+	else
+		err = MPI_Init(&ARGC, &ARGV);
 	if (err == MPI_SUCCESS) {
 		err = MPI_Comm_size(MPI_COMM_WORLD, &MPI_SIZE);
 		err |= MPI_Comm_rank(MPI_COMM_WORLD, &MPI_RANK);
 	}
+	CLUSTER_RANK = MPI_RANK;
 	MPI_Comm_get_parent(&MPI_COMM_CLUSTER);
 	storeMPIInstanceName();
 
@@ -111,16 +120,15 @@ int Distributor::instanceInit() {
 			return err;
 		}
 
+		MPI_Comm_set_errhandler(MPI_COMM_CLUSTER, MPI_ERRORS_RETURN); // a lost worker must not take down the master, see detectLostWorker
 		MPI_Comm_remote_size(MPI_COMM_CLUSTER, &universe_size);
 		newMPI_SIZE = MPI_SIZE = universe_size;
+		lostWorkers.assign(universe_size, false);
 
-		std::queue<int>().swap(idleWorkers); // clear queue in case it was already in use (eg. this function is called during cluster resize)
-		for (int i = 0; i < universe_size; ++i)
-			idleWorkers.push(i);
-			
-		workersBusy.resize(universe_size);
-		for (unsigned i = 0; i < workersBusy.size(); ++i)
-			workersBusy[i] = false;
+		workersInFlight.assign(universe_size, std::multimap<unsigned, std::chrono::steady_clock::time_point>());
+		workerEstimates.assign(universe_size, WorkerEstimate());
+		estimatesNode = nullptr;
+		resetIdleQueue(); // clears queue in case it was already in use (eg. this function is called during cluster resize)
 
 		MPI_COMM_WORKER_TO_WORKER = MPI_COMM_NULL;
 	} else {
@@ -174,27 +182,45 @@ void Distributor::graphAppendEdge(const std::string from, const std::string to)
 	dotGraph.append(from + " -> " + to + " [arrowsize=.5, weight=2.]\n");
 }
 
-std::set<Node*> Distributor::getSuccessors(Node *n) {
-	std::set<Node*> result;
-	std::queue<Node*> search;
-	std::set<Node*> visited;
-	
-	search.push(targetNode);
-	while (search.size() > 0) {
-		auto node = search.front();
-		search.pop();
-		
-		visited.insert(node);
-		for (auto dep : node->getDependencies()) {
-			if (dep->getID() == n->getID())
-				result.insert(node);
-			
-			if (visited.find(dep) == visited.end())
-				search.push(dep);
-		}
+const std::vector<Node*> &Distributor::getSuccessors(Node *n) {
+	static const std::vector<Node*> none;
+	auto it = successors.find(n);
+	return it == successors.end() ? none : it->second;
+}
+
+void Distributor::buildSchedule() {
+	successors.clear();
+	criticalPath.clear();
+	std::map<Node*, std::size_t> inDegree;
+	for (auto n : allNodes) {
+		successors[n];
+		inDegree[n] = n->getDependencies().size();
+		for (auto dep : n->getDependencies())
+			successors[dep].push_back(n);
 	}
 
-	return result;
+	// Kahn's algorithm for a topological order, then critical paths from the target node backwards
+	std::vector<Node*> order;
+	order.reserve(allNodes.size());
+	for (auto n : allNodes)
+		if (inDegree[n] == 0)
+			order.push_back(n);
+	for (std::size_t i = 0; i < order.size(); ++i)
+		for (auto successor : successors[order[i]])
+			if (--inDegree[successor] == 0)
+				order.push_back(successor);
+
+	for (auto n = order.rbegin(); n != order.rend(); ++n) {
+		unsigned longest = 0;
+		for (auto successor : successors[*n])
+			longest = std::max(longest, criticalPath[successor]);
+		criticalPath[*n] = longest + 1;
+	}
+}
+
+bool Distributor::schedulesBefore(Node *a, Node *b) {
+	const unsigned pathA = criticalPath[a], pathB = criticalPath[b];
+	return pathA != pathB ? pathA > pathB : a->getID() < b->getID();
 }
 
 int Distributor::computeNodes() {
@@ -206,39 +232,43 @@ int Distributor::computeNodes() {
 	if (dotGraph.size() == 0) // initialize, if not prefilled from cluster restart
 		dotGraph.assign(DOT_GRAPH_HEADER);
 
-	// start working on target node bottom up through all dependencies
-	std::list<Node*> readySet, dependenciesSet;
-	dependenciesSet.insert(dependenciesSet.end(), allNodes.begin(), allNodes.end());
-
-	while (dependenciesSet.size() != 0 || readySet.size() != 0) {
-		std::list<Node*> nextNodes;
-		for (auto n = dependenciesSet.begin(); n != dependenciesSet.end(); ++n)
-			if ((*n)->isReady())
-				nextNodes.push_back(*n);
-
-		for (auto n : nextNodes) {
-			readySet.push_back(n);
-			dependenciesSet.erase(std::find(dependenciesSet.begin(), dependenciesSet.end(), n));
-		}
+	if (hasConcurrentNodes()) { // computes all nodes, the loop below has nothing left to do unless the cluster restarts
+		err = computeNodesConcurrently();
+		if (restartingCluster)
+			return err;
+	}
 
-		std::list<Node*> computedNodes;
-		for (auto n : readySet) {
-			if (!n->hasFinished()) {
-				graphAppendNode(n);
-				err |= n->run(*this);
-				if (restartingCluster) {
-					return err;
-				}
+	// start working on target node bottom up through all dependencies: Kahn's algorithm, the ready node with the longest critical path first
+	auto later = [this](Node *a, Node *b) { return schedulesBefore(b, a); };
+	std::priority_queue<Node*, std::vector<Node*>, decltype(later)> readySet(later);
+	std::map<Node*, std::size_t> missingDependencies;
+	for (auto n : allNodes) {
+		missingDependencies[n] = n->getDependencies().size();
+		if (missingDependencies[n] == 0)
+			readySet.push(n);
+	}
 
-				output << n->getOutput();
-				graphAppendEdge(n);
+	while (!readySet.empty()) {
+		Node *n = readySet.top();
+		readySet.pop();
+		if (!n->hasFinished()) { // finished before a cluster restart otherwise
+			if (isMaster() && lostWorkerCount() > 0 && !n->getIsMasterOnly()) {
+				restartWithoutLostWorkers(n);
+				return err;
+			}
+			graphAppendNode(n);
+			err |= n->run(*this);
+			if (restartingCluster) {
+				return err;
 			}
 
-			computedNodes.push_back(n);
+			output << n->getOutput();
+			graphAppendEdge(n);
 		}
 
-		for (auto n : computedNodes)
-			readySet.erase(std::find(readySet.begin(), readySet.end(), n));
+		for (auto successor : getSuccessors(n))
+			if (--missingDependencies[successor] == 0)
+				readySet.push(successor);
 	}
 	finished = true;
 
@@ -258,6 +288,255 @@ int Distributor::computeNodes() {
 
 }
 
+void Distributor::restartWithoutLostWorkers(Node *n) {
+	output << indentLogText(std::to_string(lostWorkerCount()) + " worker(s) lost, restarting the cluster before " + n->getDescription());
+	restartingCluster = abandonWorkers = true;
+	if (!saveCheckpoint(n)) {
+		std::cerr << "ERROR: could not write checkpoint (" + CHECKPOINT_FILE + "). Terminating now." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+bool Distributor::hasConcurrentNodes() {
+	for (auto n : allNodes)
+		if (n->getWorkers() > 0)
+			return true;
+	return false;
+}
+
+Distributor::Distributor(Distributor &cluster, unsigned workers) : ARGC(cluster.ARGC), ARGV(cluster.ARGV) {
+	MPI_SIZE = newMPI_SIZE = static_cast<int>(workers);
+	MPI_RANK = CLUSTER_RANK = cluster.CLUSTER_RANK; // workers keep their GPU, followAssignments sets their rank within the node's workers
+	_isMaster = cluster._isMaster;
+	targetNode = nullptr;
+	successors = cluster.successors; // for the node's dot-graph
+	parameters = cluster.parameters;
+	clusterDistributor = &cluster;
+	threadLevel = cluster.threadLevel;
+	start = cluster.start;
+	if (_isMaster) {
+		workersInFlight.assign(workers, std::multimap<unsigned, std::chrono::steady_clock::time_point>());
+		workerEstimates.assign(workers, WorkerEstimate());
+		lostWorkers.assign(workers, false);
+		resetIdleQueue();
+	}
+	workerTimeout = cluster.workerTimeout;
+}
+
+void Distributor::useCommunicators(MPI_Comm cluster, MPI_Comm workers, int size) {
+	MPI_COMM_CLUSTER = cluster;
+	MPI_COMM_WORKER_TO_WORKER = workers;
+	DISTRIBUTOR_ROOT_NODE = workers == MPI_COMM_NULL ? MPI_ROOT : 0;
+	DISTRIBUTOR_MPI_SIZE = size;
+}
+
+int Distributor::computeNodesConcurrently() {
+	MPI_Comm nodeComm;
+	MPI_Intercomm_merge(MPI_COMM_CLUSTER, isMaster() ? 0 : 1, &nodeComm);
+	int err = isMaster() ? assignNodes(nodeComm) : followAssignments(nodeComm);
+	MPI_Comm_free(&nodeComm);
+	return err;
+}
+
+// master: starts every ready node as soon as enough workers are free. Nodes with Node::setWorkers get their own intercommunicator to their workers and run in a thread,
+// the others run alone with the whole cluster (or the master only). Workers get back to the pool when the thread of their node has finished
+int Distributor::assignNodes(MPI_Comm nodeComm) {
+	struct Group {
+		Node *node;
+		std::vector<int> workers;
+		MPI_Comm comm;
+		Distributor *distributor;
+		std::thread thread;
+		int err;
+	};
+	std::list<Group> running;
+	std::list<Group*> done; // filled by the threads
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	std::vector<bool> busy(MPI_SIZE, false);
+	std::list<Node*> pending(allNodes.begin(), allNodes.end());
+	pending.sort([this](Node *a, Node *b) { return schedulesBefore(a, b); }); // ready nodes on the critical path get the workers first
+	int err = 0;
+
+	auto assign = [&](Node *n, const std::vector<int> &workers) {
+		std::vector<int> assignment = { static_cast<int>(n->getID()), static_cast<int>(workers.size()) };
+		assignment.insert(assignment.end(), workers.begin(), workers.end());
+		for (auto w : workers)
+			MPI_Send(assignment.data(), static_cast<int>(assignment.size()), MPI_INT, w + 1, ASSIGN_NODE_TAG, nodeComm);
+	};
+	auto runGroup = [&](Group *group) {
+		useCommunicators(group->comm, MPI_COMM_NULL, static_cast<int>(group->workers.size()));
+		group->err = group->node->run(*group->distributor);
+		group->distributor->waitForDroppedResults(); // before its communicator is freed
+		std::lock_guard<std::mutex> lock(doneMutex);
+		done.push_back(group);
+		doneCondition.notify_one();
+	};
+
+	while (!pending.empty() || !running.empty()) {
+		for (auto it = pending.begin(); it != pending.end(); ) {
+			Node *n = *it;
+			if (n->hasFinished()) { // by a previous run of the cluster
+				it = pending.erase(it);
+				continue;
+			}
+			if (!n->isReady()) {
+				++it;
+				continue;
+			}
+			if (lostWorkerCount() > 0 && !n->getIsMasterOnly()) { // once the running nodes have finished, like in computeNodes
+				if (!running.empty()) {
+					++it;
+					continue;
+				}
+				restartWithoutLostWorkers(n);
+				return err;
+			}
+
+			const unsigned size = n->getWorkers();
+			if (size == 0 || size >= getSize() || n->getIsMasterOnly()) { // needs the whole cluster
+				if (!running.empty()) {
+					++it;
+					continue;
+				}
+				graphAppendNode(n);
+				if (!n->getIsMasterOnly()) {
+					std::vector<int> all(MPI_SIZE);
+					for (int w = 0; w < MPI_SIZE; ++w)
+						all[w] = w;
+					assign(n, all);
+				}
+				err |= n->run(*this);
+				if (restartingCluster)
+					return err;
+				output << n->getOutput();
+				graphAppendEdge(n);
+				it = pending.erase(it);
+				continue;
+			}
+
+			std::vector<int> workers;
+			for (int w = 0; w < MPI_SIZE && workers.size() < size; ++w)
+				if (!busy[w])
+					workers.push_back(w);
+			if (workers.size() < size) {
+				++it;
+				continue;
+			}
+			for (auto w : workers)
+				busy[w] = true;
+
+			graphAppendNode(n);
+			assign(n, workers);
+			running.push_back(Group());
+			Group &group = running.back();
+			group.node = n;
+			group.workers = workers;
+			MPI_Intercomm_create(MPI_COMM_SELF, 0, nodeComm, workers[0] + 1, CREATE_GROUP_TAG, &group.comm);
+			group.distributor = new Distributor(*this, size);
+			output << indentLogText("running " + n->getDescription() + " on workers " + std::to_string(workers.front()) + (workers.size() > 1 ? "..." + std::to_string(workers.back()) : "") + " of the pool");
+			if (threadLevel == MPI_THREAD_MULTIPLE)
+				group.thread = std::thread(runGroup, &group);
+			else { // one after another on the master, its communicators have to be restored
+				const MPI_Comm cluster = MPI_COMM_CLUSTER;
+				runGroup(&group);
+				useCommunicators(cluster, MPI_COMM_NULL, MPI_SIZE);
+			}
+			it = pending.erase(it);
+		}
+		if (running.empty())
+			continue;
+
+		Group *group;
+		{
+			std::unique_lock<std::mutex> lock(doneMutex);
+			doneCondition.wait(lock, [&]() { return !done.empty(); });
+			group = done.front();
+			done.pop_front();
+		}
+		if (group->thread.joinable())
+			group->thread.join();
+		err |= group->err;
+		MPI_Comm_free(&group->comm);
+		output << group->distributor->output.str() << group->node->getOutput();
+		dotGraph.append(group->distributor->dotGraph);
+		graphAppendEdge(group->node);
+		abandonedResults.splice(abandonedResults.end(), group->distributor->abandonedResults); // MPI may still write into them until MPI_Finalize
+		abandonedRequests.splice(abandonedRequests.end(), group->distributor->abandonedRequests);
+		for (std::size_t i = 0; i < group->workers.size(); ++i)
+			if (group->distributor->isLost(static_cast<int>(i)))
+				lostWorkers[group->workers[i]] = true; // stays busy, no further node gets it
+			else
+				busy[group->workers[i]] = false;
+		delete group->distributor;
+		running.remove_if([&](const Group &g) { return &g == group; });
+	}
+
+	// a worker has run the nodes assigned to it only, the others have to be marked finished or it would enter them once more after computeNodesConcurrently
+	std::vector<int> finished = { NO_NODE, 0 };
+	for (auto n : allNodes)
+		if (n->hasFinished())
+			finished.push_back(static_cast<int>(n->getID()));
+	finished[1] = static_cast<int>(finished.size()) - 2;
+	for (int w = 0; w < MPI_SIZE; ++w)
+		if (!isLost(w))
+			MPI_Send(finished.data(), static_cast<int>(finished.size()), MPI_INT, w + 1, ASSIGN_NODE_TAG, nodeComm);
+	return err;
+}
+
+// worker: runs the nodes the master assigns, with the whole cluster or with the other workers of its group
+int Distributor::followAssignments(MPI_Comm nodeComm) {
+	int err = 0;
+	std::vector<int> assignment(2 + std::max(static_cast<std::size_t>(MPI_SIZE), allNodes.size())); // node and its workers, or NO_NODE and the finished nodes
+	auto node = [this](int id) {
+		Node *n = nullptr;
+		for (auto node : allNodes)
+			if (static_cast<int>(node->getID()) == id)
+				n = node;
+		assert(n);
+		return n;
+	};
+	while (true) {
+		MPI_Recv(assignment.data(), static_cast<int>(assignment.size()), MPI_INT, 0, ASSIGN_NODE_TAG, nodeComm, MPI_STATUS_IGNORE);
+		if (assignment[0] == NO_NODE) {
+			for (int i = 0; i < assignment[1]; ++i)
+				node(assignment[2 + i])->hasFinished(true);
+			break;
+		}
+		Node *n = node(assignment[0]);
+
+		const int size = assignment[1];
+		if (size == MPI_SIZE) {
+			err |= n->run(*this);
+			if (restartingCluster)
+				return err;
+			output << n->getOutput();
+			continue;
+		}
+
+		MPI_Group world, members;
+		MPI_Comm groupWorkers, groupCluster;
+		MPI_Comm_group(MPI_COMM_WORLD, &world);
+		MPI_Group_incl(world, size, &assignment[2], &members);
+		MPI_Comm_create_group(MPI_COMM_WORLD, members, CREATE_GROUP_TAG, &groupWorkers);
+		MPI_Intercomm_create(groupWorkers, 0, nodeComm, 0, CREATE_GROUP_TAG, &groupCluster);
+		MPI_Group_free(&members);
+		MPI_Group_free(&world);
+
+		const MPI_Comm cluster = MPI_COMM_CLUSTER;
+		Distributor group(*this, static_cast<unsigned>(size));
+		MPI_Comm_rank(groupWorkers, &group.MPI_RANK); // worker ids of the master and ranks in groupWorkers: the order of the assignment
+		useCommunicators(groupCluster, groupWorkers, size);
+		err |= n->run(group);
+		useCommunicators(cluster, MPI_COMM_WORLD, MPI_SIZE);
+		output << group.output.str() << n->getOutput();
+
+		MPI_Comm_free(&groupCluster);
+		MPI_Comm_free(&groupWorkers);
+	}
+	return err;
+}
+
 /// <summary>
 /// run() includes computing all dependend nodes of the graph, then finalizing the cluster again (collecting logs, shutdown instances (if flag is set))
 /// </summary>
@@ -275,12 +554,13 @@ bool Distributor::findCycle(Node* current, Node* parent, std::list<Node*> &check
 		return false;
 	}
 
-	allNodes.insert(current);
-	graphAppendNode(current);
+	const bool visited = !allNodes.insert(current).second;
+	if (!visited)
+		graphAppendNode(current);
 	if (parent)
 		graphAppendEdge(std::to_string(current->getID()), std::to_string(parent->getID()));
 
-	if (current->getDependencies().size() == 0) {
+	if (visited || current->getDependencies().size() == 0) { // dependencies of a visited node have been checked already
 		return true;
 	} else {
 		checkDependencies.push_back(current);
@@ -305,6 +585,8 @@ bool Distributor::setTargetNode(Node * _targetNode) {
 
 	std::list<Node*> checkDependencies;
 	const bool result = findCycle(targetNode, nullptr, checkDependencies);
+	if (result)
+		buildSchedule();
 
 	dotGraph.append(DOT_GRAPH_FOOTER);
 	std::ofstream dotFile;
@@ -343,6 +625,15 @@ std::vector<std::pair<std::string, unsigned long long>> Distributor::getDuration
 
 	for (auto subResult : Data::getDurationDetails())
 		result.push_back(subResult);
+	for (auto subResult : DeviceRuntime::getDurationDetails())
+		result.push_back(subResult);
+	for (std::size_t i = 0; i < workerEstimates.size(); ++i) { // master only, throughput of the last node
+		std::string worker = "worker " + std::to_string(i);
+		worker.resize(std::max<std::size_t>(worker.size(), 10), ' ');
+		result.push_back(std::pair<std::string, unsigned long long>(worker + " chunks     ", workerEstimates[i].chunks));
+		result.push_back(std::pair<std::string, unsigned long long>(worker + " items      ", workerEstimates[i].items));
+		result.push_back(std::pair<std::string, unsigned long long>(worker + " items/min  ", static_cast<unsigned long long>(workerEstimates[i].throughput * 60 + 0.5)));
+	}
 	
 	return result;
 }
@@ -360,26 +651,99 @@ std::string Distributor::whoAmI() {
 	return result;
 }
 
-int Distributor::nextWorker(Node* n) {
+int Distributor::nextWorker(Node* n, unsigned chunk, std::size_t remainingItems) {
 	if (isRestarting()) // node has to exit and must not try to retrieve workers once a restart has been initiated
 		n->addOutput(indentLogText("distributor refused attempt to get an idle worker because a restart is in progress..."));
 
 	if (idleWorkers.empty())
 		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
 
-	auto result = idleWorkers.front();
-	workersBusy[result] = true;
+	if (n != estimatesNode) { // another kernel, the estimates of the previous node do not apply
+		for (auto &estimate : workerEstimates) {
+			estimate.throughput = estimate.itemsPerChunk = 0;
+			estimate.lastReturn = std::chrono::steady_clock::time_point::min();
+		}
+		estimatesNode = n;
+	}
 
-	idleWorkers.pop();
+	// the free slot of the worker expected to finish its next chunk first. In queue order while a worker has no estimate yet (0), so every worker gets measured
+	auto best = idleWorkers.begin();
+	double bestFinish = expectedFinish(*best, 1);
+	for (auto it = best + 1; bestFinish > 0 && it != idleWorkers.end(); ++it) {
+		const double finish = expectedFinish(*it, 1);
+		if (finish < bestFinish) {
+			best = it;
+			bestFinish = finish;
+		}
+	}
+	if (straggles(n, *best, remainingItems)) {
+		n->addOutput(indentLogText("distributor keeps slow worker " + std::to_string(*best) + " away from the last items, waiting for a faster one..."));
+		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+	}
+
+	auto result = *best;
+	workersInFlight[result].insert(std::make_pair(chunk, std::chrono::steady_clock::now()));
+
+	idleWorkers.erase(best);
 	return result;
 }
 
-void Distributor::addToIdleQueue(Node& n, int worker) {
-	if (!resizeInProgress() || !n.isResizeable())
-			idleWorkers.push(worker);
+double Distributor::expectedFinish(int worker, unsigned additional) {
+	const auto &estimate = workerEstimates[worker];
+	if (estimate.throughput <= 0)
+		return 0;
+	return (workersInFlight[worker].size() + additional) * estimate.itemsPerChunk / estimate.throughput;
+}
 
-	
-	workersBusy[worker] = false;
+bool Distributor::straggles(Node* n, int worker, std::size_t remaining) {
+	if (remaining == 0 && n->TOTAL_COUNT > n->LOOP_COUNTER) // auto resize: the loop counter counts the items handed out
+		remaining = n->TOTAL_COUNT - n->LOOP_COUNTER;
+	if (remaining == 0) // unknown
+		return false;
+
+	double throughput = 0, itemsInFlight = 0;
+	for (std::size_t i = 0; i < workerEstimates.size(); ++i) {
+		if (workerEstimates[i].throughput <= 0)
+			return false; // not measured yet
+		throughput += workerEstimates[i].throughput;
+		itemsInFlight += workersInFlight[i].size() * workerEstimates[i].itemsPerChunk;
+	}
+	const double drain = (remaining + itemsInFlight) / throughput;
+	const double finish = expectedFinish(worker, 1);
+	if (finish <= drain)
+		return false;
+
+	// only wait for a worker that is going to return a chunk, otherwise nobody would wake the caller up
+	for (std::size_t i = 0; i < workersInFlight.size(); ++i)
+		if (static_cast<int>(i) != worker && !workersInFlight[i].empty() && expectedFinish(static_cast<int>(i), 1) < finish)
+			return true;
+	return false;
+}
+
+void Distributor::addToIdleQueue(Node& n, int worker, unsigned chunk, unsigned items) {
+	if (isLost(worker)) // a late result, the worker stays out
+		return;
+
+	if (!resizeInProgress() || !n.isResizeable())
+			idleWorkers.push_back(worker);
+
+	auto &inFlight = workersInFlight[worker];
+	auto it = chunk == NO_CHUNK_ID ? inFlight.begin() : inFlight.find(chunk);
+	if (it != inFlight.end()) {
+		// the worker started on this chunk when it arrived or when it returned its previous one, whichever was later
+		auto &estimate = workerEstimates[worker];
+		const auto now = std::chrono::steady_clock::now();
+		const double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now - std::max(it->second, estimate.lastReturn)).count() / 1e9;
+		estimate.lastReturn = now;
+		++estimate.chunks;
+		estimate.items += items;
+		if (&n == estimatesNode && seconds > 0 && items > 0) { // no items: a dropped duplicate
+			const double throughput = items / seconds;
+			estimate.throughput = estimate.throughput > 0 ? THROUGHPUT_WEIGHT * throughput + (1 - THROUGHPUT_WEIGHT) * estimate.throughput : throughput;
+			estimate.itemsPerChunk = estimate.itemsPerChunk > 0 ? THROUGHPUT_WEIGHT * items + (1 - THROUGHPUT_WEIGHT) * estimate.itemsPerChunk : items;
+		}
+		inFlight.erase(it);
+	}
 
 	n.dotGraph_AppendWorkerChunk(worker, this);
 	estimateResizing(n);
@@ -388,7 +752,256 @@ void Distributor::addToIdleQueue(Node& n, int worker) {
 		resizeCluster(n);
 }
 
+int Distributor::speculativeWorker(Node* n, const std::map<unsigned, unsigned> &chunks, const double factor, unsigned &chunk) {
+	if (idleWorkers.empty() || n != estimatesNode)
+		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+
+	double sum = 0;
+	unsigned measured = 0;
+	for (auto &estimate : workerEstimates)
+		if (estimate.throughput > 0) {
+			sum += estimate.throughput;
+			++measured;
+		}
+	if (measured == 0)
+		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+	const double average = sum / measured;
+	const auto now = std::chrono::steady_clock::now();
+
+	int straggler = Distributor::NO_IDLE_WORKERS_AVAILABLE;
+	double worst = factor; // running time in expected durations
+	for (std::size_t w = 0; w < workersInFlight.size(); ++w) {
+		const auto &estimate = workerEstimates[w];
+		const double throughput = estimate.throughput > 0 ? estimate.throughput : average;
+		// in the order the worker computes them: a chunk starts when the worker returned its last result or when the chunks before it are expected to be done
+		std::vector<std::pair<std::chrono::steady_clock::time_point, unsigned>> queue;
+		for (auto &inFlight : workersInFlight[w])
+			queue.push_back(std::make_pair(inFlight.second, inFlight.first));
+		std::sort(queue.begin(), queue.end());
+
+		double ahead = 0;
+		for (auto &queued : queue) {
+			auto candidate = chunks.find(queued.second);
+			const double expected = (candidate != chunks.end() ? candidate->second : estimate.itemsPerChunk) / throughput;
+			if (candidate != chunks.end() && expected > 0) {
+				const double running = std::chrono::duration_cast<std::chrono::nanoseconds>(now - std::max(queued.first, estimate.lastReturn)).count() / 1e9 - ahead;
+				if (running / expected > worst) {
+					worst = running / expected;
+					straggler = static_cast<int>(w);
+					chunk = queued.second;
+				}
+			}
+			ahead += expected;
+		}
+	}
+	if (straggler == Distributor::NO_IDLE_WORKERS_AVAILABLE)
+		return straggler;
+
+	// the free slot of another worker expected to finish the duplicate first
+	auto best = idleWorkers.end();
+	double bestFinish = 0;
+	for (auto it = idleWorkers.begin(); it != idleWorkers.end(); ++it) {
+		if (*it == straggler)
+			continue;
+		const double throughput = workerEstimates[*it].throughput > 0 ? workerEstimates[*it].throughput : average;
+		const double finish = (workersInFlight[*it].size() + 1) * chunks.at(chunk) / throughput;
+		if (best == idleWorkers.end() || finish < bestFinish) {
+			best = it;
+			bestFinish = finish;
+		}
+	}
+	if (best == idleWorkers.end())
+		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+
+	auto result = *best;
+	workersInFlight[result].insert(std::make_pair(chunk, now));
+	idleWorkers.erase(best);
+	return result;
+}
+
+void Distributor::dropResult(int worker, unsigned chunk, Data *result, std::size_t maxRows) {
+	droppedResults.push_back(DroppedResult());
+	auto &dropped = droppedResults.back();
+	dropped.worker = worker;
+	dropped.since = std::chrono::steady_clock::now();
+	auto &inFlight = workersInFlight[worker];
+	auto it = inFlight.find(chunk);
+	if (it != inFlight.end()) {
+		dropped.since = it->second;
+		inFlight.erase(it);
+	}
+
+	// receives of the same source and tag match in the order they were posted: these get the worker's next result, a duplicate, but not necessarily this one.
+	// With several duplicates on the worker the results arrive in the order they were handed out, every buffer has room for the largest
+	dropped.idData = new Data(&dropped.id, { 1 }, sizeof(unsigned));
+	dropped.idReceived = dropped.idData->irecv_M_from_W(worker, Data::TAGS::CHUNK_ID_TAG);
+	dropped.resultData = nullptr;
+	if (result) {
+		const std::size_t rows = result->size()[0], items = rows ? result->sizeTotal() / rows * std::max(rows, maxRows) : 0;
+		dropped.buffer.resize(result->sizeOfData() * items);
+		dropped.resultData = new Data(dropped.buffer.data(), { items }, result->sizeOfData());
+		dropped.resultData->setCompression(result->getCompression());
+		dropped.resultReceived = dropped.resultData->irecv_M_from_W(worker, Data::TAGS::RECEIVE_CHUNK_TAG);
+	}
+}
+
+void Distributor::waitForDroppedResults() {
+	while (!testDroppedResults())
+		std::this_thread::yield();
+}
+
+bool Distributor::testDroppedResults() {
+	for (auto abandoned = abandonedResults.begin(); abandoned != abandonedResults.end(); ) {
+		if (!abandoned->idReceived.test() || !abandoned->resultReceived.test()) {
+			++abandoned;
+			continue;
+		}
+		delete abandoned->idData;
+		delete abandoned->resultData;
+		abandoned = abandonedResults.erase(abandoned);
+	}
+
+	// polled like ChunkScheduler::receiveResult: the worker of a duplicate may have died meanwhile
+	for (auto dropped = droppedResults.begin(); dropped != droppedResults.end(); ) {
+		const int w = dropped->worker;
+		const double timeout = isLost(w) || workerTimeout <= 0 ? 0 : silenceTimeout(w);
+		const auto since = std::max(dropped->since, workerEstimates[w].lastReturn);
+		if (timeout > 0 && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count() / 1000.0 > timeout) {
+			lostWorkers[w] = true;
+			output << indentLogText("worker " + std::to_string(w) + " lost: no dropped result for " + std::to_string(static_cast<long long>(timeout)) + "s");
+		}
+		if (isLost(w)) { // a late result would still be written into the buffers, they are kept until it arrives or MPI_Finalize
+			abandonedResults.splice(abandonedResults.end(), droppedResults, dropped++);
+			continue;
+		}
+		if (!dropped->idReceived.test() || !dropped->resultReceived.test()) {
+			++dropped;
+			continue;
+		}
+		delete dropped->idData;
+		delete dropped->resultData;
+		dropped = droppedResults.erase(dropped);
+	}
+	return droppedResults.empty();
+}
+
+void Distributor::waitForWorkers(std::vector<Data::Request> &requests) {
+	for (;;) {
+		releaseLost(requests);
+		bool done = true;
+		for (auto &request : requests)
+			done = request.test() && done;
+		if (done)
+			return;
+		testDroppedResults();
+		std::this_thread::yield();
+	}
+}
+
+int Distributor::detectLostWorker(std::vector<unsigned> &chunks) {
+	if (workerTimeout <= 0)
+		return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+
+	const auto now = std::chrono::steady_clock::now();
+	for (std::size_t w = 0; w < workersInFlight.size(); ++w) {
+		auto &inFlight = workersInFlight[w];
+		if (isLost(static_cast<int>(w)) || inFlight.empty())
+			continue;
+
+		// silent since it got its oldest chunk or returned its last one
+		const auto &estimate = workerEstimates[w];
+		auto since = inFlight.begin()->second;
+		for (auto &chunk : inFlight)
+			since = std::min(since, chunk.second);
+		since = std::max(since, estimate.lastReturn);
+		const double timeout = silenceTimeout(static_cast<int>(w));
+		if (timeout <= 0 || std::chrono::duration_cast<std::chrono::milliseconds>(now - since).count() / 1000.0 <= timeout)
+			continue;
+
+		lostWorkers[w] = true;
+		chunks.clear();
+		for (auto &chunk : inFlight)
+			if (chunk.first != NO_CHUNK_ID)
+				chunks.push_back(chunk.first);
+		inFlight.clear();
+		idleWorkers.erase(std::remove(idleWorkers.begin(), idleWorkers.end(), static_cast<int>(w)), idleWorkers.end());
+		output << indentLogText("worker " + std::to_string(w) + " lost: no result for " + std::to_string(static_cast<long long>(timeout)) + "s, " + std::to_string(chunks.size()) + " chunk(s) to hand out again");
+		if (lostWorkerCount() == lostWorkers.size()) {
+			std::cerr << std::string(COLOR_RED) + "ERROR: all workers have been lost. Terminating now." + std::string(COLOR_NC) << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		return static_cast<int>(w);
+	}
+	return Distributor::NO_IDLE_WORKERS_AVAILABLE;
+}
+
+double Distributor::silenceTimeout(int worker) {
+	// a worker without a result yet is measured by the others: its first chunk may take longer (device setup, kernel tuning, ...), but not that much. Nobody is lost before the first result of the node
+	double sum = 0;
+	unsigned measured = 0;
+	for (auto &estimate : workerEstimates)
+		if (estimate.throughput > 0) {
+			sum += estimate.itemsPerChunk / estimate.throughput;
+			++measured;
+		}
+	if (measured == 0)
+		return 0;
+
+	const auto &estimate = workerEstimates[worker];
+	const double expected = estimate.throughput > 0 ? estimate.itemsPerChunk / estimate.throughput : sum / measured;
+	return std::max(workerTimeout, WORKER_TIMEOUT_FACTOR * expected);
+}
+
+unsigned Distributor::lostWorkerCount() {
+	return static_cast<unsigned>(std::count(lostWorkers.begin(), lostWorkers.end(), true));
+}
+
+void Distributor::releaseLost(std::vector<Data::Request> &requests) {
+	for (auto &request : requests)
+		if (isLost(request.getPeer()))
+			abandon(request);
+}
+
+void Distributor::abandon(Data::Request &request) {
+	if (request.done())
+		return;
+	request.release();
+	abandonedRequests.push_back(std::move(request));
+}
+
+#ifdef DEBUG_SIMULATE_WORKER_FAILURE
+void Distributor::simulateWorkerFailure() {
+	if (!isMaster() && workerTimeout > 0 && MPI_SIZE > 1 && MPI_RANK == MPI_SIZE - 1 && ++simulatedFailureChunks == 3) {
+		std::cerr << "DEBUG: simulating failure of worker " + std::to_string(MPI_RANK) << std::endl;
+		raise(SIGKILL);
+	}
+}
+#endif // DEBUG_SIMULATE_WORKER_FAILURE
+
+void Distributor::resetIdleQueue() {
+	idleWorkers.clear();
+	// level by level, so consecutive nextWorker calls spread the chunks over all workers before a worker gets its second one
+	for (unsigned level = 0; level < prefetchDepth; ++level)
+		for (std::size_t i = 0; i < workersInFlight.size(); ++i)
+			if (workersInFlight[i].size() <= level && !isLost(static_cast<int>(i)))
+				idleWorkers.push_back(static_cast<int>(i));
+}
+
+void Distributor::setPrefetchDepth(unsigned depth) {
+	prefetchDepth = depth < 1 ? 1 : depth;
+	if (isMaster())
+		resetIdleQueue();
+}
+
+std::size_t Distributor::chunksInFlight() {
+	std::size_t result = 0;
+	for (auto &inFlight : workersInFlight)
+		result += inFlight.size();
+	return result;
+}
+
 bool Distributor::resizeCluster(Node& n, const int _newSize) {
+	assert(!clusterDistributor); // see Distributor(Distributor&, unsigned)
 	if (MPI_SIZE == _newSize)
 		return true;
 
@@ -406,23 +1019,24 @@ bool Distributor::resizeCluster(Node& n) {
 		once = false;
 	}
 	for (int i = 0; i < MPI_SIZE; ++i)
-		if (workersBusy[i] == true)
+		if (!workersInFlight[i].empty())
 			return false;
 	
 	splitHostfile(MPI_HOSTFILE, nullptr, nullptr, &newMPI_SIZE, nullptr);
 
 	for (int i = newMPI_SIZE; i < MPI_SIZE; ++i) {
-		terminateWorker(i, true); // terminate all nodes that won't be used any more
+		if (!isLost(i))
+			terminateWorker(i, true); // terminate all nodes that won't be used any more
 	}
 	for (int i = 0; i < newMPI_SIZE; ++i) {
-		terminateWorker(i, false); // just stop current MPI process on nodes that will be reused
+		if (!isLost(i))
+			terminateWorker(i, false); // just stop current MPI process on nodes that will be reused
 	}
 	n.addOutput("  " + nowToString() + ": " + whoAmI() + ": Cluster resized from " + std::to_string(MPI_SIZE) + " to " + std::to_string(newMPI_SIZE) +'\n');
 	MPI_SIZE = newMPI_SIZE;
 	restartingCluster = true;
 
-	std::queue<int> empty;
-	std::swap(idleWorkers, empty);
+	idleWorkers.clear();
 
 	once = true;
 	n.addOutput("  " + nowToString() + ": " + whoAmI() + ": restarting cluster now...\n");
@@ -438,9 +1052,35 @@ bool Distributor::resizeCluster(Node& n) {
 }
 
 void Distributor::terminateWorkers() {
-	if (isMaster())
+	if (!isMaster())
+		return;
+	if (workerTimeout <= 0) {
 		for (int i = 0; i < MPI_SIZE; ++i)
 			terminateWorker(i, true);
+		return;
+	}
+
+	// failure detection: a worker may have died without chunks in flight (eg. its chunks were duplicated by speculation), it is lost if it does not take TERMINATE_TAG within the timeout.
+	// Best effort for lost workers: one may just be slow and would wait for its next chunk forever, a dead one never receives it
+	std::vector<MPI_Request> requests(MPI_SIZE);
+	for (int i = 0; i < MPI_SIZE; ++i)
+		MPI_Isend(nullptr, 0, MPI_INT, i, Data::TAGS::TERMINATE_TAG, MPI_COMM_CLUSTER, &requests[i]);
+	const auto since = std::chrono::steady_clock::now();
+	for (int i = 0; i < MPI_SIZE; ++i) {
+		int sent = 0;
+		while (!isLost(i)) {
+			MPI_Test(&requests[i], &sent, MPI_STATUS_IGNORE);
+			if (sent)
+				break;
+			if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count() / 1000.0 > workerTimeout) {
+				lostWorkers[i] = true;
+				output << indentLogText("worker " + std::to_string(i) + " lost: did not take TERMINATE_TAG for " + std::to_string(static_cast<long long>(workerTimeout)) + "s");
+			} else
+				std::this_thread::yield();
+		}
+		if (!sent)
+			MPI_Request_free(&requests[i]);
+	}
 }
 
 void Distributor::expectTerminate() {
@@ -519,9 +1159,10 @@ void Distributor::receiveOutputFromWorkers() {
 }
 
 bool Distributor::saveCheckpoint(Node *n) { 
+	assert(!clusterDistributor); // see Distributor(Distributor&, unsigned)
 	output << n->getOutput();
 
-	if (Distributor::silent && isMaster())
+	if (Distributor::silent && isMaster() && lostWorkerCount() == 0) // lost workers would never send theirs
 			receiveOutputFromWorkers();
 
 	return checkpoint.save(this);
@@ -591,27 +1232,50 @@ std::vector<std::string> Distributor::rewriteArguments(const int argc, char ** a
 
 void Distributor::instanceFinalize() {
 	int err = 0;
+	waitForDroppedResults();
 	const std::string executable(ARGV[0]);
 	std::string hostName = getName();
 
 	if (!isMaster()) {
 		std::string myName = getName();
-		if (Data::getLastTag() == Data::TAGS::TERMINATE_TAG) {
+		const bool terminated = Data::getLastTag() == Data::TAGS::TERMINATE_TAG;
+		int lost = 0; // workers the master has lost, they would never join the collectives below
+		Data lost_(&lost, { 1 }, sizeof(int));
+		if (workerTimeout > 0) // failure detection only, see setWorkerTimeout
+			lost_.recv_W_from_M(Data::TAGS::FINALIZE_TAG);
+		if (terminated) {
 			std::cout << getOutput() << std::endl;
 			std::cout << nowToString() + ": " + whoAmI() + ": all done" << std::endl << std::string(80, '*') << std::endl;
 			if (Distributor::silent) {
-				sendOutput();
-				std::cout << "Output has been sent to master" << std::endl;
+				if (lost == 0) {
+					sendOutput();
+					std::cout << "Output has been sent to master" << std::endl;
+				}
 				deactivateSilentMode(executable, hostName);
 			}
 		}
-		MPI_Barrier(MPI_COMM_CLUSTER);
+		DeviceRuntime::releaseAll();
+		if (lost == 0) {
+			Telemetry::merge(MPI_COMM_CLUSTER, false);
+			MPI_Barrier(MPI_COMM_CLUSTER);
+		}
 		MPI_Finalize();
 	} else {
 		std::string myName = whoAmI();
 		std::string name = getName();
+		int lost = static_cast<int>(lostWorkerCount());
+		if (!abandonWorkers && workerTimeout > 0) {
+			int universe_size;
+			MPI_Comm_remote_size(MPI_COMM_CLUSTER, &universe_size);
+			Data lost_(&lost, { 1 }, sizeof(int));
+			for (int w = 0; w < universe_size; ++w)
+				if (!isLost(w))
+					lost_.send_M_to_W(w, Data::TAGS::FINALIZE_TAG);
+				else // best effort like in terminateWorkers, lost_ stays valid until MPI_Finalize
+					lost_.isend_M_to_W(w, Data::TAGS::FINALIZE_TAG).release();
+		}
 
-		if (Distributor::silent && !isRestarting())
+		if (Distributor::silent && !isRestarting() && lost == 0)
 			receiveOutputFromWorkers();
 
 		// Necessary to initiate shutdown from the master. MPI seems to kill all child processes.
@@ -623,8 +1287,27 @@ void Distributor::instanceFinalize() {
 			std::cout << ("Instances will not be shut down") << std::endl;
 
 		shutdownInstances(shutdownFlag, Distributor::silent);
-		MPI_Barrier(MPI_COMM_CLUSTER);
-		MPI_Finalize();
+		if (lost == 0)
+			Telemetry::merge(MPI_COMM_CLUSTER, true);
+		if (!isRestarting()) { // next to the csv of writeCSV, without its extension
+			const std::string csvFile = genCSVFileName(executable, MPI_RANK);
+			Telemetry::writeCSV(csvFile.substr(0, csvFile.find_last_of('.')));
+		}
+		if (lost == 0)
+			MPI_Barrier(MPI_COMM_CLUSTER);
+		for (auto &abandoned : abandonedResults) { // a lost worker never sends them
+			abandoned.idReceived.release();
+			abandoned.resultReceived.release();
+		}
+		if (!abandonWorkers) {
+			MPI_Finalize();
+			for (auto &abandoned : abandonedResults) {
+				delete abandoned.idData;
+				delete abandoned.resultData;
+			}
+			abandonedResults.clear();
+			abandonedRequests.clear();
+		}
 
 		if (isRestarting()) {
 			std::string argString;
@@ -646,6 +1329,8 @@ void Distributor::instanceFinalize() {
 
 		if (Distributor::silent)
 			deactivateSilentMode(executable, "master");
+		if (abandonWorkers) // after the checkpoint: the survivors wait in a node, only aborting stops them
+			MPI_Abort(MPI_COMM_CLUSTER, EXIT_FAILURE);
 	}
 }
 
@@ -4,6 +4,8 @@
 #pragma once
 #include "Node.h"
 #include "Checkpoint.h"
+#include "DeviceRuntime.h"
+#include "Telemetry.h"
 #include "../utils/Utils.h"
 #include "../utils/cl_utils.h"
 
@@ -15,9 +17,13 @@
 #include <algorithm>
 #include <sstream>
 #include <queue>
+#include <deque>
 #include <fstream>
 #include <cassert>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // MPI process 0 on an instance uses GPU (0+ACC_DEVICE_OFFSET), process 1 uses (1+ACC_DEVICE_OFFSET), ... in case you have additional CL-devices like a CPU which you want to skip
 #ifndef ACC_DEVICE_OFFSET
@@ -39,6 +45,7 @@ class Distributor {
 	friend class Checkpoint;
 
 	int MPI_SIZE, MPI_RANK;
+	int CLUSTER_RANK; // rank in the whole cluster, selects the GPU. MPI_RANK is the rank among the workers of the current node (see Node::setWorkers)
 	int newMPI_SIZE;
 	static int NUM_GPUS;
 	static unsigned W; // default number of workers to start
@@ -55,8 +62,54 @@ class Distributor {
 	Node *targetNode;
 	std::map<std::string, Data*> parameters;
 	std::set<Node*> allNodes;
-	std::queue<int> idleWorkers;
-	std::vector<bool> workersBusy;
+	// built once by setTargetNode: successors of every node within the graph and its critical path (nodes on the longest path to the target node, itself included)
+	std::map<Node*, std::vector<Node*>> successors;
+	std::map<Node*, unsigned> criticalPath;
+	void buildSchedule();
+	/// <returns>true if ready node a goes before b: longer critical path first, then lower id (same order on master and workers)</returns>
+	bool schedulesBefore(Node *a, Node *b);
+	std::deque<int> idleWorkers; // one entry per free slot, a worker appears up to prefetchDepth times
+	std::vector<std::multimap<unsigned, std::chrono::steady_clock::time_point>> workersInFlight; // chunk ids sent to each worker and not returned yet, with the time they were handed out
+	unsigned prefetchDepth = 1;
+	void resetIdleQueue();
+
+	// late results of duplicated chunks (see dropResult), received into their own buffers in the background
+	struct DroppedResult {
+		int worker;
+		std::chrono::steady_clock::time_point since; // handed out, for failure detection
+		unsigned id;
+		std::vector<char> buffer;
+		Data *idData, *resultData;
+		Data::Request idReceived, resultReceived;
+	};
+	std::list<DroppedResult> droppedResults;
+	// master only: given up on lost workers (see abandon), MPI may still write into their buffers. Dropped results are freed once they arrive late, everything else after MPI_Finalize
+	std::list<DroppedResult> abandonedResults;
+	std::list<Data::Request> abandonedRequests;
+
+	// master only: what each worker achieved on the current node, to prefer fast workers and keep slow ones away from the last chunks
+	struct WorkerEstimate {
+		double throughput = 0; // items per second, exponentially weighted, 0 until the first chunk returned
+		double itemsPerChunk = 0; // exponentially weighted
+		std::chrono::steady_clock::time_point lastReturn = std::chrono::steady_clock::time_point::min();
+		unsigned long long chunks = 0, items = 0; // totals over all nodes
+	};
+	std::vector<WorkerEstimate> workerEstimates;
+	Node* estimatesNode = nullptr; // throughput differs between kernels, estimates start over for every node
+
+	// master only: workers that stopped returning results (see detectLostWorker), they get no chunks any more
+	std::vector<bool> lostWorkers;
+	double workerTimeout = 0; // off, see setWorkerTimeout
+	bool abandonWorkers = false; // the survivors wait inside a node the master does not run, instanceFinalize aborts them
+#ifdef DEBUG_SIMULATE_WORKER_FAILURE
+	unsigned simulatedFailureChunks = 0; // chunks received by this worker, see simulateWorkerFailure
+#endif // DEBUG_SIMULATE_WORKER_FAILURE
+	/// <returns>estimated seconds until 'worker' has finished its chunks in flight and 'additional' chunks more, 0 if it has no estimate yet</returns>
+	double expectedFinish(int worker, unsigned additional);
+	/// <returns>seconds 'worker' may stay silent with chunks in flight before it is lost (see setWorkerTimeout), 0: no detection yet</returns>
+	double silenceTimeout(int worker);
+	/// <returns>true if handing the next chunk of 'n' to 'worker' would make it finish after the cluster is expected to drain the 'remaining' items of 'n' (see nextWorker), while another worker in flight finishes such a chunk earlier</returns>
+	bool straggles(Node* n, int worker, std::size_t remaining);
 
 	/// <summary>
 	/// block additional estimations within time buffer before end of current CLUSTER_TIME_UNIT_SECONDS-block if previous estimation decided not to restart
@@ -96,6 +149,27 @@ class Distributor {
 	bool resizeCluster(Node& n);
 
 	int computeNodes();
+	/// <summary>
+	/// The lost workers (see detectLostWorker) would never take part in 'n': saves a checkpoint and continues with a new cluster, like after a resize. Master only
+	/// </summary>
+	void restartWithoutLostWorkers(Node *n);
+
+	// concurrent nodes (see Node::setWorkers): the master assigns every node to its workers on the merged communicator of master (rank 0) and workers (rank 1+worker)
+	enum NODE_ASSIGNMENT_TAGS { ASSIGN_NODE_TAG, CREATE_GROUP_TAG };
+	static const int NO_NODE = -1; // assignment telling the workers that all nodes have been computed, followed by the ids of the finished nodes
+	int threadLevel = MPI_THREAD_SINGLE;
+	bool hasConcurrentNodes();
+	/// <summary>
+	/// Distributor of the workers of a node running concurrently with others: 'workers' workers, idle queue and estimates of its own. Shares the arguments and the failure detection of 'cluster'.
+	/// Such a node must not resize the cluster or save a checkpoint (resizeCluster, saveCheckpoint): the cluster's checkpoint state, its restart and resize bookkeeping stay with 'cluster', it is never resized automatically (see estimateResizing).
+	/// Workers lost by the node are reported to 'cluster' once it has finished (see assignNodes).
+	/// </summary>
+	Distributor(Distributor &cluster, unsigned workers);
+	Distributor *clusterDistributor = nullptr; // set for the Distributor of a node running concurrently
+	static void useCommunicators(MPI_Comm cluster, MPI_Comm workers, int size);
+	int computeNodesConcurrently();
+	int assignNodes(MPI_Comm nodeComm);
+	int followAssignments(MPI_Comm nodeComm);
 
 	void shutdownInstances(const bool shutdown, const bool silent);
 	void terminateWorker(const int w, const bool terminate = false);
@@ -111,15 +185,21 @@ public:
 	static const unsigned CLUSTER_TIME_UNIT_SECONDS = 3600;
 #endif // DEBUG_REDUCE_RESTART_CLUSTER_TIME_UNIT
 	static const float CLUSTER_TIME_UNIT_MAINTENANCE_BUFFER;
+	static const double THROUGHPUT_WEIGHT; // weight of the latest chunk in a worker's throughput estimate
+	static const double WORKER_TIMEOUT_FACTOR; // times the expected duration of a chunk, if longer than the timeout
 	static const int NO_IDLE_WORKERS_AVAILABLE = -1;
 
 #ifdef DEBUG_FORCE_ALWAYS_USING_ACC_DEVICE_0
 	unsigned assignedGPU_Device() { return 0 + ACC_DEVICE_OFFSET; }
 #else
-	unsigned assignedGPU_Device() { return MPI_RANK % NUM_GPUS + ACC_DEVICE_OFFSET; }
+	unsigned assignedGPU_Device() { return CLUSTER_RANK % NUM_GPUS + ACC_DEVICE_OFFSET; }
 #endif // DEBUG_FORCE_ALWAYS_USING_ACC_DEVICE_0
 
 	std::string deviceInfoCL();
+	/// <summary>
+	/// OpenCL context, queue, program and kernel cache of the assigned GPU device. Lives until Distributor::instanceFinalize, use it instead of rebuilding programs per chunk.
+	/// </summary>
+	DeviceRuntime& deviceRuntime() { return DeviceRuntime::get(assignedGPU_Device()); }
 	static int getNumGPUs() { return NUM_GPUS; }
 	unsigned getW() { return W; }
 
@@ -169,7 +249,7 @@ public:
 	/// <summary>
 	/// Sets target node on that later Distributor::run may operate. All dependencies (recursive) of this node need to be computed before this node can be computed.
 	/// 
-	/// Sideffect: calls findCycle, which generates dependency graph and fills set allNodes.
+	/// Sideffect: calls findCycle, which generates dependency graph and fills set allNodes, then the successor and critical path tables used by computeNodes.
 	/// </summary>
 	/// <param name="targetNode">Node with the final computation. This node depends on all preceding computations.</param>
 	/// <returns>true if target node's graph does not contain circles.</returns>
@@ -183,20 +263,107 @@ public:
 	/// <returns>RC=0 if no error occured</returns>
 	int run();
 
-	int nextWorker(Node* n);
+	static const unsigned NO_CHUNK_ID = ~0u;
+	/// <summary>
+	/// Returns a worker with a free slot (see setPrefetchDepth) and records 'chunk' as in flight on it, or NO_IDLE_WORKERS_AVAILABLE.
+	/// Once all workers have returned a chunk of node n, the worker expected to finish the chunk first is chosen, so faster workers get proportionally more chunks.
+	/// If the remaining items of n are known, a slow worker is not handed one of the last items: 
+	/// NO_IDLE_WORKERS_AVAILABLE while a faster worker with chunks in flight would finish it earlier. Wait for a worker then, as without free slots.
+	/// </summary>
+	/// <param name="n">Current node</param>
+	/// <param name="chunk">id of the chunk the worker is going to get, NO_CHUNK_ID if the caller does not track chunks</param>
+	/// <param name="remainingItems">items of n not handed out yet, the next chunk included. 0: from the loop counter of n if it uses auto resize (see Node::activateAutoResize, eg. by ChunkScheduler), unknown otherwise</param>
+	int nextWorker(Node* n, unsigned chunk = NO_CHUNK_ID, std::size_t remainingItems = 0);
 	/// <summary>
 	/// Marks worker-id for distributor as idle. Sideffect: if this nodes supports cluster restart, it will estimated. Check distributor.isRestarting() after call. Sideffect: adds worker/chunk (LOOP_COUNTER) to node's dotGraph.
+	/// With a prefetch depth above 1 this frees one slot of the worker only, the worker stays busy as long as other chunks are in flight on it.
 	/// </summary>
 	/// <param name="n">Current node to get additional information regarding cluster restart and node's dotGraph.</param>
 	/// <param name="worker">id of now idle worker</param>
+	/// <param name="chunk">id of the returned chunk as given to nextWorker, NO_CHUNK_ID for any chunk of the worker</param>
+	/// <param name="items">work of the returned chunk (eg. rows), in the unit of the node's loop counter. Updates the worker's throughput estimate</param>
 	/// <returns></returns>
-	void addToIdleQueue(Node& n, int worker);
+	void addToIdleQueue(Node& n, int worker, unsigned chunk = NO_CHUNK_ID, unsigned items = 1);
+	/// <returns>number of free slots over all workers. With prefetch depth 1 (default) the number of idle workers</returns>
 	std::size_t availableWorkers() { return idleWorkers.size(); }
+	/// <summary>
+	/// Number of chunks a worker may have in flight at the same time, so it can receive the next chunk while computing and sending the previous ones. Default: 1
+	/// Master only; may be changed between nodes or while chunks are in flight, workers get new slots right away.
+	/// </summary>
+	void setPrefetchDepth(unsigned depth);
+	unsigned getPrefetchDepth() { return prefetchDepth; }
+	/// <returns>number of chunks currently in flight on 'worker'</returns>
+	std::size_t chunksInFlight(int worker) { return workersInFlight[worker].size(); }
+	/// <returns>number of chunks in flight on all workers</returns>
+	std::size_t chunksInFlight();
+
+	/// <summary>
+	/// Failure detection: a worker is lost once it has had chunks in flight without returning one for 'seconds', or WORKER_TIMEOUT_FACTOR times its expected duration of a chunk if that is longer. 0 turns it off.
+	/// The expected duration of a worker without a result yet is the average of the others, nobody is lost before the first result of the node. Lost workers still get TERMINATE_TAG and FINALIZE_TAG, without waiting for the sends.
+	/// MPI errors on the cluster communicator are returned instead of aborting the job (MPI_ERRORS_RETURN), mpirun has to keep the survivors running (Open MPI: --enable-recovery).
+	/// Set the same value on master and workers: with failure detection instanceFinalize tells the survivors how many workers have been lost (FINALIZE_TAG), without it the cluster shuts down as usual. Default: 0 (off)
+	/// </summary>
+	void setWorkerTimeout(double seconds) { workerTimeout = seconds; }
+	double getWorkerTimeout() { return workerTimeout; }
+	/// <summary>
+	/// Checks the workers with chunks in flight for a timeout (see setWorkerTimeout). A lost worker gets no chunks any more (only TERMINATE_TAG and FINALIZE_TAG, see setWorkerTimeout), its late results are not used for scheduling.
+	/// Once a lost worker would be needed by a further node, the master saves a checkpoint and aborts the cluster: it restarts from there like after a resize.
+	/// </summary>
+	/// <param name="chunks">ids of the chunks in flight on the lost worker, they have to be handed out again</param>
+	/// <returns>the newly lost worker, NO_IDLE_WORKERS_AVAILABLE if all workers are alive</returns>
+	int detectLostWorker(std::vector<unsigned> &chunks);
+	bool isLost(int worker) { return static_cast<std::size_t>(worker) < lostWorkers.size() && lostWorkers[worker]; }
+	unsigned lostWorkerCount();
+	/// <summary>
+	/// Abandons the requests with lost workers (see abandon), waiting for them would never return.
+	/// </summary>
+	void releaseLost(std::vector<Data::Request> &requests);
+	/// <summary>
+	/// Gives up on 'request' with a lost worker: it is released (see Data::Request::release) and kept with its compression frame until MPI_Finalize. The buffer of its data object has to stay valid until then, too.
+	/// </summary>
+	void abandon(Data::Request &request);
+#ifdef DEBUG_SIMULATE_WORKER_FAILURE
+	/// <summary>
+	/// Fault injection for failure detection, called by worker loops for every chunk they receive: the last worker of the node dies at its third chunk, the master hands its chunks to the others. Only with failure detection (see setWorkerTimeout).
+	/// </summary>
+	void simulateWorkerFailure();
+#endif // DEBUG_SIMULATE_WORKER_FAILURE
+	/// <summary>
+	/// Speculative re-execution of stragglers: finds the chunk in flight longest beyond 'factor' times its expected duration (its items at the throughput of its worker, the average throughput while the worker has none)
+	/// among 'chunks' (chunk-id -> items) and takes a free slot of another worker for a duplicate of it, like nextWorker. Master only.
+	/// </summary>
+	/// <param name="chunk">the overdue chunk</param>
+	/// <returns>worker for the duplicate, NO_IDLE_WORKERS_AVAILABLE if no chunk is overdue or no other worker has a free slot</returns>
+	int speculativeWorker(Node* n, const std::map<unsigned, unsigned> &chunks, const double factor, unsigned &chunk);
+	/// <summary>
+	/// Stops waiting for 'chunk' on 'worker', whose result has arrived from another worker already: its id and result (rows shaped like 'result', nullptr if the worker sends the id only)
+	/// are received into own buffers in the background and dropped. Master only, instanceFinalize waits for them.
+	/// </summary>
+	/// <param name="maxRows">rows of the largest result the worker may send, its results arrive in the order they were handed out</param>
+	void dropResult(int worker, unsigned chunk, Data *result, std::size_t maxRows);
+	/// <summary>
+	/// Waits for the results of dropResult. With failure detection a worker that does not return them in time is lost (see setWorkerTimeout), its receives are given up: their buffers are freed if they arrive late, by instanceFinalize otherwise.
+	/// </summary>
+	void waitForDroppedResults();
+	/// <returns>true once all results of dropResult have arrived or have been given up, checks their workers like waitForDroppedResults without waiting</returns>
+	bool testDroppedResults();
+	/// <summary>
+	/// Waits for 'requests' with workers, eg. the sends of a node's chunks: those of lost workers are released, meanwhile the workers of dropped results are checked (see testDroppedResults), a send to a dead one would never complete.
+	/// </summary>
+	void waitForWorkers(std::vector<Data::Request> &requests);
+	/// <returns>estimated items per second of 'worker' on the current node (see addToIdleQueue), 0 if none of its chunks has returned yet. Master only</returns>
+	double getThroughput(int worker) { return static_cast<std::size_t>(worker) < workerEstimates.size() ? workerEstimates[worker].throughput : 0; }
 
+	/// <summary>
+	/// Not within nodes running concurrently (see Node::setWorkers).
+	/// </summary>
 	bool resizeCluster(Node& n, const int _newSize);
 	bool isRestarting() { return restartingCluster; }
 
 	Checkpoint& getCheckpoint() { return checkpoint; }
+	/// <summary>
+	/// Not within nodes running concurrently (see Node::setWorkers).
+	/// </summary>
 	bool saveCheckpoint(Node* n);
 	bool readCheckpoint() { return checkpoint.read(this); }
 
@@ -204,7 +371,8 @@ public:
 	void graphAppendNode(Node* n);
 	void graphAppendEdge(Node* n);
 	void graphAppendEdge(const std::string from, const std::string to);
-	std::set<Node*> getSuccessors(Node *n);
+	/// <returns>nodes of the target node's graph depending directly on 'n'</returns>
+	const std::vector<Node*> &getSuccessors(Node *n);
 
 	void instanceFinalize();
 	/// <summary>
@@ -213,6 +381,9 @@ public:
 	/// <param name="_shutdown"></param>
 	void setShutdownFlag(const bool _shutdown) { shutdownFlag = _shutdown; }
 	
+	/// <summary>
+	/// Sends TERMINATE_TAG to all workers. With failure detection (see setWorkerTimeout) a worker that does not take it within the timeout is lost.
+	/// </summary>
 	void terminateWorkers();
 	void expectTerminate();
 };
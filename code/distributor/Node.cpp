@@ -49,6 +49,8 @@ std::string Node::logline(std::string line, std::string whoAmI) {
 
 const long long Node::getDuration() {
 	long long elapsed_s = 0;
+	if (start == std::chrono::steady_clock::time_point::min()) // not run by this process, eg. a worker outside of the node's workers (see setWorkers)
+		return elapsed_s;
 	if (finished)
 		elapsed_s = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 	else
@@ -74,7 +76,7 @@ void Node::dotGraph_WorkerUnionBeforeClusterRestart(Distributor* distributor) {
 }
 
 void Node::dotGraph_WorkerUnionAfterCompletion(Distributor* distributor) {
-	auto successors = distributor->getSuccessors(this);
+	const auto &successors = distributor->getSuccessors(this);
 	for (auto w : workers_dotGraph)
 		for (auto successor : successors) {
 
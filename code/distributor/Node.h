@@ -8,6 +8,7 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <atomic>
 
 #include "Data.h"
 
@@ -32,11 +33,13 @@ class Node {
 
 	std::stringstream output;
 
-	bool finished = false;
+	std::atomic<bool> finished{ false }; // set by the thread running the node, see setWorkers
 	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::time_point::min(); // first execution of node (may be interrupted by restart)
 	std::chrono::steady_clock::time_point lastStart; // current start of execution (resetted after restart - required to estimate current time per chunk/node)
 	std::chrono::steady_clock::time_point end;
 
+	unsigned workers = 0; // see setWorkers
+
 	unsigned LOOP_COUNTER = 0;
 	unsigned TOTAL_COUNT = 0;
 	unsigned LOOP_COUNTER_lastStart = 0;
@@ -50,12 +53,21 @@ class Node {
 public:
 
 	Node(std::string description, krnl mk, krnl wk = nullptr) : id(nodeCount++), description(description), masterKernel(mk), workerKernel(wk) {}
+	virtual ~Node() {}
 	unsigned getID() { return id; }
 	const std::string & getDescription() { return description; }
 	const bool hasFinished() { return finished; }
 	void hasFinished(bool hasFinished) { finished = hasFinished; }
 	const bool isReady();
 	bool getIsMasterOnly() { return !workerKernel; }
+	/// <summary>
+	/// Lets the node run on 'workers' workers only (default 0: the whole cluster), concurrently with other ready nodes on the remaining workers. Its workers return to the pool once it has finished.
+	/// Only for nodes whose workers keep nothing for later nodes (eg. a ParallelForNode): data a node broadcasts to its workers is not available on the others.
+	/// The kernels see a Distributor of their workers, worker ids and ranks (getRank) 0...workers-1, and communication (send_W_to_W, bcast_M_to_W, gather_W_to_M, ...) over their workers only. Shared data and windows (allocateShared, openWindow_M) need the whole cluster.
+	/// Cluster resize is not estimated for such nodes. The master runs them in threads, which needs MPI_THREAD_MULTIPLE, otherwise one after another.
+	/// </summary>
+	void setWorkers(unsigned _workers) { workers = _workers; }
+	unsigned getWorkers() { return workers; }
 
 	void addArgument(const std::string &key, Data* value) { parameters[key] = value; }
 	void addArguments(const std::vector<std::pair<std::string, Data*>> datas) {
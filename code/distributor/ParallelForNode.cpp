@@ -0,0 +1,235 @@
+// parallel-for node: distributes the rows of an input data object in chunks to the workers, which apply a chunk function and return the rows of an output data object
+// author: Schuchardt Martin, csap9442
+
+#include "ParallelForNode.h"
+#include "Distributor.h"
+
+#include <deque>
+#include <vector>
+#include <thread>
+
+
+ParallelForNode::ParallelForNode(std::string description, const std::string &_input, const std::string &_output, chunkKrnl kernel, unsigned _maxChunk, unsigned _minChunk)
+	: Node(description, kernel_Master, kernel_Worker), input(_input), output(_output), chunkKernel(kernel), asyncChunkKernel(nullptr), maxChunk(std::max(_maxChunk, 1u)), minChunk(std::min(std::max(_minChunk, 1u), std::max(_maxChunk, 1u))) {
+}
+
+ParallelForNode::ParallelForNode(std::string description, const std::string &_input, const std::string &_output, asyncChunkKrnl kernel, unsigned _maxChunk, unsigned _minChunk)
+	: Node(description, kernel_Master, kernel_Worker), input(_input), output(_output), chunkKernel(nullptr), asyncChunkKernel(kernel), maxChunk(std::max(_maxChunk, 1u)), minChunk(std::min(std::max(_minChunk, 1u), std::max(_maxChunk, 1u))) {
+}
+
+// the chunk-id is the first row: the master sends id and input rows, the worker returns id and output rows (or puts the rows into the output, see setResultsViaPut)
+int ParallelForNode::kernel_Master(Node &_n, Distributor &d) {
+	auto &n = static_cast<ParallelForNode&>(_n);
+	Data *in = d.getArgument(n.input);
+	Data *out = d.getArgument(n.output);
+	assert(!in->isView() && !out->isView() && in->size()[0] == out->size()[0]);
+
+	const unsigned rows = static_cast<unsigned>(in->size()[0]);
+	unsigned long long shape[SHAPE_SIZE] = { rows, rows ? in->sizeTotal() / rows : 0, in->sizeOfData(), rows ? out->sizeTotal() / rows : 0, out->sizeOfData() };
+	Data shape_(shape, { SHAPE_SIZE }, sizeof(unsigned long long));
+	int err = shape_.bcast_M_to_W();
+	const std::size_t inRowBytes = static_cast<std::size_t>(shape[INPUT_ROW] * shape[INPUT_SIZEOF]);
+	const std::size_t outRowBytes = static_cast<std::size_t>(shape[OUTPUT_ROW] * shape[OUTPUT_SIZEOF]);
+
+	ChunkScheduler scheduler(n, d, rows, n.policy, n.minChunk, n.maxChunk);
+	scheduler.setSpeculation(n.speculation);
+	n.addOutput(indentLogText("distributing " + std::to_string(rows - scheduler.position()) + " rows to workers, " + ChunkScheduler::POLICY_NAMES[n.policy] + " scheduling..."));
+	d.setPrefetchDepth(n.prefetchDepth);
+
+	std::deque<unsigned> ids; // deque: ids stay in place while being sent
+	std::vector<Data*> chunkData; // ids and input chunks must stay untouched until their sends have completed
+	std::map<unsigned, Data*> outChunks; // chunk-id -> output rows
+	std::vector<Data::Request> sends;
+	auto waitForSends = [&]() {
+		d.waitForWorkers(sends); // not those to lost workers, they would never complete
+		for (auto data : chunkData)
+			delete data;
+		for (auto outChunk : outChunks)
+			delete outChunk.second;
+	};
+	if (n.resultsViaPut) // workers put their results directly into the output
+		err |= out->openWindow_M();
+	auto sendChunk = [&](ChunkScheduler::Chunk chunk, int worker) {
+		ids.push_back(chunk.first);
+		chunkData.push_back(new Data(&ids.back(), { 1 }, sizeof(unsigned)));
+		sends.push_back(chunkData.back()->isend_M_to_W(worker, Data::TAGS::CHUNK_ID_TAG));
+		err |= sends.back().error();
+		chunkData.push_back(new Data(static_cast<char*>(in->get()) + chunk.first * inRowBytes, { chunk.count, static_cast<std::size_t>(shape[INPUT_ROW]) }, in->sizeOfData()));
+		chunkData.back()->setCompression(n.compression);
+		sends.push_back(chunkData.back()->isend_M_to_W(worker, Data::TAGS::SEND_CHUNK_TAG));
+		err |= sends.back().error();
+		if (outChunks.count(chunk.first)) // a duplicate, see ChunkScheduler::setSpeculation
+			return;
+		outChunks[chunk.first] = new Data(static_cast<char*>(out->get()) + chunk.first * outRowBytes, { chunk.count, static_cast<std::size_t>(shape[OUTPUT_ROW]) }, out->sizeOfData());
+		outChunks[chunk.first]->setCompression(n.compression);
+		n.addOutput(indentLogText("distributed rows " + std::to_string(chunk.first) + "-" + std::to_string(chunk.first + chunk.count - 1) + " to worker " + std::to_string(worker)));
+	};
+	// the id tells where the result goes before it arrives, it is received in place. The late result of a duplicate is the same, it is received in place as well but does not count
+	auto waitForWorker = [&]() {
+		unsigned chunkId;
+		Data chunkId_(&chunkId, { 1 }, sizeof(unsigned));
+		auto status = scheduler.receiveResult(chunkId_, sendChunk);
+		Data *outChunk = outChunks.at(chunkId);
+		if (!n.resultsViaPut) { // otherwise the rows are there already
+			const auto shape = outChunk->size();
+			auto received = outChunk->irecv_M_from_W(status.MPI_SOURCE, Data::TAGS::RECEIVE_CHUNK_TAG);
+			const bool arrived = scheduler.receiveFrom(status.MPI_SOURCE, received, sendChunk);
+			outChunk->setSize(shape); // receiving flattens it (the empty result of a cancelled chunk to 0), dropDuplicates sizes the buffers by rows
+			if (!arrived) // the worker has been lost, another one computes the chunk again
+				return;
+		}
+		const unsigned count = scheduler.completed(chunkId, status.MPI_SOURCE) ? static_cast<unsigned>(outChunk->size()[0]) : 0;
+		d.addToIdleQueue(n, status.MPI_SOURCE, chunkId, count);
+	};
+
+	while (!scheduler.done()) {
+		auto worker = d.nextWorker(&n, scheduler.position());
+		while (worker == Distributor::NO_IDLE_WORKERS_AVAILABLE) {
+			if (d.isRestarting()) { // a restart has been initiated, no worker gets idle any more
+				waitForSends();
+				if (n.resultsViaPut)
+					err |= out->closeWindow_M();
+				return err;
+			}
+			waitForWorker();
+			worker = d.nextWorker(&n, scheduler.position());
+		}
+
+		sendChunk(scheduler.next(worker), worker);
+	}
+
+	while (scheduler.resultsPending())
+		waitForWorker();
+	scheduler.dropDuplicates([&](unsigned first) { return n.resultsViaPut ? nullptr : outChunks.at(first); }); // no need to wait for stragglers
+	waitForSends();
+
+	d.terminateWorkers(); // nothing to do for workers anymore
+	if (n.resultsViaPut)
+		err |= out->closeWindow_M();
+	out->modified();
+	return err;
+}
+
+// an asynchronous chunk function keeps up to pipeline depth chunks computing, results are sent as soon as they are finished
+int ParallelForNode::kernel_Worker(Node &_n, Distributor &d) {
+	auto &n = static_cast<ParallelForNode&>(_n);
+	unsigned long long shape[SHAPE_SIZE];
+	Data shape_(shape, { SHAPE_SIZE }, sizeof(unsigned long long));
+	int err = shape_.bcast_M_to_W();
+	const std::size_t inRow = static_cast<std::size_t>(shape[INPUT_ROW]), outRow = static_cast<std::size_t>(shape[OUTPUT_ROW]);
+	const unsigned slots = n.pipelineDepth;
+
+	std::vector<std::vector<char>> inBuffers, outBuffers;
+	std::vector<Data*> inChunks, outChunks, chunkIds;
+	std::vector<unsigned> ids(slots);
+	for (unsigned i = 0; i < slots; ++i) {
+		inBuffers.push_back(std::vector<char>(n.maxChunk * inRow * shape[INPUT_SIZEOF]));
+		outBuffers.push_back(std::vector<char>(n.maxChunk * outRow * shape[OUTPUT_SIZEOF]));
+		inChunks.push_back(new Data(inBuffers.back().data(), { n.maxChunk, inRow }, static_cast<unsigned>(shape[INPUT_SIZEOF])));
+		outChunks.push_back(new Data(outBuffers.back().data(), { n.maxChunk, outRow }, static_cast<unsigned>(shape[OUTPUT_SIZEOF])));
+		chunkIds.push_back(new Data(&ids[i], { 1 }, sizeof(unsigned)));
+		inChunks.back()->setCompression(n.compression);
+		outChunks.back()->setCompression(n.compression);
+	}
+	std::vector<Data::Request> idSent(slots), outSent(slots); // results on their way to the master
+	ChunkScheduler::Cancellations cancellations;
+	std::deque<std::pair<unsigned, ChunkCompletion>> computing; // slots of the asynchronous chunks, oldest first
+	Data outWindow(nullptr, { static_cast<std::size_t>(shape[ROWS]), outRow }, static_cast<unsigned>(shape[OUTPUT_SIZEOF])); // the master's output
+	if (n.resultsViaPut)
+		err |= outWindow.openWindow_M();
+
+	// a cancelled chunk returns no rows, the master drops the empty result
+	auto sendResult = [&](unsigned slot, std::size_t count) {
+		outChunks[slot]->setSize({ count, outRow });
+		if (n.resultsViaPut && count > 0) // the rows are in the output once put returns, the id tells the master
+			err |= outChunks[slot]->put_W_to_M(outWindow, static_cast<std::size_t>(ids[slot]) * outRow);
+		idSent[slot] = chunkIds[slot]->isend_W_to_M(Data::TAGS::CHUNK_ID_TAG);
+		if (!n.resultsViaPut)
+			outSent[slot] = outChunks[slot]->isend_W_to_M(Data::TAGS::RECEIVE_CHUNK_TAG);
+		err |= idSent[slot].error() | outSent[slot].error();
+		if (count > 0)
+			n.addOutput(indentLogText("Worker " + std::to_string(d.getRank()) + " computed rows " + std::to_string(ids[slot]) + "-" + std::to_string(ids[slot] + count - 1)));
+		else
+			n.addOutput(indentLogText("Worker " + std::to_string(d.getRank()) + " skipped cancelled chunk " + std::to_string(ids[slot])));
+	};
+	auto sendOldest = [&](bool wait) {
+		if (!computing.front().second(wait))
+			return false;
+		const unsigned slot = computing.front().first;
+		computing.pop_front();
+		sendResult(slot, static_cast<std::size_t>(inChunks[slot]->size()[0]));
+		return true;
+	};
+
+	for (unsigned slot = 0; ; slot = (slot + 1) % slots) {
+		// slot gets reused: its previous chunk has to be computed and its result sent
+		if (!computing.empty() && computing.front().first == slot)
+			sendOldest(true);
+		idSent[slot].wait();
+		outSent[slot].wait();
+
+		// any tag: either the id of the next chunk, the id of a cancelled chunk or terminate/restart
+		chunkIds[slot]->setSize({ 1 });
+		auto idReceived = chunkIds[slot]->irecv_W_from_M();
+		err |= idReceived.error();
+		while (!idReceived.test()) { // send results as soon as they are finished, the master might wait for them
+			if (computing.empty()) {
+				idReceived.wait();
+				break;
+			}
+			if (!sendOldest(false))
+				std::this_thread::yield();
+		}
+		if (Data::getLastTag() == Data::TAGS::CANCEL_CHUNK_TAG) { // the slot stays free for the next id
+			cancellations.add(ids[slot]);
+			slot = (slot + slots - 1) % slots;
+			continue;
+		}
+		if (Data::getLastTag() == Data::TAGS::TERMINATE_TAG || Data::getLastTag() == Data::TAGS::RESTART_TAG)
+			break;
+
+		inChunks[slot]->setSize({ n.maxChunk, inRow });
+		inChunks[slot]->recv_W_from_M(Data::TAGS::SEND_CHUNK_TAG); // the master sends the chunk right after its id
+#ifdef DEBUG_SIMULATE_WORKER_FAILURE
+		d.simulateWorkerFailure();
+#endif // DEBUG_SIMULATE_WORKER_FAILURE
+		std::size_t count = inRow ? inChunks[slot]->sizeTotal() / inRow : 0;
+		if (cancellations.cancelled(ids[slot])) // another worker has returned it already
+			count = 0;
+		inChunks[slot]->setSize({ count, inRow });
+		outChunks[slot]->setSize({ count, outRow });
+		if (count > 0 && n.asyncChunkKernel) {
+			computing.push_back(std::make_pair(slot, n.asyncChunkKernel(n, d, *inChunks[slot], *outChunks[slot], ids[slot], slot)));
+			continue;
+		}
+		if (count > 0)
+			err |= n.chunkKernel(n, d, *inChunks[slot], *outChunks[slot], ids[slot]);
+		sendResult(slot, count);
+	}
+
+	// drain the pipeline, all results have to reach the master before terminating or restarting
+	const auto tag = Data::getLastTag();
+	while (!computing.empty())
+		sendOldest(true);
+	Data::Request::waitAll(outSent);
+	Data::Request::waitAll(idSent);
+	if (n.resultsViaPut)
+		err |= outWindow.closeWindow_M();
+
+	if (tag == Data::TAGS::TERMINATE_TAG) {
+		n.addOutput(indentLogText("  no more work for this worker on this kernel anymore"));
+	} else {
+		n.addOutput(indentLogText("  cluster will restart.\n  Saving checkpoint and stopping now but expecting to continue."));
+		if (!d.saveCheckpoint(&n)) {
+			std::cerr << "ERROR: could not write checkpoint (" + CHECKPOINT_FILE + "). Terminating now." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (unsigned i = 0; i < slots; ++i) {
+		delete inChunks[i];
+		delete outChunks[i];
+		delete chunkIds[i];
+	}
+	return err;
+}
@@ -0,0 +1,77 @@
+// parallel-for node: distributes the rows of an input data object in chunks to the workers, which apply a chunk function and return the rows of an output data object
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+
+#include "Node.h"
+#include "ChunkScheduler.h"
+
+#include <string>
+#include <functional>
+
+
+class ParallelForNode;
+typedef int(*chunkKrnl)(ParallelForNode& n, Distributor& d, Data& input, Data& output, unsigned first);
+// completion of an asynchronous chunk: true once the output rows are written, 'wait' blocks until then. Not called again after it returned true
+typedef std::function<bool(bool wait)> ChunkCompletion;
+// starts the chunk (eg. enqueues it on the device) and returns its completion. 'slot' (0...pipeline depth-1) is the buffer set of the chunk, no other chunk in progress has the same
+typedef ChunkCompletion(*asyncChunkKrnl)(ParallelForNode& n, Distributor& d, Data& input, Data& output, unsigned first, unsigned slot);
+
+
+class ParallelForNode : public Node {
+	const std::string input, output; // argument keys
+	const chunkKrnl chunkKernel;
+	const asyncChunkKrnl asyncChunkKernel;
+	const unsigned maxChunk, minChunk;
+	ChunkScheduler::POLICY policy = ChunkScheduler::GUIDED;
+	unsigned prefetchDepth = 2;
+	unsigned pipelineDepth = 2; // chunks per worker: computing one while the result of the previous one is sent
+	bool resultsViaPut = false;
+	Data::COMPRESSION compression = Data::COMPRESSION_OFF;
+	double speculation = 2;
+
+	// shape of the rows, broadcast by the master at the start of the node: the workers do not have the arguments
+	enum SHAPE { ROWS, INPUT_ROW, INPUT_SIZEOF, OUTPUT_ROW, OUTPUT_SIZEOF, SHAPE_SIZE };
+
+	static int kernel_Master(Node& n, Distributor& d);
+	static int kernel_Worker(Node& n, Distributor& d);
+
+public:
+	/// <summary>
+	/// Node computing 'kernel' on all rows (first dimension) of the argument 'input', the results are written to the same rows of the argument 'output'. The master owns the dispatch loop:
+	/// rows are handed out in chunks by a ChunkScheduler to the fastest idle workers, up to 'prefetch depth' chunks per worker are in flight and results are taken in any order.
+	/// Cluster resize and checkpoints continue with the rows not handed out yet.
+	/// Both arguments are needed on the master only and have to be contiguous. Construct the node with the same parameters and settings on master and workers.
+	/// </summary>
+	/// <param name="kernel">called by the workers for every chunk: 'input' holds rows first...first+input.size()[0]-1, 'output' the same number of rows to be written</param>
+	/// <param name="maxChunk">most rows per chunk, the workers allocate buffers of this size</param>
+	/// <param name="minChunk">fewest rows per chunk, except the last one</param>
+	ParallelForNode(std::string description, const std::string &input, const std::string &output, chunkKrnl kernel, unsigned maxChunk, unsigned minChunk = 1);
+	/// <summary>
+	/// Node with an asynchronous chunk function: the workers receive the next chunks and send finished results while up to 'pipeline depth' chunks are computed, eg. on the device.
+	/// </summary>
+	/// <param name="kernel">called by the workers for every chunk, starts it and returns its completion; see asyncChunkKrnl</param>
+	ParallelForNode(std::string description, const std::string &input, const std::string &output, asyncChunkKrnl kernel, unsigned maxChunk, unsigned minChunk = 1);
+
+	void setPolicy(ChunkScheduler::POLICY _policy) { policy = _policy; }
+	/// <summary>
+	/// Chunks in flight per worker, see Distributor::setPrefetchDepth. Default: 2
+	/// </summary>
+	void setPrefetchDepth(unsigned depth) { prefetchDepth = depth < 1 ? 1 : depth; }
+	/// <summary>
+	/// Chunks per worker in progress: receiving the next, computing (asynchronous chunk functions: several) and sending the results of the previous ones. Every chunk has its own buffers. Default: 2
+	/// </summary>
+	void setPipelineDepth(unsigned depth) { pipelineDepth = depth < 1 ? 1 : depth; }
+	/// <summary>
+	/// Workers put their results directly into the output argument on the master (MPI_Put, see Data::openWindow_M) and only send the chunk-id. Default: off, results are sent and received
+	/// </summary>
+	void setResultsViaPut(bool put) { resultsViaPut = put; }
+	/// <summary>
+	/// Compression of the chunks on the wire, see Data::setCompression. Default: off
+	/// </summary>
+	void setCompression(Data::COMPRESSION mode) { compression = mode; }
+	/// <summary>
+	/// Chunks running longer than 'factor' times their expected duration are computed by a second worker at the end, see ChunkScheduler::setSpeculation. 0 turns it off. Default: 2
+	/// </summary>
+	void setSpeculation(double factor) { speculation = factor; }
+};
@@ -0,0 +1,170 @@
+// communication telemetry: per-operation latency histograms and per-peer bandwidth of all Data transfers
+// author: Schuchardt Martin, csap9442
+
+#include "Telemetry.h"
+#include <fstream>
+#include <mutex>
+
+
+const char* const Telemetry::OPERATION_NAMES[OPERATIONS] = {
+	"bcast M_to_W", "bcast W_to_W", "send M_to_W", "send W_to_M", "send W_to_W", "recv W_from_M", "recv M_from_W", "recv W_from_W",
+	"gather W_to_M", "allGather W_to_W", "reduce W_to_M", "allReduce W_to_W", "put W_to_M"
+};
+
+const int Telemetry::MASTER;
+const int Telemetry::ALL;
+const unsigned Telemetry::HISTOGRAM_BUCKETS;
+
+Telemetry::OperationStatistics Telemetry::operations[OPERATIONS];
+std::map<std::tuple<int, int, int>, Telemetry::Statistics> Telemetry::peers;
+std::map<int, std::vector<unsigned long long>> Telemetry::merged;
+static std::mutex recordMutex; // concurrent nodes record from several threads of the master
+
+
+void Telemetry::record(OPERATION operation, int peer, int tag, unsigned long long bytes, unsigned long long nanoseconds) {
+	unsigned bucket = 0;
+	while (bucket + 1 < HISTOGRAM_BUCKETS && (nanoseconds >> (bucket + 1)) != 0)
+		++bucket;
+
+	std::lock_guard<std::mutex> lock(recordMutex);
+	auto &op = operations[operation];
+	++op.count;
+	op.bytes += bytes;
+	op.nanoseconds += nanoseconds;
+	++op.histogram[bucket];
+
+	auto &p = peers[std::make_tuple(static_cast<int>(operation), peer, tag)];
+	++p.count;
+	p.bytes += bytes;
+	p.nanoseconds += nanoseconds;
+}
+
+// per operation: count, bytes, nanoseconds, histogram. Then number of peer entries, per entry: operation, peer, tag, count, bytes, nanoseconds
+std::vector<unsigned long long> Telemetry::serialize() {
+	std::vector<unsigned long long> result;
+	for (auto &op : operations) {
+		result.push_back(op.count);
+		result.push_back(op.bytes);
+		result.push_back(op.nanoseconds);
+		result.insert(result.end(), op.histogram, op.histogram + HISTOGRAM_BUCKETS);
+	}
+	result.push_back(peers.size());
+	for (auto &p : peers) {
+		result.push_back(static_cast<unsigned long long>(std::get<0>(p.first)));
+		result.push_back(static_cast<unsigned long long>(static_cast<long long>(std::get<1>(p.first))));
+		result.push_back(static_cast<unsigned long long>(static_cast<long long>(std::get<2>(p.first))));
+		result.push_back(p.second.count);
+		result.push_back(p.second.bytes);
+		result.push_back(p.second.nanoseconds);
+	}
+	return result;
+}
+
+void Telemetry::merge(MPI_Comm intercomm, bool isMaster) {
+	if (!isMaster) {
+		auto own = serialize();
+		int size = static_cast<int>(own.size());
+		MPI_Gather(&size, 1, MPI_INT, nullptr, 0, MPI_INT, 0, intercomm);
+		MPI_Gatherv(own.data(), size, MPI_UNSIGNED_LONG_LONG, nullptr, nullptr, nullptr, MPI_UNSIGNED_LONG_LONG, 0, intercomm);
+		return;
+	}
+
+	int workers;
+	MPI_Comm_remote_size(intercomm, &workers);
+	std::vector<int> sizes(workers), displacements(workers);
+	MPI_Gather(nullptr, 0, MPI_INT, sizes.data(), 1, MPI_INT, MPI_ROOT, intercomm);
+	int total = 0;
+	for (int w = 0; w < workers; ++w) {
+		displacements[w] = total;
+		total += sizes[w];
+	}
+	std::vector<unsigned long long> all(total);
+	MPI_Gatherv(nullptr, 0, MPI_UNSIGNED_LONG_LONG, all.data(), sizes.data(), displacements.data(), MPI_UNSIGNED_LONG_LONG, MPI_ROOT, intercomm);
+
+	merged.clear();
+	merged[MASTER] = serialize();
+	for (int w = 0; w < workers; ++w)
+		merged[w] = std::vector<unsigned long long>(all.begin() + displacements[w], all.begin() + displacements[w] + sizes[w]);
+}
+
+static std::string rankName(int rank) {
+	if (rank == Telemetry::MASTER)
+		return "master";
+	if (rank == Telemetry::ALL)
+		return "all";
+	return std::to_string(rank);
+}
+
+// bytes per nanosecond are GB/s
+static double megabytesPerSecond(unsigned long long bytes, unsigned long long nanoseconds) {
+	return nanoseconds == 0 ? 0.0 : 1000.0 * bytes / nanoseconds;
+}
+
+void Telemetry::writeCSV(const std::string &csvBaseName) {
+	const char DELIMITER = ';';
+	std::ofstream latency(csvBaseName + ".latency.csv", std::ofstream::out | std::ofstream::trunc);
+	std::ofstream bandwidth(csvBaseName + ".peers.csv", std::ofstream::out | std::ofstream::trunc);
+
+	latency << "rank" << DELIMITER << "operation" << DELIMITER << "count" << DELIMITER << "bytes" << DELIMITER << "total_ns" << DELIMITER << "mean_ns" << DELIMITER << "MB_per_s";
+	for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+		latency << DELIMITER << (b + 1 < HISTOGRAM_BUCKETS ? "lt_" + std::to_string(1ull << (b + 1)) : "ge_" + std::to_string(1ull << b)) << "_ns";
+	latency << std::endl;
+	bandwidth << "rank" << DELIMITER << "operation" << DELIMITER << "peer" << DELIMITER << "tag" << DELIMITER << "count" << DELIMITER << "bytes" << DELIMITER << "total_ns" << DELIMITER << "MB_per_s" << std::endl;
+
+	OperationStatistics all[OPERATIONS];
+	std::map<std::tuple<int, int, int>, Statistics> allPeers;
+	auto writeOperations = [&](int rank, const OperationStatistics *ops) {
+		for (unsigned o = 0; o < OPERATIONS; ++o) {
+			if (ops[o].count == 0)
+				continue;
+			latency << rankName(rank) << DELIMITER << OPERATION_NAMES[o] << DELIMITER << ops[o].count << DELIMITER << ops[o].bytes << DELIMITER << ops[o].nanoseconds << DELIMITER
+				<< ops[o].nanoseconds / ops[o].count << DELIMITER << megabytesPerSecond(ops[o].bytes, ops[o].nanoseconds);
+			for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				latency << DELIMITER << ops[o].histogram[b];
+			latency << std::endl;
+		}
+	};
+	auto writePeers = [&](int rank, const std::map<std::tuple<int, int, int>, Statistics> &entries) {
+		for (auto &p : entries)
+			bandwidth << rankName(rank) << DELIMITER << OPERATION_NAMES[std::get<0>(p.first)] << DELIMITER << rankName(std::get<1>(p.first)) << DELIMITER << std::get<2>(p.first) << DELIMITER
+				<< p.second.count << DELIMITER << p.second.bytes << DELIMITER << p.second.nanoseconds << DELIMITER << megabytesPerSecond(p.second.bytes, p.second.nanoseconds) << std::endl;
+	};
+
+	for (auto &process : merged) {
+		const unsigned long long *it = process.second.data();
+		OperationStatistics ops[OPERATIONS];
+		for (unsigned o = 0; o < OPERATIONS; ++o) {
+			ops[o].count = *it++;
+			ops[o].bytes = *it++;
+			ops[o].nanoseconds = *it++;
+			for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				ops[o].histogram[b] = *it++;
+
+			all[o].count += ops[o].count;
+			all[o].bytes += ops[o].bytes;
+			all[o].nanoseconds += ops[o].nanoseconds;
+			for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				all[o].histogram[b] += ops[o].histogram[b];
+		}
+		writeOperations(process.first, ops);
+
+		std::map<std::tuple<int, int, int>, Statistics> entries;
+		const unsigned long long count = *it++;
+		for (unsigned long long i = 0; i < count; ++i, it += 6) {
+			auto key = std::make_tuple(static_cast<int>(it[0]), static_cast<int>(static_cast<long long>(it[1])), static_cast<int>(static_cast<long long>(it[2])));
+			Statistics s;
+			s.count = it[3];
+			s.bytes = it[4];
+			s.nanoseconds = it[5];
+			entries[key] = s;
+
+			auto &sum = allPeers[key];
+			sum.count += s.count;
+			sum.bytes += s.bytes;
+			sum.nanoseconds += s.nanoseconds;
+		}
+		writePeers(process.first, entries);
+	}
+	writeOperations(ALL, all);
+	writePeers(ALL, allPeers);
+}
@@ -0,0 +1,62 @@
+// communication telemetry: per-operation latency histograms and per-peer bandwidth of all Data transfers
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+
+#include <mpi.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <tuple>
+
+
+class Telemetry {
+public:
+	enum OPERATION {
+		BCAST_M_TO_W, BCAST_W_TO_W, SEND_M_TO_W, SEND_W_TO_M, SEND_W_TO_W, RECV_W_FROM_M, RECV_M_FROM_W, RECV_W_FROM_W,
+		GATHER_W_TO_M, ALLGATHER_W_TO_W, REDUCE_W_TO_M, ALLREDUCE_W_TO_W, PUT_W_TO_M, OPERATIONS
+	};
+	static const char* const OPERATION_NAMES[OPERATIONS];
+
+	static const int MASTER = -1; // peer/rank of the master, workers are numbered from 0
+	static const int ALL = -2; // peer of collectives without a single root (allGather, allReduce)
+	static const unsigned HISTOGRAM_BUCKETS = 40; // bucket i counts durations in [2^i, 2^(i+1)) ns, the last one everything above
+
+private:
+	struct Statistics {
+		unsigned long long count = 0;
+		unsigned long long bytes = 0;
+		unsigned long long nanoseconds = 0;
+	};
+	struct OperationStatistics : Statistics {
+		unsigned long long histogram[HISTOGRAM_BUCKETS] = {};
+	};
+
+	static OperationStatistics operations[OPERATIONS];
+	static std::map<std::tuple<int, int, int>, Statistics> peers; // (operation, peer, tag) -> statistics
+	static std::map<int, std::vector<unsigned long long>> merged; // rank -> serialized telemetry, master only, filled by merge()
+
+	static std::vector<unsigned long long> serialize();
+
+public:
+	/// <summary>
+	/// Records one completed transfer. Called by every Data primitive, blocking ones with the duration of the call, non-blocking ones with the durations of posting and completing.
+	/// </summary>
+	/// <param name="operation">primitive that moved the data</param>
+	/// <param name="peer">rank of the other side (MASTER for the master), the root of collectives or ALL</param>
+	/// <param name="tag">MPI tag, MPI_ANY_TAG for collectives</param>
+	/// <param name="bytes">bytes moved by this process</param>
+	/// <param name="nanoseconds">duration of the transfer</param>
+	static void record(OPERATION operation, int peer, int tag, unsigned long long bytes, unsigned long long nanoseconds);
+
+	/// <summary>
+	/// Collects the telemetry of all workers on the master. Collective on 'intercomm', called by Distributor::instanceFinalize on the master and all workers.
+	/// </summary>
+	static void merge(MPI_Comm intercomm, bool isMaster);
+
+	/// <summary>
+	/// Writes the merged telemetry (master only, after merge): 'csvBaseName'.latency.csv with one line per rank and operation including the latency histogram,
+	/// and 'csvBaseName'.peers.csv with bytes and bandwidth per rank, operation, peer and tag. Rank "all" sums up all processes. Existing files are replaced.
+	/// </summary>
+	static void writeCSV(const std::string &csvBaseName);
+};
@@ -1,11 +1,104 @@
 // author: Schuchardt Martin, csap9442
+// C = A*B for a chunk of ROWS rows of A and C, B is N*N. All kernels guard against work-items outside of the chunk,
+// so the NDRange can be padded up to a multiple of the tile size and N does not need to be a multiple of TS.
+// compile time parameters: N, TS (tile size), WPT (columns per work-item), WIDTH (vector width). DATA_TYPE is defined in front of the source (see kernelSource)
 std::string kernelCode =
-"__kernel void mmulNaive(__global DATA_TYPE *A, __global DATA_TYPE *B, __global DATA_TYPE *C) {"
-"	int col = get_global_id(0);																   "
-"	int row = get_global_id(1);																   "
-"	DATA_TYPE sum = 0;																		   "
-"	for (int k = 0; k<N; ++k) {																   "
-"		sum += *(A + row*N + k) * *(B + k*N + col);											   "
-"	}																						   "
-"	*(C + row*N + col) = sum;																   "
-"}																						       ";
\ No newline at end of file
+"#ifdef cl_khr_fp64\n"
+"	#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+"#endif\n"
+"#define CAT_(a, b) a##b\n"
+"#define CAT(a, b) CAT_(a, b)\n"
+"#define VECTOR CAT(DATA_TYPE, WIDTH)\n"
+"#define VLOAD CAT(vload, WIDTH)\n"
+"#define VSTORE CAT(vstore, WIDTH)\n"
+"#define RTS (TS/WPT)\n"
+"\n"
+// one work-item per element of C, global size (N, ROWS)
+"__kernel void mmulNaive(__global DATA_TYPE *A, __global DATA_TYPE *B, __global DATA_TYPE *C, const int ROWS) {\n"
+"	int col = get_global_id(0);\n"
+"	int row = get_global_id(1);\n"
+"	if (col >= N || row >= ROWS)\n"
+"		return;\n"
+"	DATA_TYPE sum = 0;\n"
+"	for (int k = 0; k < N; ++k) {\n"
+"		sum += *(A + row*N + k) * *(B + k*N + col);\n"
+"	}\n"
+"	*(C + row*N + col) = sum;\n"
+"}\n"
+"\n"
+// TS*TS tiles of A and B in local memory, zero-padded at the borders. local size (TS, TS)
+"__kernel void mmulTiling(__global DATA_TYPE *A, __global DATA_TYPE *B, __global DATA_TYPE *C, const int ROWS) {\n"
+"	int col = get_global_id(0);\n"
+"	int row = get_global_id(1);\n"
+"	int lCol = get_local_id(0);\n"
+"	int lRow = get_local_id(1);\n"
+"	__local DATA_TYPE localA[TS][TS];\n"
+"	__local DATA_TYPE localB[TS][TS];\n"
+"	DATA_TYPE sum = 0;\n"
+"	for (int t = 0; t < N; t += TS) {\n"
+"		localA[lRow][lCol] = (row < ROWS && t + lCol < N) ? A[row*N + t + lCol] : 0;\n"
+"		localB[lRow][lCol] = (t + lRow < N && col < N) ? B[(t + lRow)*N + col] : 0;\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		for (int k = 0; k < TS; ++k)\n"
+"			sum += localA[lRow][k] * localB[k][lCol];\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	}\n"
+"	if (row < ROWS && col < N)\n"
+"		C[row*N + col] = sum;\n"
+"}\n"
+"\n"
+// tiling plus register blocking: each work-item computes WPT columns, RTS apart. local size (RTS, TS)
+"__kernel void mmulRegisterBlocking(__global DATA_TYPE *A, __global DATA_TYPE *B, __global DATA_TYPE *C, const int ROWS) {\n"
+"	int lCol = get_local_id(0);\n"
+"	int lRow = get_local_id(1);\n"
+"	int col = get_group_id(0)*TS + lCol;\n"
+"	int row = get_group_id(1)*TS + lRow;\n"
+"	__local DATA_TYPE localA[TS][TS];\n"
+"	__local DATA_TYPE localB[TS][TS];\n"
+"	DATA_TYPE sum[WPT];\n"
+"	for (int w = 0; w < WPT; ++w)\n"
+"		sum[w] = 0;\n"
+"	for (int t = 0; t < N; t += TS) {\n"
+"		for (int w = 0; w < WPT; ++w) {\n"
+"			int c = lCol + w*RTS;\n"
+"			localA[lRow][c] = (row < ROWS && t + c < N) ? A[row*N + t + c] : 0;\n"
+"			localB[lRow][c] = (t + lRow < N && col + w*RTS < N) ? B[(t + lRow)*N + col + w*RTS] : 0;\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		for (int k = 0; k < TS; ++k) {\n"
+"			DATA_TYPE a = localA[lRow][k];\n"
+"			for (int w = 0; w < WPT; ++w)\n"
+"				sum[w] += a * localB[k][lCol + w*RTS];\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	}\n"
+"	if (row < ROWS)\n"
+"		for (int w = 0; w < WPT; ++w)\n"
+"			if (col + w*RTS < N)\n"
+"				C[row*N + col + w*RTS] = sum[w];\n"
+"}\n"
+"\n"
+// tiling with vector loads and stores of B and C: each work-item computes WIDTH consecutive columns. local size (TS/WIDTH, TS)
+// requires N % WIDTH == 0, so a vector is either completely inside or completely outside of the matrix
+"__kernel void mmulVector(__global DATA_TYPE *A, __global DATA_TYPE *B, __global DATA_TYPE *C, const int ROWS) {\n"
+"	int lCol = get_local_id(0);\n"
+"	int lRow = get_local_id(1);\n"
+"	int col = (get_group_id(0)*(TS/WIDTH) + lCol)*WIDTH;\n"
+"	int row = get_group_id(1)*TS + lRow;\n"
+"	__local DATA_TYPE localA[TS][TS];\n"
+"	__local VECTOR localB[TS][TS/WIDTH];\n"
+"	VECTOR sum = 0;\n"
+"	for (int t = 0; t < N; t += TS) {\n"
+"		for (int w = 0; w < WIDTH; ++w) {\n"
+"			int c = lCol*WIDTH + w;\n"
+"			localA[lRow][c] = (row < ROWS && t + c < N) ? A[row*N + t + c] : 0;\n"
+"		}\n"
+"		localB[lRow][lCol] = (t + lRow < N && col < N) ? VLOAD(0, B + (t + lRow)*N + col) : (VECTOR)0;\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		for (int k = 0; k < TS; ++k)\n"
+"			sum += localA[lRow][k] * localB[k][lCol];\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	}\n"
+"	if (row < ROWS && col < N)\n"
+"		VSTORE(sum, 0, C + row*N + col);\n"
+"}\n";
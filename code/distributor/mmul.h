@@ -3,35 +3,89 @@
 
 #pragma once
 #include <iostream>
+#include <cmath>
 #include <string>
+#include <vector>
+#include <utility>
+#include <set>
+#include <future>
+#include <chrono>
 #include "../utils/cl_utils.h"
+#include "../utils/Utils.h"
+#include "DeviceRuntime.h"
+#include "mmulCPU.h"
 
 
 #ifndef VERIFY
 #define VERIFY 1
 #endif
 
-#ifndef DATA_TYPE
-#define DATA_TYPE int
-#define DATA_TYPE_CL cl_int
-#define DATA_TYPE_STRING "int"
-//#define DATA_TYPE float
-//#define DATA_TYPE_CL cl_float
-//#define DATA_TYPE_STRING "float"
-//#define DATA_TYPE double
-//#define DATA_TYPE_CL cl_double
-//#define DATA_TYPE_STRING "double"
+// element types of the multiplication. Everything from the chunk multiplication to the kernel source is templated on the element type,
+// so one binary contains all of them and the type is selected at runtime (see parseDataType)
+enum MMUL_DATA_TYPE { MMUL_INT, MMUL_FLOAT, MMUL_DOUBLE };
+const char* const MMUL_DATA_TYPE_NAMES[] = { "int", "float", "double" };
+
+// compile-time properties of an element type: its id and the name of the matching OpenCL type
+template<typename T> struct MMulType;
+template<> struct MMulType<int> {
+	typedef cl_int cl_type;
+	static MMUL_DATA_TYPE id() { return MMUL_INT; }
+	static const char* name() { return MMUL_DATA_TYPE_NAMES[MMUL_INT]; }
+};
+template<> struct MMulType<float> {
+	typedef cl_float cl_type;
+	static MMUL_DATA_TYPE id() { return MMUL_FLOAT; }
+	static const char* name() { return MMUL_DATA_TYPE_NAMES[MMUL_FLOAT]; }
+};
+template<> struct MMulType<double> {
+	typedef cl_double cl_type;
+	static MMUL_DATA_TYPE id() { return MMUL_DOUBLE; }
+	static const char* name() { return MMUL_DATA_TYPE_NAMES[MMUL_DOUBLE]; }
+};
+static_assert(sizeof(cl_int) == sizeof(int) && sizeof(cl_float) == sizeof(float) && sizeof(cl_double) == sizeof(double), "host and OpenCL element types have to match, chunks are copied to the device as they are");
+
+// default parameters of the tiled kernels, TILESIZE has to be a multiple of WORK_PER_THREAD and VECTOR_WIDTH
+#ifndef TILESIZE
+#define TILESIZE 16u
+#endif
+#ifndef WORK_PER_THREAD
+#define WORK_PER_THREAD 4u
 #endif
+#ifndef VECTOR_WIDTH
+#define VECTOR_WIDTH 4u
+#endif
+
 
+enum MMUL_KERNEL { MMUL_AUTO, MMUL_NAIVE, MMUL_TILING, MMUL_REGISTER_BLOCKING, MMUL_VECTOR, MMUL_CPU };
+const char* const MMUL_KERNEL_NAMES[] = { "auto", "mmulNaive", "mmulTiling", "mmulRegisterBlocking", "mmulVector", "cpu" };
+MMUL_KERNEL mmulKernel = MMUL_AUTO; // MMUL_AUTO selects the kernel per device and chunk shape, anything else forces that kernel if the device supports it. MMUL_CPU uses the CPU engine (see mmulCPU.h), also chosen automatically without OpenCL devices
+MMUL_KERNEL mmulTunedKernel = MMUL_AUTO; // winner of autotuneMMul for this device and N, if any
+
+// tuning database of the workers, see cluTuningLookup
+const std::string MMUL_TUNING_DATABASE = std::string(WORKDIR) + "/" + CLU_TUNING_DATABASE;
+
+typedef struct {
+	unsigned tileSize;
+	unsigned workPerThread;
+	unsigned vectorWidth;
+} mmul_parameters;
+mmul_parameters mmul_param = { TILESIZE, WORK_PER_THREAD, VECTOR_WIDTH };
+
+typedef struct {
+	unsigned long long chunks;
+	unsigned long long kernel_ns; // device time of the multiplication kernels, from profiling events
+	double flop;
+	MMUL_KERNEL lastKernel;
+} mmul_statistics;
+mmul_statistics mmul_stats = { 0, 0, 0.0, MMUL_AUTO };
 
 typedef struct {
-	cl_context ctx;
-	cl_command_queue queue;
-	cl_device_id id;
-	cl_program prog;
-	cl_kernel kernel;
-} ocl_mgmt;
-ocl_mgmt cl;
+	cl_event kernel; // multiplication, for profiling
+	cl_event done; // readback of C, completes last
+	std::shared_future<unsigned long long> cpu; // CPU engine only: computation time in ns, kernel and done are unused
+	double flop;
+	MMUL_KERNEL kernelUsed;
+} ocl_chunk;
 
 typedef struct {
 	size_t globalWorkGroupSize[2];
@@ -46,8 +100,20 @@ ocl_parameters cl_param;
 
 
 const float EPSILON = 0.0000000001f;
-void multiplyChunkCPU(const DATA_TYPE *A, const int ROWS, const int COLUMNS, const DATA_TYPE *B, DATA_TYPE *C);
-void multiplyChunkCL(const DATA_TYPE_CL *A, const int ROWS, const int COLUMNS, const DATA_TYPE_CL *B, DATA_TYPE_CL *C, unsigned acc_device);
+template<typename T> void multiplyChunkCPU(const T *A, const int ROWS, const int COLUMNS, const T *B, T *C);
+template<typename T> ocl_chunk multiplyChunkCPUAsync(const T *A, const int ROWS, const int COLUMNS, const T *B, T *C);
+bool computesOnCPU();
+template<typename T> void multiplyChunkCL(const T *A, const int ROWS, const int COLUMNS, Data *B, T *C, unsigned acc_device);
+template<typename T> ocl_chunk multiplyChunkCLAsync(const T *A, const int ROWS, const int COLUMNS, Data *B, T *C, unsigned acc_device, unsigned slot = 0);
+bool testChunkCL(const ocl_chunk &chunk);
+void waitChunkCL(const ocl_chunk &chunk);
+template<typename T> MMUL_KERNEL selectKernel(DeviceRuntime &runtime, const int ROWS, const int COLUMNS);
+MMUL_KERNEL parseKernel(const std::string &name);
+MMUL_DATA_TYPE parseDataType(const std::string &name);
+template<typename T> bool loadTuning(DeviceRuntime &runtime, const int COLUMNS);
+template<typename T> void autotuneMMul(DeviceRuntime &runtime, const int ROWS, const int COLUMNS);
+double mmulGFlops();
+std::vector<std::pair<std::string, unsigned long long>> mmulDetails();
 
 #include "mmul.cl"
 #include "mmul.tpp"
@@ -18,7 +18,7 @@ int testResults(T *should, T *is, const std::size_t N, std::string &output) {
 	output = "...verifying...\n";
 	for (unsigned i = 0; i < N; i++)
 		for (unsigned j = 0; j < N; j++) {
-			if (abs((should[i*N + j]) - is[i*N + j]) > EPSILON) {
+			if (std::abs((should[i*N + j]) - is[i*N + j]) > EPSILON) {
 				output += "ERROR: values do not match: should[" + std::to_string(i) + ", " + std::to_string(j) + "]: " + std::to_string(*(should + i*N + j)) + ", is[" + std::to_string(i) + ", " + std::to_string(j) + "]: " + std::to_string(*(is + i*N + j)) + '\n';
 				return 1;
 			}
@@ -40,71 +40,352 @@ void printMatrix(T *A, unsigned I, unsigned J) {
 
 
 // *** MMul/OpenCL code **********************************************************************************************************************************
-// simple matrix multiplication using CPU
-void multiplyChunkCPU(const DATA_TYPE *A, const int ROWS, const int COLUMNS, const DATA_TYPE *B, DATA_TYPE *C) {
-	for (int i = 0; i < ROWS; ++i) {
-		for (int j = 0; j < COLUMNS; ++j) {
-			DATA_TYPE sum = 0;
-			for (int k = 0; k < COLUMNS; ++k) {
-				sum += *(A + i*COLUMNS + k) * *(B + k*COLUMNS + j);
-			}
-			*(C + i*COLUMNS + j) = sum;
-		}
+// matrix multiplication using the CPU engine: packed, cache-blocked, vectorized and multithreaded (see mmulCPU.h)
+template<typename T>
+void multiplyChunkCPU(const T *A, const int ROWS, const int COLUMNS, const T *B, T *C) {
+	gemmCPU(ROWS, COLUMNS, COLUMNS, A, COLUMNS, B, COLUMNS, C, COLUMNS);
+}
+
+// same as multiplyChunkCPU, but computes on a separate thread. Completes like OpenCL chunks with testChunkCL and waitChunkCL
+template<typename T>
+ocl_chunk multiplyChunkCPUAsync(const T *A, const int ROWS, const int COLUMNS, const T *B, T *C) {
+	ocl_chunk chunk;
+	chunk.kernel = chunk.done = NULL;
+	chunk.kernelUsed = MMUL_CPU;
+	chunk.flop = 2.0 * ROWS * COLUMNS * COLUMNS;
+	chunk.cpu = std::async(std::launch::async, [=]() {
+		auto start = std::chrono::steady_clock::now();
+		multiplyChunkCPU(A, ROWS, COLUMNS, B, C);
+		return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}).share();
+	return chunk;
+}
+
+// true, if chunks are computed by the CPU engine: forced with MMUL_CPU, or automatically if there is no OpenCL device at all
+bool computesOnCPU() {
+	static const bool noDevice = cluGetDeviceCount() == 0;
+	if (mmulKernel == MMUL_AUTO && noDevice)
+		mmulKernel = MMUL_CPU;
+	return mmulKernel == MMUL_CPU;
+}
+
+// matrix multiplication using openCL, for int, float and double matrices
+// context, program and kernel are taken from the device runtime, so they are built only once per worker and element type
+// B is kept resident on the device and uploaded only if its host copy has changed since the last chunk
+template<typename T>
+void multiplyChunkCL(const T *A, const int ROWS, const int COLUMNS, Data *B, T *C, unsigned acc_device) {
+	waitChunkCL(multiplyChunkCLAsync(A, ROWS, COLUMNS, B, C, acc_device));
+}
+
+inline size_t roundUp(const size_t value, const size_t multiple) {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+// local work size of 'kernel' for a chunk, (0, 0) lets the implementation decide
+void kernelWorkSize(const MMUL_KERNEL kernel, const int ROWS, const int COLUMNS, size_t *global, size_t *local) {
+	const size_t TS = mmul_param.tileSize;
+	switch (kernel) {
+	case MMUL_TILING:
+		local[0] = TS; local[1] = TS;
+		global[0] = roundUp(COLUMNS, TS); global[1] = roundUp(ROWS, TS);
+		break;
+	case MMUL_REGISTER_BLOCKING:
+		local[0] = TS / mmul_param.workPerThread; local[1] = TS;
+		global[0] = roundUp(COLUMNS, TS) / mmul_param.workPerThread; global[1] = roundUp(ROWS, TS);
+		break;
+	case MMUL_VECTOR:
+		local[0] = TS / mmul_param.vectorWidth; local[1] = TS;
+		global[0] = roundUp(COLUMNS, TS) / mmul_param.vectorWidth; global[1] = roundUp(ROWS, TS);
+		break;
+	default:
+		local[0] = 0; local[1] = 0;
+		global[0] = COLUMNS; global[1] = ROWS;
 	}
 }
 
-// simple matrix multiplication using openCL
-// ATTENTION: for integer-matrices only!
-void multiplyChunkCL(const DATA_TYPE_CL *A, const int ROWS, const int COLUMNS, const DATA_TYPE_CL *B, DATA_TYPE_CL *C, unsigned acc_device) {
-	// initialize ocl device
-	cl.id = cluInitDevice(acc_device, &cl.ctx, &cl.queue);
-	int err = 0;
+// kernel source for element type T. DATA_TYPE is part of the source, so every type gets its own program and binary cache entry
+template<typename T>
+const std::string& kernelSource() {
+	static const std::string source = std::string("#define DATA_TYPE ") + MMulType<T>::name() + "\n" + kernelCode;
+	return source;
+}
 
-	// create kernels from source
+// program options for the current chunk size and kernel parameters, all kernels share one program
+std::string kernelOptions(const int COLUMNS) {
 	char tmp[1024];
-	sprintf(tmp, "-DN=%i -DDATA_TYPE=%s", COLUMNS, DATA_TYPE_STRING);
+	sprintf(tmp, "-DN=%i -DTS=%u -DWPT=%u -DWIDTH=%u", COLUMNS, mmul_param.tileSize, mmul_param.workPerThread, mmul_param.vectorWidth);
+	return tmp;
+}
+
+// true, if the device of 'runtime' computes with T. double needs cl_khr_fp64
+template<typename T>
+bool deviceSupports(DeviceRuntime &runtime) {
+	return true;
+}
+
+template<>
+bool deviceSupports<double>(DeviceRuntime &runtime) {
+	cl_device_fp_config config;
+	CLU_ERRCHECK(clGetDeviceInfo(runtime.getDevice(), CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(config), &config, NULL), "Error getting \"double fp config\" info");
+	return config != 0;
+}
+
+// true, if 'kernel' can run with its local work size and local memory on the device of 'runtime'
+template<typename T>
+bool kernelFits(DeviceRuntime &runtime, const MMUL_KERNEL kernel, const int ROWS, const int COLUMNS) {
+	if (kernel == MMUL_NAIVE)
+		return true;
+	if (kernel == MMUL_VECTOR && COLUMNS % mmul_param.vectorWidth != 0)
+		return false;
+
+	cl_ulong localMemSize;
+	CLU_ERRCHECK(clGetDeviceInfo(runtime.getDevice(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemSize), &localMemSize, NULL), "Error getting \"local memory size\" info");
+	if (2 * mmul_param.tileSize * mmul_param.tileSize * sizeof(T) > localMemSize)
+		return false;
+
+	size_t maxWorkGroupSize, global[2], local[2];
+	cl_kernel k = runtime.getKernel(kernelSource<T>(), kernelOptions(COLUMNS), MMUL_KERNEL_NAMES[kernel]);
+	CLU_ERRCHECK(clGetKernelWorkGroupInfo(k, runtime.getDevice(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL), "Error getting \"kernel work group size\" info");
+	kernelWorkSize(kernel, ROWS, COLUMNS, global, local);
+	return local[0] * local[1] <= maxWorkGroupSize;
+}
+
+// chooses the kernel by device and chunk shape:
+// tiny matrices or chunks with only a few rows would mostly compute padding, so they stay with the naive kernel.
+// Otherwise the autotuned kernel is used, if there is one. Without tuning CPUs profit from vector loads, GPUs from register blocking.
+// Falls back to simpler kernels if the device lacks resources.
+template<typename T>
+MMUL_KERNEL selectKernel(DeviceRuntime &runtime, const int ROWS, const int COLUMNS) {
+	MMUL_KERNEL kernel = mmulKernel;
+	if (kernel == MMUL_AUTO) {
+		const unsigned TS = mmul_param.tileSize;
+		if (static_cast<unsigned>(COLUMNS) < TS || roundUp(ROWS, TS) > 2u * ROWS)
+			return MMUL_NAIVE;
+	}
+	if (kernel == MMUL_AUTO && mmulTunedKernel != MMUL_AUTO)
+		kernel = mmulTunedKernel;
+	if (kernel == MMUL_AUTO) {
+		cl_device_type type;
+		CLU_ERRCHECK(clGetDeviceInfo(runtime.getDevice(), CL_DEVICE_TYPE, sizeof(type), &type, NULL), "Error getting \"device type\" info");
+		if (type == CL_DEVICE_TYPE_CPU)
+			kernel = (COLUMNS % mmul_param.vectorWidth == 0) ? MMUL_VECTOR : MMUL_TILING;
+		else
+			kernel = MMUL_REGISTER_BLOCKING;
+	}
+
+	if (kernel == MMUL_VECTOR && !kernelFits<T>(runtime, kernel, ROWS, COLUMNS))
+		kernel = MMUL_TILING;
+	if (kernel == MMUL_REGISTER_BLOCKING && !kernelFits<T>(runtime, kernel, ROWS, COLUMNS))
+		kernel = MMUL_TILING;
+	if (kernel == MMUL_TILING && !kernelFits<T>(runtime, kernel, ROWS, COLUMNS))
+		kernel = MMUL_NAIVE;
+	return kernel;
+}
+
+MMUL_KERNEL parseKernel(const std::string &name) {
+	for (int k = MMUL_AUTO; k <= MMUL_CPU; ++k)
+		if (name == MMUL_KERNEL_NAMES[k])
+			return static_cast<MMUL_KERNEL>(k);
+	std::cerr << "WARNING: unknown kernel " + name + ", selecting kernels automatically" << std::endl;
+	return MMUL_AUTO;
+}
+
+MMUL_DATA_TYPE parseDataType(const std::string &name) {
+	for (int t = MMUL_INT; t <= MMUL_DOUBLE; ++t)
+		if (name == MMUL_DATA_TYPE_NAMES[t])
+			return static_cast<MMUL_DATA_TYPE>(t);
+	std::cerr << "WARNING: unknown data type " + name + ", using int" << std::endl;
+	return MMUL_INT;
+}
 
+// enqueues 'kernel' for a chunk of ROWS rows on device buffers A, B and C, returns the event of the kernel
+template<typename T>
+cl_event enqueueMMul(DeviceRuntime &runtime, const MMUL_KERNEL kernel, const int ROWS, const int COLUMNS, cl_mem A, cl_mem B, cl_mem C) {
 	// reading kernel from string spares erroneous mpi --preload-files
 	// const std::string KERNEL_FILE_NAME = getDirectory(__FILE__) + "/mmul.cl";
 	// cl.prog = cluBuildProgramFromFile(cl.ctx, cl.id, KERNEL_FILE_NAME.c_str(), tmp);
-	cl.prog = cluBuildProgramFromString(cl.ctx, cl.id, kernelCode.c_str(), tmp);
-	cl.kernel = clCreateKernel(cl.prog, "mmulNaive", &err);
-	CLU_ERRCHECK(err, "could not create kernel");
+	cl_kernel k = runtime.getKernel(kernelSource<T>(), kernelOptions(COLUMNS), MMUL_KERNEL_NAMES[kernel]);
+	size_t global[2], local[2];
+	kernelWorkSize(kernel, ROWS, COLUMNS, global, local);
+
+	// prepare kernel, arguments are captured at enqueue time
+	cl_event event;
+	cluSetKernelArguments(k, 4, sizeof(cl_mem), (void*)&A, sizeof(cl_mem), (void*)&B, sizeof(cl_mem), (void*)&C, sizeof(cl_int), (void*)&ROWS);
+	CLU_ERRCHECK(clEnqueueNDRangeKernel(runtime.getQueue(), k, 2, NULL, global, local[0] ? local : NULL, 0, NULL, &event), "Failed to enqueue %s", MMUL_KERNEL_NAMES[kernel]);
+	return event;
+}
+
+// shape of the tuning database entries, chunks differ in their number of rows only
+template<typename T>
+std::string tuningShape(const int COLUMNS) {
+	return "N=" + std::to_string(COLUMNS) + " DATA_TYPE=" + MMulType<T>::name();
+}
+
+// applies kernel and parameters tuned for this device, N and element type, if the tuning database has an entry
+template<typename T>
+bool loadTuning(DeviceRuntime &runtime, const int COLUMNS) {
+	char params[256];
+	if (!cluTuningLookup(MMUL_TUNING_DATABASE.c_str(), runtime.getDevice(), "mmul", tuningShape<T>(COLUMNS).c_str(), params, sizeof(params)))
+		return false;
+
+	mmulTunedKernel = static_cast<MMUL_KERNEL>(cluTuningParameter(params, "KERNEL", MMUL_AUTO));
+	if (mmulTunedKernel < MMUL_AUTO || mmulTunedKernel > MMUL_VECTOR)
+		mmulTunedKernel = MMUL_AUTO;
+	mmul_param.tileSize = cluTuningParameter(params, "TILESIZE", TILESIZE);
+	mmul_param.workPerThread = cluTuningParameter(params, "WORK_PER_THREAD", WORK_PER_THREAD);
+	mmul_param.vectorWidth = cluTuningParameter(params, "VECTOR_WIDTH", VECTOR_WIDTH);
+	return true;
+}
 
-	cl_param.globalWorkGroupSize[0] = COLUMNS;
-	cl_param.globalWorkGroupSize[1] = ROWS;
+// sweeps all kernels with tile sizes, work per thread and vector widths for chunks of ROWS rows on the device of 'runtime'.
+// Every candidate is timed with profiling events (best of 3 runs after a warm-up), the fastest is stored in the tuning database and applied.
+template<typename T>
+void autotuneMMul(DeviceRuntime &runtime, const int ROWS, const int COLUMNS) {
+	if (!deviceSupports<T>(runtime))
+		return;
+	std::vector<T> A(ROWS*COLUMNS), B(COLUMNS*COLUMNS);
+	for (auto &a : A) a = rand() % 100;
+	for (auto &b : B) b = rand() % 100;
+	cl_mem bufA = runtime.getBuffer("tuneA", CL_MEM_READ_ONLY, A.size() * sizeof(T));
+	cl_mem bufB = runtime.getBuffer("tuneB", CL_MEM_READ_ONLY, B.size() * sizeof(T));
+	cl_mem bufC = runtime.getBuffer("tuneC", CL_MEM_WRITE_ONLY, A.size() * sizeof(T));
+	CLU_ERRCHECK(clEnqueueWriteBuffer(runtime.getQueue(), bufA, CL_FALSE, 0, A.size() * sizeof(T), A.data(), 0, NULL, NULL), "Failed to write buffers");
+	CLU_ERRCHECK(clEnqueueWriteBuffer(runtime.getQueue(), bufB, CL_TRUE, 0, B.size() * sizeof(T), B.data(), 0, NULL, NULL), "Failed to write buffers");
+
+	const mmul_parameters original = mmul_param;
+	mmul_parameters best = original;
+	MMUL_KERNEL bestKernel = MMUL_NAIVE;
+	cl_ulong bestTime = ~0ull;
+
+	auto measure = [&](MMUL_KERNEL kernel) {
+		if (!kernelFits<T>(runtime, kernel, ROWS, COLUMNS))
+			return;
+		cl_ulong time = ~0ull;
+		for (int run = 0; run < 4; ++run) {
+			cl_event event = enqueueMMul<T>(runtime, kernel, ROWS, COLUMNS, bufA, bufB, bufC);
+			CLU_ERRCHECK(clWaitForEvents(1, &event), "Failed to wait for kernel");
+			if (run > 0) // first run is warm-up
+				time = std::min(time, cluEventDurationNs(event));
+			CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
+		}
+		if (time < bestTime) {
+			bestTime = time;
+			bestKernel = kernel;
+			best = mmul_param;
+		}
+	};
 
-	// create buffers
-	cl_param.A = clCreateBuffer(cl.ctx, CL_MEM_READ_ONLY, COLUMNS*ROWS * sizeof(DATA_TYPE_CL), NULL, &err);
-	CLU_ERRCHECK(err, "Failed to create buffer");
-	cl_param.B = clCreateBuffer(cl.ctx, CL_MEM_READ_ONLY, COLUMNS*COLUMNS * sizeof(DATA_TYPE_CL), NULL, &err);
-	CLU_ERRCHECK(err, "Failed to create buffer");
-	cl_param.C = clCreateBuffer(cl.ctx, CL_MEM_WRITE_ONLY, COLUMNS*ROWS * sizeof(DATA_TYPE_CL), NULL, &err);
-	CLU_ERRCHECK(err, "Failed to create buffer");
+	measure(MMUL_NAIVE);
+	for (unsigned ts = 4; ts <= 32; ts *= 2) {
+		mmul_param = original;
+		mmul_param.tileSize = ts;
+		measure(MMUL_TILING);
+		for (unsigned wpt = 1; wpt <= 8 && wpt <= ts; wpt *= 2) {
+			mmul_param.workPerThread = wpt;
+			measure(MMUL_REGISTER_BLOCKING);
+		}
+		mmul_param.workPerThread = original.workPerThread <= ts ? original.workPerThread : ts;
+		for (unsigned width = 2; width <= 8 && width <= ts; width *= 2) {
+			mmul_param.vectorWidth = width;
+			measure(MMUL_VECTOR);
+		}
+	}
+
+	mmul_param = best;
+	mmulTunedKernel = bestKernel;
+	char params[256];
+	sprintf(params, "KERNEL=%d TILESIZE=%u WORK_PER_THREAD=%u VECTOR_WIDTH=%u", bestKernel, best.tileSize, best.workPerThread, best.vectorWidth);
+	cluTuningStore(MMUL_TUNING_DATABASE.c_str(), runtime.getDevice(), "mmul", tuningShape<T>(COLUMNS).c_str(), params, bestTime);
+}
+
+// same as multiplyChunkCL, but returns right after enqueueing. Each pipeline slot uses its own device buffers for A and C.
+// A must not be changed and C must not be read before the chunk has completed (see testChunkCL, waitChunkCL)
+// Workers without OpenCL device, without support for T or with MMUL_CPU selected are passed on to the CPU engine
+template<typename T>
+ocl_chunk multiplyChunkCLAsync(const T *A, const int ROWS, const int COLUMNS, Data *B, T *C, unsigned acc_device, unsigned slot) {
+	if (!computesOnCPU() && !deviceSupports<T>(DeviceRuntime::get(acc_device))) {
+		std::cerr << "WARNING: OpenCL device " + std::to_string(acc_device) + " does not support " + MMulType<T>::name() + ", computing on the CPU" << std::endl;
+		mmulKernel = MMUL_CPU;
+	}
+	if (computesOnCPU())
+		return multiplyChunkCPUAsync(A, ROWS, COLUMNS, static_cast<const T*>(B->get()), C);
+
+	DeviceRuntime &runtime = DeviceRuntime::get(acc_device);
+	cl_command_queue queue = runtime.getQueue();
+	int err = 0;
+
+	// tuned parameters are looked up once per device and matrix size
+	static std::set<std::pair<unsigned, int>> consulted;
+	if (consulted.insert(std::make_pair(acc_device, COLUMNS)).second)
+		loadTuning<T>(runtime, COLUMNS);
+
+	ocl_chunk chunk;
+	chunk.kernelUsed = selectKernel<T>(runtime, ROWS, COLUMNS);
+	chunk.flop = 2.0 * ROWS * COLUMNS * COLUMNS;
+
+	// buffers are reused for all chunks, reallocated only if a larger chunk arrives
+	cl_param.A = runtime.getBuffer("A" + std::to_string(slot), CL_MEM_READ_ONLY, COLUMNS*ROWS * sizeof(T));
+	cl_param.B = runtime.getResidentBuffer(B);
+	cl_param.C = runtime.getBuffer("C" + std::to_string(slot), CL_MEM_WRITE_ONLY, COLUMNS*ROWS * sizeof(T));
 
 	// write buffers
-	err = clEnqueueWriteBuffer(cl.queue, cl_param.A, CL_FALSE, 0, COLUMNS*ROWS * sizeof(DATA_TYPE_CL), A, 0, NULL, NULL);
-	err |= clEnqueueWriteBuffer(cl.queue, cl_param.B, CL_FALSE, 0, COLUMNS*COLUMNS * sizeof(DATA_TYPE_CL), B, 0, NULL, NULL);
+	err = clEnqueueWriteBuffer(queue, cl_param.A, CL_FALSE, 0, COLUMNS*ROWS * sizeof(T), A, 0, NULL, NULL);
 	CLU_ERRCHECK(err, "Failed to write buffers");
 
-	// prepare kernel
-	cluSetKernelArguments(cl.kernel, 3, sizeof(cl_mem), (void*)&cl_param.A, sizeof(cl_mem), (void*)&cl_param.B, sizeof(cl_mem), (void*)&cl_param.C);
-	CLU_ERRCHECK(clEnqueueNDRangeKernel(cl.queue, cl.kernel, 2, NULL, cl_param.globalWorkGroupSize, NULL, 0, NULL, NULL), "Failed to enqueue scan kernel");
+	chunk.kernel = enqueueMMul<T>(runtime, chunk.kernelUsed, ROWS, COLUMNS, cl_param.A, cl_param.B, cl_param.C);
+
+	// readback data, in-order queue: completion of the read implies completion of write and kernel
+	CLU_ERRCHECK(clEnqueueReadBuffer(queue, cl_param.C, CL_FALSE, 0, COLUMNS*ROWS * sizeof(T), C, 0, NULL, &chunk.done), "Failed to read new positions");
+	CLU_ERRCHECK(clFlush(queue), "Failed to flush command queue");
+	return chunk;
+}
 
-	// readback data
-	CLU_ERRCHECK(clEnqueueReadBuffer(cl.queue, cl_param.C, CL_TRUE, 0, COLUMNS*ROWS * sizeof(DATA_TYPE_CL), C, 0, NULL, NULL), "Failed to read new positions");
+// true, if the chunk has been computed and read back. Does not release the events.
+bool testChunkCL(const ocl_chunk &chunk) {
+	if (chunk.cpu.valid())
+		return chunk.cpu.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	cl_int status;
+	CLU_ERRCHECK(clGetEventInfo(chunk.done, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL), "Failed to query event status");
+	CLU_ERRCHECK(status < 0 ? status : CL_SUCCESS, "Failed to compute chunk");
+	return status == CL_COMPLETE;
+}
+
+// waits until the chunk has been computed and read back, adds its kernel time to the statistics and releases the events
+void waitChunkCL(const ocl_chunk &chunk) {
+	if (chunk.cpu.valid()) {
+		++mmul_stats.chunks;
+		mmul_stats.kernel_ns += chunk.cpu.get();
+		mmul_stats.flop += chunk.flop;
+		mmul_stats.lastKernel = chunk.kernelUsed;
+		return;
+	}
+
+	CLU_ERRCHECK(clWaitForEvents(1, &chunk.done), "Failed to wait for chunk");
+
+	cl_ulong start, end;
+	CLU_ERRCHECK(clGetEventProfilingInfo(chunk.kernel, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL), "Failed to get profiling info");
+	CLU_ERRCHECK(clGetEventProfilingInfo(chunk.kernel, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL), "Failed to get profiling info");
+	++mmul_stats.chunks;
+	mmul_stats.kernel_ns += end - start;
+	mmul_stats.flop += chunk.flop;
+	mmul_stats.lastKernel = chunk.kernelUsed;
+
+	CLU_ERRCHECK(clReleaseEvent(chunk.kernel), "Failed to release event");
+	CLU_ERRCHECK(clReleaseEvent(chunk.done), "Failed to release event");
+}
+
+// throughput of all chunks computed so far, device time only (computation time for the CPU engine)
+double mmulGFlops() {
+	return mmul_stats.kernel_ns ? mmul_stats.flop / mmul_stats.kernel_ns : 0.0;
+}
 
+std::vector<std::pair<std::string, unsigned long long>> mmulDetails() {
+	std::vector<std::pair<std::string, unsigned long long>> result;
 
-	// finalization
-	err = clFinish(cl.queue);
-	err |= clReleaseKernel(cl.kernel);
-	err |= clReleaseProgram(cl.prog);
-	err |= clReleaseCommandQueue(cl.queue);
-	err |= clReleaseContext(cl.ctx);
+	result.push_back(std::pair<std::string, unsigned long long>("mmul chunks          ", mmul_stats.chunks));
+	result.push_back(std::pair<std::string, unsigned long long>("mmul kernel (ms)     ", mmul_stats.kernel_ns / 1000000));
+	result.push_back(std::pair<std::string, unsigned long long>("mmul MFLOP/s         ", static_cast<unsigned long long>(mmulGFlops() * 1000)));
 
-	err |= clReleaseMemObject(cl_param.A);
-	err |= clReleaseMemObject(cl_param.B);
-	err |= clReleaseMemObject(cl_param.C);
-	CLU_ERRCHECK(err, "Failed during ocl cleanup");
+	return result;
 }
 // *** MMul/OpenCL code **********************************************************************************************************************************
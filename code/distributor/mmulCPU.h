@@ -0,0 +1,94 @@
+// Matrix multiplication on the CPU: packed panels, cache blocking, SIMD micro-kernels and a thread pool
+// author: Schuchardt Martin, csap9442
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MMUL_CPU_HAS_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define MMUL_CPU_HAS_NEON
+#include <arm_neon.h>
+#endif
+
+
+// cache blocking: a KC*NR sliver of packed B stays in L1, the MC*KC panel of packed A in L2 and the KC*NC panel of packed B in L3
+#ifndef MMUL_CPU_MC
+#define MMUL_CPU_MC 96
+#endif
+#ifndef MMUL_CPU_KC
+#define MMUL_CPU_KC 256
+#endif
+#ifndef MMUL_CPU_NC
+#define MMUL_CPU_NC 4096
+#endif
+// micro-tile: MR rows times two 256-bit registers of columns, so the accumulators fit into the 16 AVX2 (or 32 NEON) registers
+#define MMUL_CPU_MR 6
+
+enum MMUL_CPU_ENGINE { MMUL_CPU_GENERIC, MMUL_CPU_AVX2, MMUL_CPU_NEON };
+const char* const MMUL_CPU_ENGINE_NAMES[] = { "generic", "avx2", "neon" };
+
+unsigned mmulCPUThreads = 0; // threads of the CPU engine, 0 uses all cores. Set before the first multiplication
+
+
+// fixed set of threads, shared by all multiplications of a process
+class CPUThreadPool {
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping;
+
+	void work();
+
+public:
+	/// <summary>
+	/// Starts 'size'-1 threads, the thread calling parallelFor is the last one.
+	/// </summary>
+	CPUThreadPool(unsigned size);
+	~CPUThreadPool();
+	CPUThreadPool(const CPUThreadPool&) = delete;
+	CPUThreadPool& operator=(const CPUThreadPool&) = delete;
+
+	/// <summary>
+	/// Returns the pool of the process, created with mmulCPUThreads threads on first use.
+	/// </summary>
+	static CPUThreadPool& get();
+	unsigned size() const { return static_cast<unsigned>(threads.size()) + 1; }
+	/// <summary>
+	/// Calls body(0) ... body(count-1) on the threads of the pool and returns after all calls have finished. The calling thread takes part, so concurrent callers cannot starve each other.
+	/// </summary>
+	void parallelFor(unsigned count, const std::function<void(unsigned)> &body);
+};
+
+template<typename T>
+struct CPUMicroKernel {
+	// computes the MR*NR tile c (row stride ldc) from kc columns of a packed A panel and kc rows of a packed B panel, adds to c if 'accumulate'
+	typedef void(*type)(int kc, const T *a, const T *b, T *c, int ldc, bool accumulate);
+	// columns of a micro-tile, two 256-bit vectors
+	enum { NR = 64 / sizeof(T) < 4 ? 4 : 64 / sizeof(T) };
+};
+
+/// <summary>
+/// C = A*B with A M*K, B K*N and C M*N, all row-major with row strides lda, ldb and ldc. Uses the fastest micro-kernel the CPU supports and all threads of CPUThreadPool.
+/// </summary>
+template<typename T>
+void gemmCPU(const int M, const int N, const int K, const T *A, const int lda, const T *B, const int ldb, T *C, const int ldc);
+
+/// <summary>
+/// Returns the micro-kernel engine gemmCPU uses for element type T on this CPU.
+/// </summary>
+template<typename T>
+MMUL_CPU_ENGINE gemmCPUEngine();
+
+#include "mmulCPU.tpp"
@@ -0,0 +1,377 @@
+// Matrix multiplication on the CPU: packed panels, cache blocking, SIMD micro-kernels and a thread pool
+// author: Schuchardt Martin, csap9442
+
+// *** thread pool ***************************************************************************************************************************************
+inline CPUThreadPool::CPUThreadPool(unsigned size) : stopping(false) {
+	for (unsigned i = 1; i < size; ++i)
+		threads.emplace_back(&CPUThreadPool::work, this);
+}
+
+inline CPUThreadPool::~CPUThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+inline void CPUThreadPool::work() {
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeup.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty()) // stopping
+				return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+inline CPUThreadPool& CPUThreadPool::get() {
+	static CPUThreadPool pool(mmulCPUThreads ? mmulCPUThreads : std::max(std::thread::hardware_concurrency(), 1u));
+	return pool;
+}
+
+inline void CPUThreadPool::parallelFor(unsigned count, const std::function<void(unsigned)> &body) {
+	if (count == 0)
+		return;
+
+	// indices are taken dynamically, helpers starting after all indices are gone return without touching 'body'
+	struct Job {
+		std::atomic<unsigned> next;
+		std::atomic<unsigned> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto job = std::make_shared<Job>();
+	job->next = 0;
+	job->done = 0;
+	auto run = [job, count, &body]() {
+		for (unsigned i = job->next++; i < count; i = job->next++) {
+			body(i);
+			if (++job->done == count) {
+				std::lock_guard<std::mutex> lock(job->mutex);
+				job->finished.notify_all();
+			}
+		}
+	};
+
+	const unsigned helpers = std::min(count, size()) - 1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (unsigned i = 0; i < helpers; ++i)
+			tasks.push_back(run);
+	}
+	wakeup.notify_all();
+
+	run();
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&job, count] { return job->done == count; });
+}
+
+
+// *** micro-kernels *************************************************************************************************************************************
+// a holds kc columns of MR rows, b kc rows of NR columns, both packed contiguously (see packA, packB)
+template<typename T>
+void microKernelGeneric(int kc, const T *a, const T *b, T *c, int ldc, bool accumulate) {
+	const int NR = CPUMicroKernel<T>::NR;
+	T sum[MMUL_CPU_MR][NR] = {};
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += NR)
+		for (int r = 0; r < MMUL_CPU_MR; ++r)
+			for (int j = 0; j < NR; ++j)
+				sum[r][j] += a[r] * b[j];
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int j = 0; j < NR; ++j)
+			c[r*ldc + j] = accumulate ? c[r*ldc + j] + sum[r][j] : sum[r][j];
+}
+
+#ifdef MMUL_CPU_HAS_AVX2
+// compiled for AVX2 and FMA regardless of the compiler flags, only called if the CPU supports both (see cpuSupportsAVX2)
+__attribute__((target("avx2,fma")))
+inline void microKernelAVX2(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+	__m256 sum0[MMUL_CPU_MR], sum1[MMUL_CPU_MR];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		sum0[r] = sum1[r] = _mm256_setzero_ps();
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 16) {
+		const __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+		for (int r = 0; r < MMUL_CPU_MR; ++r) {
+			const __m256 ar = _mm256_broadcast_ss(a + r);
+			sum0[r] = _mm256_fmadd_ps(ar, b0, sum0[r]);
+			sum1[r] = _mm256_fmadd_ps(ar, b1, sum1[r]);
+		}
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r) {
+		float *row = c + r*ldc;
+		if (accumulate) {
+			sum0[r] = _mm256_add_ps(sum0[r], _mm256_loadu_ps(row));
+			sum1[r] = _mm256_add_ps(sum1[r], _mm256_loadu_ps(row + 8));
+		}
+		_mm256_storeu_ps(row, sum0[r]);
+		_mm256_storeu_ps(row + 8, sum1[r]);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+inline void microKernelAVX2(int kc, const double *a, const double *b, double *c, int ldc, bool accumulate) {
+	__m256d sum0[MMUL_CPU_MR], sum1[MMUL_CPU_MR];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		sum0[r] = sum1[r] = _mm256_setzero_pd();
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 8) {
+		const __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+		for (int r = 0; r < MMUL_CPU_MR; ++r) {
+			const __m256d ar = _mm256_broadcast_sd(a + r);
+			sum0[r] = _mm256_fmadd_pd(ar, b0, sum0[r]);
+			sum1[r] = _mm256_fmadd_pd(ar, b1, sum1[r]);
+		}
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r) {
+		double *row = c + r*ldc;
+		if (accumulate) {
+			sum0[r] = _mm256_add_pd(sum0[r], _mm256_loadu_pd(row));
+			sum1[r] = _mm256_add_pd(sum1[r], _mm256_loadu_pd(row + 4));
+		}
+		_mm256_storeu_pd(row, sum0[r]);
+		_mm256_storeu_pd(row + 4, sum1[r]);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+inline void microKernelAVX2(int kc, const int *a, const int *b, int *c, int ldc, bool accumulate) {
+	__m256i sum0[MMUL_CPU_MR], sum1[MMUL_CPU_MR];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		sum0[r] = sum1[r] = _mm256_setzero_si256();
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 16) {
+		const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+		const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 8));
+		for (int r = 0; r < MMUL_CPU_MR; ++r) {
+			const __m256i ar = _mm256_set1_epi32(a[r]);
+			sum0[r] = _mm256_add_epi32(sum0[r], _mm256_mullo_epi32(ar, b0));
+			sum1[r] = _mm256_add_epi32(sum1[r], _mm256_mullo_epi32(ar, b1));
+		}
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r) {
+		__m256i *row = reinterpret_cast<__m256i*>(c + r*ldc);
+		if (accumulate) {
+			sum0[r] = _mm256_add_epi32(sum0[r], _mm256_loadu_si256(row));
+			sum1[r] = _mm256_add_epi32(sum1[r], _mm256_loadu_si256(row + 1));
+		}
+		_mm256_storeu_si256(row, sum0[r]);
+		_mm256_storeu_si256(row + 1, sum1[r]);
+	}
+}
+
+inline bool cpuSupportsAVX2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+#ifdef MMUL_CPU_HAS_NEON
+// NEON is part of every AArch64 CPU, so no runtime check is needed
+inline void microKernelNEON(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+	float32x4_t sum[MMUL_CPU_MR][4];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v)
+			sum[r][v] = vdupq_n_f32(0);
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 16) {
+		const float32x4_t bv[4] = { vld1q_f32(b), vld1q_f32(b + 4), vld1q_f32(b + 8), vld1q_f32(b + 12) };
+		for (int r = 0; r < MMUL_CPU_MR; ++r)
+			for (int v = 0; v < 4; ++v)
+				sum[r][v] = vfmaq_n_f32(sum[r][v], bv[v], a[r]);
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v) {
+			float *row = c + r*ldc + 4*v;
+			vst1q_f32(row, accumulate ? vaddq_f32(sum[r][v], vld1q_f32(row)) : sum[r][v]);
+		}
+}
+
+inline void microKernelNEON(int kc, const double *a, const double *b, double *c, int ldc, bool accumulate) {
+	float64x2_t sum[MMUL_CPU_MR][4];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v)
+			sum[r][v] = vdupq_n_f64(0);
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 8) {
+		const float64x2_t bv[4] = { vld1q_f64(b), vld1q_f64(b + 2), vld1q_f64(b + 4), vld1q_f64(b + 6) };
+		for (int r = 0; r < MMUL_CPU_MR; ++r)
+			for (int v = 0; v < 4; ++v)
+				sum[r][v] = vfmaq_n_f64(sum[r][v], bv[v], a[r]);
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v) {
+			double *row = c + r*ldc + 2*v;
+			vst1q_f64(row, accumulate ? vaddq_f64(sum[r][v], vld1q_f64(row)) : sum[r][v]);
+		}
+}
+
+inline void microKernelNEON(int kc, const int *a, const int *b, int *c, int ldc, bool accumulate) {
+	int32x4_t sum[MMUL_CPU_MR][4];
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v)
+			sum[r][v] = vdupq_n_s32(0);
+	for (int p = 0; p < kc; ++p, a += MMUL_CPU_MR, b += 16) {
+		const int32x4_t bv[4] = { vld1q_s32(b), vld1q_s32(b + 4), vld1q_s32(b + 8), vld1q_s32(b + 12) };
+		for (int r = 0; r < MMUL_CPU_MR; ++r)
+			for (int v = 0; v < 4; ++v)
+				sum[r][v] = vmlaq_n_s32(sum[r][v], bv[v], a[r]);
+	}
+
+	for (int r = 0; r < MMUL_CPU_MR; ++r)
+		for (int v = 0; v < 4; ++v) {
+			int *row = c + r*ldc + 4*v;
+			vst1q_s32(row, accumulate ? vaddq_s32(sum[r][v], vld1q_s32(row)) : sum[r][v]);
+		}
+}
+#endif
+
+// runtime selection of the micro-kernel, element types without SIMD kernels use the generic one
+template<typename T>
+MMUL_CPU_ENGINE selectMicroKernel(void(*&kernel)(int, const T*, const T*, T*, int, bool)) {
+	kernel = microKernelGeneric<T>;
+	return MMUL_CPU_GENERIC;
+}
+
+#define MMUL_CPU_SELECT_MICRO_KERNEL(T)\
+inline MMUL_CPU_ENGINE selectMicroKernel(CPUMicroKernel<T>::type &kernel) {\
+	MMUL_CPU_SELECT_AVX2\
+	MMUL_CPU_SELECT_NEON\
+	kernel = microKernelGeneric<T>;\
+	return MMUL_CPU_GENERIC;\
+}
+#ifdef MMUL_CPU_HAS_AVX2
+#define MMUL_CPU_SELECT_AVX2 if (cpuSupportsAVX2()) { kernel = microKernelAVX2; return MMUL_CPU_AVX2; }
+#else
+#define MMUL_CPU_SELECT_AVX2
+#endif
+#ifdef MMUL_CPU_HAS_NEON
+#define MMUL_CPU_SELECT_NEON kernel = microKernelNEON; return MMUL_CPU_NEON;
+#else
+#define MMUL_CPU_SELECT_NEON
+#endif
+MMUL_CPU_SELECT_MICRO_KERNEL(float)
+MMUL_CPU_SELECT_MICRO_KERNEL(double)
+MMUL_CPU_SELECT_MICRO_KERNEL(int)
+#undef MMUL_CPU_SELECT_MICRO_KERNEL
+#undef MMUL_CPU_SELECT_AVX2
+#undef MMUL_CPU_SELECT_NEON
+
+// micro-kernel of element type T, selected once per process
+template<typename T>
+struct CPUEngine {
+	typename CPUMicroKernel<T>::type kernel;
+	MMUL_CPU_ENGINE engine;
+
+	CPUEngine() { engine = selectMicroKernel(kernel); }
+	static const CPUEngine& get() {
+		static const CPUEngine selected;
+		return selected;
+	}
+};
+
+template<typename T>
+MMUL_CPU_ENGINE gemmCPUEngine() {
+	return CPUEngine<T>::get().engine;
+}
+
+
+// *** blocked multiplication ****************************************************************************************************************************
+// packs mc rows and kc columns of A into panels of MR rows, column by column. The last panel is padded with zeros
+template<typename T>
+void packA(const int mc, const int kc, const T *A, const int lda, T *packed) {
+	for (int i = 0; i < mc; i += MMUL_CPU_MR) {
+		const int rows = std::min(MMUL_CPU_MR, mc - i);
+		for (int p = 0; p < kc; ++p)
+			for (int r = 0; r < MMUL_CPU_MR; ++r)
+				*packed++ = r < rows ? A[(i + r)*lda + p] : T(0);
+	}
+}
+
+// packs kc rows and nc columns of B into panels of NR columns, row by row. The last panel is padded with zeros
+template<typename T>
+void packB(const int kc, const int nc, const T *B, const int ldb, T *packed) {
+	const int NR = CPUMicroKernel<T>::NR;
+	for (int j = 0; j < nc; j += NR) {
+		const int columns = std::min(NR, nc - j);
+		for (int p = 0; p < kc; ++p) {
+			const T *row = B + p*ldb + j;
+			for (int c = 0; c < NR; ++c)
+				*packed++ = c < columns ? row[c] : T(0);
+		}
+	}
+}
+
+// C = A*B for the columns [first, last) of B and C, single-threaded
+template<typename T>
+void gemmCPUColumns(const int M, const int first, const int last, const int K, const T *A, const int lda, const T *B, const int ldb, T *C, const int ldc) {
+	const int NR = CPUMicroKernel<T>::NR;
+	const auto kernel = CPUEngine<T>::get().kernel;
+
+	// packing buffers are kept per thread, so they are allocated once only
+	static thread_local std::vector<T> packedA, packedB;
+	packedA.resize((MMUL_CPU_MC + MMUL_CPU_MR - 1) / MMUL_CPU_MR * MMUL_CPU_MR * MMUL_CPU_KC);
+	packedB.resize((MMUL_CPU_NC + NR - 1) / NR * NR * MMUL_CPU_KC);
+
+	for (int jc = first; jc < last; jc += MMUL_CPU_NC) {
+		const int nc = std::min(MMUL_CPU_NC, last - jc);
+		for (int pc = 0; pc < K; pc += MMUL_CPU_KC) {
+			const int kc = std::min(MMUL_CPU_KC, K - pc);
+			const bool accumulate = pc > 0;
+			packB(kc, nc, B + pc*ldb + jc, ldb, packedB.data());
+
+			for (int ic = 0; ic < M; ic += MMUL_CPU_MC) {
+				const int mc = std::min(MMUL_CPU_MC, M - ic);
+				packA(mc, kc, A + ic*lda + pc, lda, packedA.data());
+
+				for (int jr = 0; jr < nc; jr += NR) {
+					const int columns = std::min(NR, nc - jr);
+					for (int ir = 0; ir < mc; ir += MMUL_CPU_MR) {
+						const int rows = std::min(MMUL_CPU_MR, mc - ir);
+						T *c = C + (ic + ir)*ldc + jc + jr;
+						if (rows == MMUL_CPU_MR && columns == NR) {
+							kernel(kc, packedA.data() + ir*kc, packedB.data() + jr*kc, c, ldc, accumulate);
+						} else { // border: compute the full micro-tile, copy the part inside of C
+							T tile[MMUL_CPU_MR * NR];
+							kernel(kc, packedA.data() + ir*kc, packedB.data() + jr*kc, tile, NR, false);
+							for (int r = 0; r < rows; ++r)
+								for (int j = 0; j < columns; ++j)
+									c[r*ldc + j] = accumulate ? c[r*ldc + j] + tile[r*NR + j] : tile[r*NR + j];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+template<typename T>
+void gemmCPU(const int M, const int N, const int K, const T *A, const int lda, const T *B, const int ldb, T *C, const int ldc) {
+	if (M <= 0 || N <= 0)
+		return;
+	if (K <= 0) {
+		for (int i = 0; i < M; ++i)
+			std::fill(C + i*ldc, C + i*ldc + N, T(0));
+		return;
+	}
+
+	// every thread computes a range of whole micro-tile columns and packs its own panels
+	const int NR = CPUMicroKernel<T>::NR;
+	CPUThreadPool &pool = CPUThreadPool::get();
+	const unsigned panels = (N + NR - 1) / NR;
+	const unsigned ranges = std::min(pool.size(), panels);
+	pool.parallelFor(ranges, [&](unsigned range) {
+		const int first = static_cast<int>(panels * range / ranges) * NR;
+		const int last = std::min(N, static_cast<int>(panels * (range + 1) / ranges) * NR);
+		gemmCPUColumns(M, first, last, K, A, lda, B, ldb, C, ldc);
+	});
+}
@@ -12,7 +12,8 @@ using namespace std;
 const unsigned MAX_ELEMENTS = 15346;
 
 
-int kernel_m2w_bcast(Node &n, Distributor &d) {
+// M*M elements from master to all workers, broadcast with 'mode' (see Data::setBroadcast)
+int m2w_bcast(Node &n, Distributor &d, Data::BROADCAST mode) {
 	const unsigned M = *static_cast<unsigned*>(d.getArgument("M")->get());
 
 	unsigned *x;
@@ -23,15 +24,17 @@ int kernel_m2w_bcast(Node &n, Distributor &d) {
 		return -2;
 	}
 	Data X(x, { M, M }, sizeof(unsigned));
+	X.setBroadcast(mode);
 	{
 		if (d.isMaster()) {
 			x[0] = 17;
+			x[M*M - 1] = 18;
 			n.addOutput(indentLogText("bcasting to all workers..."));
 			X.bcast_M_to_W();
 		} else {
 			X.bcast_M_to_W();
 			n.addOutput(indentLogText("received bcast from master instance."));
-			assert(x[0] == 17);
+			assert(x[0] == 17 && x[M*M - 1] == 18);
 		}
 		MPI_Barrier(MPI_COMM_CLUSTER);
 	}
@@ -39,6 +42,11 @@ int kernel_m2w_bcast(Node &n, Distributor &d) {
 	return 0;
 }
 
+// the node durations compare the broadcast modes
+int kernel_m2w_bcast(Node &n, Distributor &d) { return m2w_bcast(n, d, Data::BROADCAST_MPI); }
+int kernel_m2w_chainBcast(Node &n, Distributor &d) { return m2w_bcast(n, d, Data::BROADCAST_CHAIN); }
+int kernel_m2w_treeBcast(Node &n, Distributor &d) { return m2w_bcast(n, d, Data::BROADCAST_TREE); }
+
 int kernel_m2w_p2p(Node &n, Distributor &d) {
 	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
 	
@@ -296,6 +304,8 @@ int main(int argc, char** argv) {
 	}
 
 	Node *m2w_bcast =     new Node("master-to-worker bcast    ", kernel_m2w_bcast, kernel_m2w_bcast);
+	Node *m2w_chain =     new Node("master-to-worker chain    ", kernel_m2w_chainBcast, kernel_m2w_chainBcast);
+	Node *m2w_tree =      new Node("master-to-worker tree     ", kernel_m2w_treeBcast, kernel_m2w_treeBcast);
 	Node *m2w_p2p =       new Node("master-to-worker p2p      ", kernel_m2w_p2p, kernel_m2w_p2p);
 	Node *w2w_bcast =     new Node("worker-to-worker bcast    ", nullptr, kernel_w2w_bcast);
 	Node *w2w_p2p =       new Node("worker-to-worker p2p      ", nullptr, kernel_w2w_p2p);
@@ -303,15 +313,22 @@ int main(int argc, char** argv) {
 	Node *w2w_allGather = new Node("worker-to-worker allGather", nullptr, kernel_w2w_allGather);
 	Node *w2m_reduce =    new Node("worker-to-master reduce   ", kernel_w2m_reduce, kernel_w2m_reduce);
 	Node *w2w_allReduce = new Node("worker-to-worker allReduce", nullptr, kernel_w2w_allReduce);
+	Node *group_m2w_p2p = new Node("group: master-worker p2p  ", kernel_m2w_p2p, kernel_m2w_p2p); // concurrently, on half of the workers each
+	Node *group_w2w_bcast = new Node("group: worker-worker bcast", nullptr, kernel_w2w_bcast);
 	Node *shutdown =      new Node("shutdown workers          ", Distributor::kernel_shutdown, Distributor::kernel_shutdown);
-	m2w_p2p->addDependency(m2w_bcast);
+	m2w_chain->addDependency(m2w_bcast);
+	m2w_tree->addDependency(m2w_chain);
+	m2w_p2p->addDependency(m2w_tree);
 	w2w_bcast->addDependency(m2w_p2p);
 	w2w_p2p->addDependency(w2w_bcast);
 	w2m_gather->addDependency(w2w_p2p);
 	w2w_allGather->addDependency(w2m_gather);
 	w2m_reduce->addDependency(w2w_allGather);
 	w2w_allReduce->addDependency(w2m_reduce);
-	shutdown->addDependency(w2w_allReduce);
+	group_m2w_p2p->addDependency(w2w_allReduce);
+	group_w2w_bcast->addDependency(w2w_allReduce);
+	shutdown->addDependency(group_m2w_p2p);
+	shutdown->addDependency(group_w2w_bcast);
 
 	Distributor d(argc, argv, shutdown);
 
@@ -336,20 +353,23 @@ int main(int argc, char** argv) {
 		cerr << string(COLOR_RED) + "ERROR: at least 2 workers are required, this cluster has only " + to_string(d.getSize()) + string(COLOR_NC) << endl;
 		exit(EXIT_FAILURE);
 	}
+	group_m2w_p2p->setWorkers(d.getSize() / 2);
+	group_w2w_bcast->setWorkers(d.getSize() - d.getSize() / 2);
 	
 	if (d.isMaster()) {
 		string mpiVersion;
 		getMPI_StandardVersion(0, 0, mpiVersion);
 		cout << string(COLOR_YELLOW) + "  MPI(v" << mpiVersion << ") cluster size: " << d.getSize() << endl;
 		cout << "  Simple communication tests using" << endl;
-		cout << "         M=" + to_string(M) + ",\t -> M*M=" + to_string(M*M) + " elements for bcast master -> worker," << endl;
+		cout << "         M=" + to_string(M) + ",\t -> M*M=" + to_string(M*M) + " elements for bcast master -> worker (MPI, chain and tree)," << endl;
 		cout << "         N=" + to_string(N) + ",\t -> N*N=" + to_string(N*N) + " elements for send/recv master <-> worker" << endl;
 		cout << "         O=" + to_string(O) + ",\t -> O*O=" + to_string(O*O) + " elements for bcast worker -> worker" << endl;
 		cout << "         P=" + to_string(P) + ",\t -> P*P=" + to_string(P*P) + " elements for send/recv worker <-> worker" << endl;
 		cout << "         Q=" + to_string(Q) + ",\t -> Q*Q=" + to_string(Q*Q) + " elements for gather worker <-> worker" << endl;
 		cout << "         R=" + to_string(R) + ",\t -> R*R=" + to_string(R*R) + " elements for all gather worker <-> worker" << endl;
 		cout << "         S=" + to_string(S) + ",\t -> S*S=" + to_string(S*S) + " elements for reduce worker <-> worker" << endl;
-		cout << "         T=" + to_string(T) + ",\t -> T*T=" + to_string(T*T) + " elements for all reduce worker <-> worker" << endl << endl << string(COLOR_NC);
+		cout << "         T=" + to_string(T) + ",\t -> T*T=" + to_string(T*T) + " elements for all reduce worker <-> worker" << endl;
+		cout << "  then p2p master <-> worker and bcast worker -> worker concurrently, on " + to_string(d.getSize() / 2) + " and " + to_string(d.getSize() - d.getSize() / 2) + " workers" << endl << endl << string(COLOR_NC);
 	}
 
 	if (d.getSize() < 1) {
@@ -374,6 +394,8 @@ int main(int argc, char** argv) {
 	}
 	
 	delete m2w_bcast;
+	delete m2w_chain;
+	delete m2w_tree;
 	delete m2w_p2p;
 	delete w2w_bcast;
 	delete w2w_p2p;
@@ -381,6 +403,8 @@ int main(int argc, char** argv) {
 	delete w2w_allGather;
 	delete w2m_reduce;
 	delete w2w_allReduce;
+	delete group_m2w_p2p;
+	delete group_w2w_bcast;
 	delete shutdown;
 	
 	exit (err);
@@ -2,6 +2,7 @@
 // author: Schuchardt Martin, csap9442
 
 #include "Distributor.h"
+#include "ParallelForNode.h"
 #include "mmul.h"
 #include "../utils/Utils.h"
 #include "../utils/cl_utils.h"
@@ -10,9 +11,49 @@
 #include <algorithm>
 
 
+// largest chunk, the size of the workers' chunk buffers
 #ifndef MAX_ROWS_PER_WORKER
 #define MAX_ROWS_PER_WORKER 128u
 #endif
+// smallest chunk the scheduler hands out (except the last one), keeps the per message overhead low toward the end
+#ifndef MIN_ROWS_PER_CHUNK
+#define MIN_ROWS_PER_CHUNK 8u
+#endif
+
+// chunks in flight per worker: receiving chunk i+1, computing chunk i and sending result i-1. 1 disables pipelining
+#ifndef PIPELINE_DEPTH
+#define PIPELINE_DEPTH 3u
+#endif
+// chunks the master keeps in flight per worker, so the next chunk is already on its way while the worker computes. 1 sends a new chunk only after the previous result arrived
+#ifndef PREFETCH_DEPTH
+#define PREFETCH_DEPTH 2u
+#endif
+// chunks running longer than this many times their expected duration are computed by a second worker at the end of the node, 0 disables it. See ChunkScheduler::setSpeculation
+#ifndef SPECULATION_FACTOR
+#define SPECULATION_FACTOR 2.0
+#endif
+const char ARGUMENT_PIPELINE_DEPTH[3] = "P=";
+const char ARGUMENT_PREFETCH_DEPTH[3] = "F=";
+const char ARGUMENT_KERNEL[3] = "K="; // mmulNaive, mmulTiling, mmulRegisterBlocking, mmulVector, cpu or auto (default)
+const char ARGUMENT_DATA_TYPE[3] = "D="; // int (default), float or double, all workers get the same arguments
+const char ARGUMENT_AUTOTUNE[3] = "T="; // T=1: workers tune kernels for their device before computing, results are kept in the tuning database
+const char ARGUMENT_COMPRESSION[3] = "Z="; // 0: off (default), 1: auto, 2: on. Compresses B, A- and C-chunks on the wire, see Data::setCompression
+const char ARGUMENT_BROADCAST[3] = "B="; // 0: MPI_Bcast (default), 1: chain, 2: tree. How B is broadcast, see Data::setBroadcast
+const char ARGUMENT_RMA[3] = "R="; // 1: workers put their results directly into C on the master (MPI_Put) and only send the chunk-id, 0: results are sent and received (default). See Data::openWindow_M
+const char ARGUMENT_SHARED_B[3] = "H="; // 1: B is allocated once per host and shared by its workers, 0: every worker has its own copy (default). See Data::allocateShared
+const char ARGUMENT_SCHEDULING[3] = "S="; // static, guided (default), factoring or adaptive. How rows are split into chunks, see ChunkScheduler
+const char ARGUMENT_SPECULATION[3] = "X="; // speculative re-execution of straggling chunks, see SPECULATION_FACTOR
+const char ARGUMENT_LOST_WORKER_TIMEOUT[3] = "L="; // seconds a worker with chunks in flight may stay silent before its chunks are handed to the others, 0: off (default). See Distributor::setWorkerTimeout
+bool autotune = false;
+Data::COMPRESSION compression = Data::COMPRESSION_OFF;
+Data::BROADCAST broadcast = Data::BROADCAST_MPI;
+bool sharedB = false;
+bool rmaResults = false;
+ChunkScheduler::POLICY chunkPolicy = ChunkScheduler::GUIDED;
+double speculation = SPECULATION_FACTOR;
+double workerTimeout = 0;
+unsigned pipelineDepth = PIPELINE_DEPTH;
+unsigned prefetchDepth = PREFETCH_DEPTH;
 
 using namespace std;
 
@@ -21,9 +62,10 @@ using namespace std;
 // filling A with random values and B is unit-Matrix
 // out: rewritten A and B matrices
 // master only
+template<typename T>
 int kernel_InitMatrix(Node &n, Distributor &d) {
-	DATA_TYPE *A = static_cast<DATA_TYPE*>(d.getArgument("A")->get());
-	DATA_TYPE *B = static_cast<DATA_TYPE*>(d.getArgument("B")->get());
+	T *A = static_cast<T*>(d.getArgument("A")->get());
+	T *B = static_cast<T*>(d.getArgument("B")->get());
 	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
 	
 	initMatrices(A, B, N);
@@ -35,115 +77,43 @@ int kernel_InitMatrix(Node &n, Distributor &d) {
 // distribute B-matrix to all cluster nodes
 // out: nothing
 // same kernel for master and workers
+template<typename T>
 int kernel_DistributeB(Node &n, Distributor &d) {
 	auto err = d.getArgument("B")->bcast_M_to_W();
-	return err;
-}
-
-// in: B-matrix, matrix size N from B-matrix
-// waits for chunks from master, calculate subresult for C-matrix for that chunk, sends back chunk and waits for next chunk or terminate tag.
-// out: chunks of C-matrix
-// worker kernel
-int kernel_ComputeOnWorkers(Node &n, Distributor &d) {
-	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
-	int err = 0;
-	DATA_TYPE *cBuffer = new DATA_TYPE[MAX_ROWS_PER_WORKER*N];
-	while (true) {
-		Data aChunk(new DATA_TYPE[MAX_ROWS_PER_WORKER*N], { MAX_ROWS_PER_WORKER, N }, sizeof(DATA_TYPE));
-		MPI_Status status = aChunk.recv_W_from_M();
-
-		if (status.MPI_TAG == Data::TAGS::TERMINATE_TAG) { // all kernels have been computed by some workers. No further work for this kernel.
-			n.addOutput(indentLogText("  no more work for this worker on this kernel anymore"));
-			break;
-		} else if (status.MPI_TAG == Data::TAGS::RESTART_TAG) {
-			n.addOutput(indentLogText("  cluster will restart.\n  Saving checkpoint and stopping now but expecting to continue."));
-			if (!d.saveCheckpoint(&n)) {
-				cerr << "ERROR: could not write checkpoint (" + CHECKPOINT_FILE + "). Terminating now." << endl;
-				exit(EXIT_FAILURE);
-			}
-			break;
+	if (!d.isMaster() && !computesOnCPU()) { // upload B once, all chunks reuse the device-resident copy
+		d.deviceRuntime().getResidentBuffer(d.getArgument("B"));
+		if (autotune) {
+			const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
+			autotuneMMul<T>(d.deviceRuntime(), std::min(N, static_cast<unsigned>(MAX_ROWS_PER_WORKER)), N);
+			n.addOutput(indentLogText("Worker " + to_string(d.getRank()) + " tuned for N=" + to_string(N) + ": " + MMUL_KERNEL_NAMES[mmulTunedKernel] + ", tile size " + to_string(mmul_param.tileSize) + ", work per thread " + to_string(mmul_param.workPerThread) + ", vector width " + to_string(mmul_param.vectorWidth)));
 		}
-
-		// multiplyChunkCPU(static_cast<DATA_TYPE*>(aChunk.get()), aChunk.sizeTotal() / N, N, static_cast<DATA_TYPE*>(distributor.getArgument("B")->get()), cBuffer); // legacy, simple mmul using CPU
-		multiplyChunkCL(static_cast<DATA_TYPE*>(aChunk.get()), aChunk.sizeTotal() / N, N, static_cast<DATA_TYPE*>(d.getArgument("B")->get()), cBuffer, d.assignedGPU_Device());
-		Data cChunk(cBuffer, aChunk.size(), sizeof(DATA_TYPE));
-		err |= cChunk.send_W_to_M(Data::TAGS::RECEIVE_CHUNK_TAG);
-
-		n.addOutput(indentLogText("Worker " + to_string(d.getRank()) + " executes " + n.getDescription()));
 	}
-
-	delete[] cBuffer;
 	return err;
 }
 
-// if no idle workers available or all chunks have been distributed:
-// wait for incoming chunk (from any worker), get matching chunk-id associated to the worker-id, fill C-matrix with chunk at the matching position
-void waitForWorker(Node& n, Distributor &d, map<int, int> &worker_chunks, vector<Data*> &cChunks) {
+// worker function of the parallel-for node, called for every chunk: enqueues the multiplication of the rows of A (on the device or the CPU engine) and returns right away
+// the node receives the next chunks and sends finished C-chunks meanwhile, up to pipelineDepth chunks are in progress. Every slot has its own device buffers
+template<typename T>
+ChunkCompletion multiplyChunk(ParallelForNode &n, Distributor &d, Data &aChunk, Data &cChunk, unsigned firstRow, unsigned slot) {
 	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
-	Data cBuffer(new DATA_TYPE[MAX_ROWS_PER_WORKER*N], { MAX_ROWS_PER_WORKER, N }, sizeof(DATA_TYPE));
-	auto status = cBuffer.recv_M_from_W(MPI_ANY_SOURCE, Data::TAGS::RECEIVE_CHUNK_TAG);
-
-
-	DATA_TYPE *cTarget = static_cast<DATA_TYPE*>(cChunks[worker_chunks.at(status.MPI_SOURCE)]->get());
-	DATA_TYPE *cChunk = static_cast<DATA_TYPE*>(cBuffer.get());
-	for (unsigned i = 0; i < cBuffer.sizeTotal(); ++i) // need to copy the data, because we don't know the sender and so the target pointer until we've received the data
-		cTarget[i] = cChunk[i];
-
-	delete[] static_cast<DATA_TYPE*>(cBuffer.get());
-	d.addToIdleQueue(n, status.MPI_SOURCE); // mark worker as idle again
-}
-
-
-// in: A, B and C-matrix, N from C-matrix
-// split A (and C) into chunks, distribute A-chunk to workers, wait for computed C-chunks
-// out: computed C-matrix
-// master kernel. inserts additionally nodes in .dot-graph for each chunk/worker
-int kernel_ComputeOnMaster(Node &n, Distributor &d) {
-	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
-	unsigned ROWS = std::min(N / d.getSize(), static_cast<unsigned>(MAX_ROWS_PER_WORKER)); // split, at least one part per worker, but chunk has at most MAX_ROWS_PER_WORKER lines
-	ROWS = std::max(ROWS, 1u); // at least one row per node if N is less then worker-nodes
-
-	auto aChunks = d.getArgument("A")->sliceSize(ROWS*N);
-	auto cChunks = d.getArgument("C")->sliceSize(ROWS*N);
-	n.addOutput(indentLogText("distributing " + to_string(aChunks.size()) + " chunks to workers..."));
-
-	assert(aChunks.size() <= std::numeric_limits<unsigned int>::max());
-	n.activateAutoResize(static_cast<unsigned>(aChunks.size())); // tell the library how many chunks exist, then need to use *getLoopCounter() to increment the current status
-	unsigned *loopCounter = n.getLoopCounter();
-
-	int err = 0;
-	map<int, int> worker_chunks; // to remember which worker computed which C-chunk
-	
-	for (; *loopCounter < aChunks.size(); ++*loopCounter) {
-		auto worker = d.nextWorker(&n);
-		while (worker == Distributor::NO_IDLE_WORKERS_AVAILABLE) { // no idle worker currently available
-			if (d.isRestarting()) // if a restart has been initiated, we will never get an idle worker and have to terminate
-				return err;
-			waitForWorker(n, d, worker_chunks, cChunks); // otherwise, we wait for the next worker to finish & insert computed chunk in C-matrix
-			worker = d.nextWorker(&n);
-		}
-
-		err |= aChunks[*loopCounter]->send_M_to_W(worker, Data::TAGS::SEND_CHUNK_TAG);
-		worker_chunks[worker] = *loopCounter;
-		n.addOutput(indentLogText("distributed chunk " + to_string(*loopCounter + 1) + " to worker " + to_string(worker)));
-	}
-
-	while (d.availableWorkers() != (d.getSize()))
-		waitForWorker(n, d, worker_chunks, cChunks);
-
-	d.terminateWorkers(); // nothing to do for workers anymore
-
-	return err;
+	ocl_chunk chunk = multiplyChunkCLAsync(static_cast<T*>(aChunk.get()), static_cast<int>(aChunk.size()[0]), N, d.getArgument("B"), static_cast<T*>(cChunk.get()), d.assignedGPU_Device(), slot);
+	return [chunk](bool wait) {
+		if (!wait && !testChunkCL(chunk))
+			return false;
+		waitChunkCL(chunk);
+		return true;
+	};
 }
 
 
 // in: A and C-matrix, N from A-matrix
 // compare A == C, cout errors
 // out: 1 if A and C do not match, else 0
+template<typename T>
 int kernel_Verify(Node &n, Distributor &d) {
 	const unsigned N = *static_cast<unsigned*>(d.getArgument("N")->get());
-	DATA_TYPE *A = static_cast<DATA_TYPE*>(d.getArgument("A")->get());
-	DATA_TYPE *C = static_cast<DATA_TYPE*>(d.getArgument("C")->get());
+	T *A = static_cast<T*>(d.getArgument("A")->get());
+	T *C = static_cast<T*>(d.getArgument("C")->get());
 	
 	string output;
 	int err = testResults(A, C, N, output);
@@ -158,63 +128,68 @@ int kernel_Verify(Node &n, Distributor &d) {
 }
 
 
-int main(int argc, char** argv) {
-	unsigned N = 727; // small size for fast testing
-	string arg;
-	if (parseArguments(argc, argv, ARGUMENT_N, arg) >= 0)
-		N = atoi(arg.c_str());
-	
-	string mpiVersion;
-	if (!getMPI_StandardVersion(1, 6, mpiVersion)) {
-		cerr << string(COLOR_RED) + "ERROR: incompatible MPI version " + mpiVersion + " found, expecting at least v1.6. Terminating now." + string(COLOR_NC) << endl;
-		exit(EXIT_FAILURE);
-	}
-
-	Node *initMatrix = new Node("init input matrices", kernel_InitMatrix, nullptr);
-	Node *distributeB = new Node("distribute matrix B", kernel_DistributeB, kernel_DistributeB);
-	Node *compute = new Node("computing chunks", kernel_ComputeOnMaster, kernel_ComputeOnWorkers);
-	Node *verify = new Node("verify", kernel_Verify, nullptr);
+// builds the graph, allocates the matrices with element type T and runs the distributed multiplication
+template<typename T>
+int runMMul(int argc, char** argv, unsigned N) {
+	Node *initMatrix = new Node("init input matrices", kernel_InitMatrix<T>, nullptr);
+	Node *distributeB = new Node("distribute matrix B", kernel_DistributeB<T>, kernel_DistributeB<T>);
+	auto *compute = new ParallelForNode("computing chunks", "A", "C", multiplyChunk<T>, MAX_ROWS_PER_WORKER, std::min(MIN_ROWS_PER_CHUNK, MAX_ROWS_PER_WORKER)); // rows of A to the workers, rows of C back
+	Node *verify = new Node("verify", kernel_Verify<T>, nullptr);
 
 	distributeB->addDependency(initMatrix);
 	compute->addDependency(distributeB);
 	verify->addDependency(compute);
 
+	compute->setPolicy(chunkPolicy);
+	compute->setPrefetchDepth(prefetchDepth);
+	compute->setPipelineDepth(pipelineDepth);
+	compute->setCompression(compression);
+	compute->setSpeculation(speculation);
+	compute->setResultsViaPut(rmaResults);
+
 	// verify does not need workers any more.
 	// Better setRoot(compute), then call distributor.instanceFinalize; to shutdown workers and at last compute verify with master as last instance running.
 	// But verify as root makes this toy example better to test functionality.
 	Distributor d(argc, argv, verify);
+	d.setWorkerTimeout(workerTimeout); // master and workers, they agree on how to shut down
 	// d.setShutdownFlag(true); // shutdown flag: true=shutdown, false(default)=log shutdown attempt only
 
 	Data *A_ = nullptr, *C_ = nullptr;
-	DATA_TYPE *A = nullptr, *C = nullptr;
+	T *A = nullptr, *C = nullptr;
 	if (d.isMaster()) {
 		try {
-			A = new DATA_TYPE[N*N];
-			C = new DATA_TYPE[N*N];
+			A = new T[N*N];
+			C = new T[N*N];
 		} catch (const std::bad_alloc& e) {
 			cerr << string(COLOR_RED) + d.whoAmI() + ": ERROR: could not allocate space for N*N=" + to_string(N) + "*" + to_string(N) + " elements. Error message: " + string(e.what()) + ". Terminating now." + string(COLOR_NC) << endl;
 			return -2;
 		}
-		A_ = new Data(A, { N, N }, sizeof(DATA_TYPE));
-		C_ = new Data(C, { N, N }, sizeof(DATA_TYPE));
+		A_ = new Data(A, { N, N }, sizeof(T));
+		C_ = new Data(C, { N, N }, sizeof(T));
 		d.addArguments({ { "A", A_ },{ "C", C_ } });
 	}
-	DATA_TYPE *B;
+	Data *B_;
 	try {
-		B = new DATA_TYPE[N*N];
+		if (sharedB) // one copy per host, only one worker per host receives it
+			B_ = Data::allocateShared({ N, N }, sizeof(T));
+		else
+			B_ = new Data(new T[N*N], { N, N }, sizeof(T));
 	} catch (const std::bad_alloc& e) {
 		cerr << string(COLOR_RED) + d.whoAmI() + ": ERROR: could not allocate space for N*N=" + to_string(N) + "*" + to_string(N) + " elements. Error message: " + string(e.what()) + ". Terminating now." + string(COLOR_NC) << endl;
 		return -2;
 	}
-	Data B_(B, { N, N }, sizeof(DATA_TYPE));
+	B_->setCompression(compression);
+	B_->setBroadcast(broadcast);
 	Data N_(&N, { 1 }, sizeof(unsigned));
-	d.addArguments({ { "B", &B_ }, { "N", &N_}});
+	d.addArguments({ { "B", B_ }, { "N", &N_}});
 	
 	if (d.isMaster()) {
 		string mpiVersion;
 		getMPI_StandardVersion(0, 0, mpiVersion);
 		cout << string(COLOR_YELLOW) + "  MPI(v" << mpiVersion << ") cluster size: " << d.getSize() << endl;
-		cout << "  Matrix multiplication, using " << N << "x" << N << " matrix (" << DATA_TYPE_STRING << "), max chunk size " << to_string(MAX_ROWS_PER_WORKER*N) << string(COLOR_NC) << endl << endl;
+		cout << "  Matrix multiplication, using " << N << "x" << N << " matrix (" << MMulType<T>::name() << "), max chunk size " << to_string(MAX_ROWS_PER_WORKER*N) << ", pipeline depth " << pipelineDepth << ", prefetch depth " << prefetchDepth << ", compression " << compression << ", broadcast " << broadcast << (sharedB ? " (shared per host)" : "") << (rmaResults ? ", results via MPI_Put" : "") << ", " << ChunkScheduler::POLICY_NAMES[chunkPolicy] << " scheduling, speculation " << speculation << (workerTimeout > 0 ? ", lost worker timeout " + to_string(workerTimeout) + "s" : "") << string(COLOR_NC) << endl << endl;
+	} else if (computesOnCPU()) {
+		d.addOutput(indentLogText("CPU engine: " + string(MMUL_CPU_ENGINE_NAMES[gemmCPUEngine<T>()]) + ", " + to_string(CPUThreadPool::get().size()) + " threads"));
 	} else {
 		d.addOutput(indentLogText(d.deviceInfoCL()));
 	}
@@ -235,14 +210,70 @@ int main(int argc, char** argv) {
 	}
 	if (!d.isRestarting()) {
 		// cluster_size will become less meaningful if restarts occure. Still useful for benchmarking.
-		writeCSV(genCSVFileName(argv[0], d.getRank()), { pair<string, unsigned>("num_gpus", Distributor::getNumGPUs()), pair<string, unsigned>("cluster_size", d.getSize()), pair<string, unsigned>("N", N)}, d.getDurationDetails());
+		auto details = d.getDurationDetails();
+		auto throughput = mmulDetails();
+		details.insert(details.end(), throughput.begin(), throughput.end());
+		writeCSV(genCSVFileName(argv[0], d.getRank()), { pair<string, unsigned>("num_gpus", Distributor::getNumGPUs()), pair<string, unsigned>("cluster_size", d.getSize()), pair<string, unsigned>("N", N), pair<string, unsigned>("pipeline_depth", pipelineDepth), pair<string, unsigned>("prefetch_depth", prefetchDepth), pair<string, unsigned>("compression", compression), pair<string, unsigned>("broadcast", broadcast), pair<string, unsigned>("shared_b", sharedB), pair<string, unsigned>("rma_results", rmaResults), pair<string, unsigned>("scheduling", chunkPolicy), pair<string, unsigned>("data_type", MMulType<T>::id())}, details);
 	}
 
 	delete initMatrix; delete distributeB; delete compute; delete verify;
-	delete[] static_cast<DATA_TYPE*>(B_.get());
+	if (sharedB)
+		Data::freeShared(B_);
+	else {
+		delete[] static_cast<T*>(B_->get());
+		delete B_;
+	}
 	if (d.isMaster()) {
-		delete[] static_cast<DATA_TYPE*>(A_->get());
-		delete[] static_cast<DATA_TYPE*>(C_->get());
+		delete[] static_cast<T*>(A_->get());
+		delete[] static_cast<T*>(C_->get());
+	}
+	return err;
+}
+
+
+int main(int argc, char** argv) {
+	unsigned N = 727; // small size for fast testing
+	string arg;
+	if (parseArguments(argc, argv, ARGUMENT_N, arg) >= 0)
+		N = atoi(arg.c_str());
+	if (parseArguments(argc, argv, ARGUMENT_PIPELINE_DEPTH, arg) >= 0)
+		pipelineDepth = std::max(atoi(arg.c_str()), 1);
+	if (parseArguments(argc, argv, ARGUMENT_PREFETCH_DEPTH, arg) >= 0)
+		prefetchDepth = std::max(atoi(arg.c_str()), 1);
+	if (parseArguments(argc, argv, ARGUMENT_KERNEL, arg) >= 0)
+		mmulKernel = parseKernel(arg);
+	if (parseArguments(argc, argv, ARGUMENT_AUTOTUNE, arg) >= 0)
+		autotune = atoi(arg.c_str()) != 0;
+	if (parseArguments(argc, argv, ARGUMENT_COMPRESSION, arg) >= 0)
+		compression = static_cast<Data::COMPRESSION>(std::min(std::max(atoi(arg.c_str()), 0), static_cast<int>(Data::COMPRESSION_ON)));
+	if (parseArguments(argc, argv, ARGUMENT_BROADCAST, arg) >= 0)
+		broadcast = static_cast<Data::BROADCAST>(std::min(std::max(atoi(arg.c_str()), 0), static_cast<int>(Data::BROADCAST_TREE)));
+	if (parseArguments(argc, argv, ARGUMENT_SHARED_B, arg) >= 0)
+		sharedB = atoi(arg.c_str()) != 0;
+	if (parseArguments(argc, argv, ARGUMENT_RMA, arg) >= 0)
+		rmaResults = atoi(arg.c_str()) != 0;
+	if (parseArguments(argc, argv, ARGUMENT_SCHEDULING, arg) >= 0)
+		chunkPolicy = ChunkScheduler::parsePolicy(arg);
+	if (parseArguments(argc, argv, ARGUMENT_SPECULATION, arg) >= 0)
+		speculation = std::max(atof(arg.c_str()), 0.0);
+	if (parseArguments(argc, argv, ARGUMENT_LOST_WORKER_TIMEOUT, arg) >= 0)
+		workerTimeout = std::max(atof(arg.c_str()), 0.0);
+	MMUL_DATA_TYPE dataType = MMUL_INT;
+	if (parseArguments(argc, argv, ARGUMENT_DATA_TYPE, arg) >= 0)
+		dataType = parseDataType(arg);
+	
+	string mpiVersion;
+	if (!getMPI_StandardVersion(1, 6, mpiVersion)) {
+		cerr << string(COLOR_RED) + "ERROR: incompatible MPI version " + mpiVersion + " found, expecting at least v1.6. Terminating now." + string(COLOR_NC) << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	switch (dataType) {
+	case MMUL_FLOAT:
+		exit(runMMul<float>(argc, argv, N));
+	case MMUL_DOUBLE:
+		exit(runMMul<double>(argc, argv, N));
+	default:
+		exit(runMMul<int>(argc, argv, N));
 	}
-	exit (err);
 }
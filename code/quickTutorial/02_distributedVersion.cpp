@@ -33,6 +33,7 @@ int receiveData(Node &n, Distributor &d) {
 }
 
 //void calc(int *input, int *result) {
+// the dispatch loop by hand, to show the building blocks. Computations row by row can use a ParallelForNode (see ../distributor/ParallelForNode.h) instead
 int kernel_calc_master(Node &n, Distributor &d) {
 	int *result = static_cast<int*>(d.getArgument("*result")->get());
 	*result = 0;
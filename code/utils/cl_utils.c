@@ -1,5 +1,14 @@
 #include "cl_utils.h"
 
+#ifndef __linux
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#endif
+
 // Peter
 cl_device_id cluInitDevice(size_t num, cl_context *out_context, cl_command_queue *out_queue) {
     // get platform ids
@@ -37,6 +46,23 @@ cl_device_id cluInitDevice(size_t num, cl_context *out_context, cl_command_queue
     return device_id;
 }
 
+cl_uint cluGetDeviceCount(void) {
+    cl_uint ret_num_platforms = 0;
+    if (clGetPlatformIDs(0, NULL, &ret_num_platforms) != CL_SUCCESS || ret_num_platforms == 0)
+        return 0;
+    cl_platform_id *ret_platforms = (cl_platform_id*)alloca(sizeof(cl_platform_id)*ret_num_platforms);
+    if (clGetPlatformIDs(ret_num_platforms, ret_platforms, NULL) != CL_SUCCESS)
+        return 0;
+
+    cl_uint count = 0;
+    for (cl_uint i = 0; i < ret_num_platforms; ++i) {
+        cl_uint ret_num_devices = 0;
+        if (clGetDeviceIDs(ret_platforms[i], CL_DEVICE_TYPE_ALL, 0, NULL, &ret_num_devices) == CL_SUCCESS)
+            count += ret_num_devices;
+    }
+    return count;
+}
+
 
 void cluLoadSource(const char* fn, size_t max_len, char* source_buffer) {
     FILE *fp;
@@ -93,6 +119,242 @@ cl_program cluBuildProgramFromString(cl_context context, cl_device_id device_id,
 }
 
 
+// Martin
+#define CLU_BINARY_MAGIC "CLUBIN01"
+static unsigned long long cluBinaryCacheHits = 0;
+static unsigned long long cluBinaryCacheMisses = 0;
+
+// FNV-1a, including the terminating '\0' so that ("ab","c") and ("a","bc") differ
+static unsigned long long cluHashString(unsigned long long hash, const char* str) {
+	do {
+		hash ^= (unsigned char)*str;
+		hash *= 1099511628211ull;
+	} while (*str++);
+	return hash;
+}
+
+// loads and builds a cached binary, returns NULL if missing, stale or rejected by the driver
+static cl_program cluLoadProgramBinary(cl_context context, cl_device_id device_id, const char* fn, unsigned long long key, const char* options) {
+	FILE *fp = fopen(fn, "rb");
+	if (!fp)
+		return NULL;
+
+	char magic[sizeof(CLU_BINARY_MAGIC) - 1];
+	unsigned long long storedKey = 0, size = 0;
+	unsigned char *binary = NULL;
+	if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, CLU_BINARY_MAGIC, sizeof(magic)) == 0
+		&& fread(&storedKey, sizeof(storedKey), 1, fp) == 1 && storedKey == key
+		&& fread(&size, sizeof(size), 1, fp) == 1 && size > 0) {
+		binary = (unsigned char*)malloc((size_t)size);
+		if (binary && fread(binary, 1, (size_t)size, fp) != size) {
+			free(binary);
+			binary = NULL;
+		}
+	}
+	fclose(fp);
+	if (!binary)
+		return NULL;
+
+	cl_int err, binaryStatus;
+	size_t binarySize = (size_t)size;
+	const unsigned char *binaries[1] = { binary };
+	cl_program program = clCreateProgramWithBinary(context, 1, &device_id, &binarySize, binaries, &binaryStatus, &err);
+	free(binary);
+	if (err != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+		return NULL;
+
+	if (clBuildProgram(program, 1, &device_id, options, NULL, NULL) != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+	return program;
+}
+
+// writes the binary of a freshly built program; concurrent workers write to their own temporary file first
+static void cluStoreProgramBinary(cl_program program, const char* fn, unsigned long long key) {
+	char tmpFn[1024];
+	if (snprintf(tmpFn, sizeof(tmpFn), "%s.%d.tmp", fn, (int)getpid()) >= (int)sizeof(tmpFn))
+		return; // path too long, the binary is rebuilt next time
+
+	size_t binarySize = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, NULL) != CL_SUCCESS || binarySize == 0)
+		return;
+	unsigned char *binary = (unsigned char*)malloc(binarySize);
+	if (!binary)
+		return;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS) {
+		free(binary);
+		return;
+	}
+
+	FILE *fp = fopen(tmpFn, "wb");
+	if (fp) {
+		unsigned long long size = binarySize;
+		int ok = fwrite(CLU_BINARY_MAGIC, 1, sizeof(CLU_BINARY_MAGIC) - 1, fp) == sizeof(CLU_BINARY_MAGIC) - 1
+			&& fwrite(&key, sizeof(key), 1, fp) == 1
+			&& fwrite(&size, sizeof(size), 1, fp) == 1
+			&& fwrite(binary, 1, binarySize, fp) == binarySize;
+		ok = (fclose(fp) == 0) && ok;
+#ifndef __linux
+		if (ok)
+			remove(fn); // rename does not replace existing files on windows
+#endif
+		if (!ok || rename(tmpFn, fn) != 0)
+			remove(tmpFn);
+	}
+	free(binary);
+}
+
+cl_program cluBuildProgramFromStringCached(cl_context context, cl_device_id device_id, const char* code, const char* options, const char* cache_dir) {
+	char deviceName[256], driverVersion[256];
+	CLU_ERRCHECK(clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(deviceName), deviceName, NULL), "Error getting \"device name\" info");
+	CLU_ERRCHECK(clGetDeviceInfo(device_id, CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL), "Error getting \"driver version\" info");
+
+	unsigned long long key = 14695981039346656037ull;
+	key = cluHashString(key, code);
+	key = cluHashString(key, options ? options : "");
+	key = cluHashString(key, deviceName);
+	key = cluHashString(key, driverVersion);
+
+	char fn[1024];
+	const int length = snprintf(fn, sizeof(fn), "%s/cl_program_%016llx.bin", cache_dir, key);
+	if (length < 0 || length >= (int)sizeof(fn)) { // a truncated path might belong to another key, build without the cache
+		++cluBinaryCacheMisses;
+		return cluBuildProgramFromString(context, device_id, code, options);
+	}
+
+	cl_program program = cluLoadProgramBinary(context, device_id, fn, key, options);
+	if (program) {
+		++cluBinaryCacheHits;
+		return program;
+	}
+
+	++cluBinaryCacheMisses;
+	program = cluBuildProgramFromString(context, device_id, code, options);
+	cluStoreProgramBinary(program, fn, key);
+	return program;
+}
+
+void cluGetBinaryCacheStatistics(unsigned long long *hits, unsigned long long *misses) {
+	*hits = cluBinaryCacheHits;
+	*misses = cluBinaryCacheMisses;
+}
+
+
+// Martin
+#define CLU_TUNING_LINE 1024
+
+// device name and driver version, without the database's delimiters
+static void cluTuningDeviceKey(cl_device_id device, char* key, size_t key_size) {
+	char name[256], driver[256];
+	CLU_ERRCHECK(clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL), "Error getting \"device name\" info");
+	CLU_ERRCHECK(clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL), "Error getting \"driver version\" info");
+	snprintf(key, key_size, "%s (%s)", trim(name), trim(driver));
+	for (char *c = key; *c; ++c)
+		if (*c == ';' || *c == '\n')
+			*c = ' ';
+}
+
+// "device;kernel;shape;" prefix of a database line
+static void cluTuningPrefix(cl_device_id device, const char* kernel, const char* shape, char* prefix, size_t prefix_size) {
+	char key[CLU_TUNING_LINE / 2];
+	cluTuningDeviceKey(device, key, sizeof(key));
+	snprintf(prefix, prefix_size, "%s;%s;%s;", key, kernel, shape);
+}
+
+int cluTuningLookup(const char* db_file, cl_device_id device, const char* kernel, const char* shape, char* params, size_t params_size) {
+	char prefix[CLU_TUNING_LINE], line[CLU_TUNING_LINE];
+	cluTuningPrefix(device, kernel, shape, prefix, sizeof(prefix));
+
+	FILE *fp = fopen(db_file, "r");
+	if (!fp)
+		return 0;
+
+	int found = 0;
+	while (!found && fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, prefix, strlen(prefix)) != 0)
+			continue;
+		char *value = line + strlen(prefix);
+		char *end = strchr(value, ';');
+		if (end)
+			*end = '\0';
+		snprintf(params, params_size, "%s", value);
+		found = 1;
+	}
+	fclose(fp);
+	return found;
+}
+
+void cluTuningStore(const char* db_file, cl_device_id device, const char* kernel, const char* shape, const char* params, cl_ulong duration_ns) {
+	char prefix[CLU_TUNING_LINE], line[CLU_TUNING_LINE], tmpFn[1024];
+	cluTuningPrefix(device, kernel, shape, prefix, sizeof(prefix));
+	if (snprintf(tmpFn, sizeof(tmpFn), "%s.%d.tmp", db_file, (int)getpid()) >= (int)sizeof(tmpFn)) {
+		fprintf(stderr, "WARNING: could not write tuning database %s\n", db_file);
+		return;
+	}
+
+#ifdef __linux
+	// ranks on the same host share the database: without the lock, the last read-copy-rename would drop the entries of the others
+	// the lock is on a separate file, the rename replaces the database file itself
+	char lockFn[1024];
+	int lock = -1;
+	if (snprintf(lockFn, sizeof(lockFn), "%s.lock", db_file) < (int)sizeof(lockFn))
+		lock = open(lockFn, O_RDWR | O_CREAT, 0666);
+	if (lock >= 0 && flock(lock, LOCK_EX) != 0) {
+		close(lock);
+		lock = -1;
+	}
+	if (lock < 0)
+		fprintf(stderr, "WARNING: could not lock tuning database %s, concurrent entries may get lost\n", db_file);
+#endif
+
+	FILE *out = fopen(tmpFn, "w");
+	if (out) {
+		// copy all other entries, then append the new one
+		FILE *in = fopen(db_file, "r");
+		if (in) {
+			while (fgets(line, sizeof(line), in))
+				if (strncmp(line, prefix, strlen(prefix)) != 0)
+					fputs(line, out);
+			fclose(in);
+		}
+		fprintf(out, "%s%s;%llu\n", prefix, params, (unsigned long long)duration_ns);
+		int ok = fclose(out) == 0;
+
+#ifndef __linux
+		if (ok)
+			remove(db_file); // rename does not replace existing files on windows
+#endif
+		if (!ok || rename(tmpFn, db_file) != 0) {
+			remove(tmpFn);
+			out = NULL;
+		}
+	}
+	if (!out)
+		fprintf(stderr, "WARNING: could not write tuning database %s\n", db_file);
+
+#ifdef __linux
+	if (lock >= 0)
+		close(lock); // releases the lock
+#endif
+}
+
+int cluTuningParameter(const char* params, const char* name, int default_value) {
+	size_t len = strlen(name);
+	for (const char *p = params; (p = strstr(p, name)) != NULL; p += len)
+		if ((p == params || p[-1] == ' ') && p[len] == '=')
+			return atoi(p + len + 1);
+	return default_value;
+}
+
+cl_ulong cluEventDurationNs(cl_event event) {
+	cl_ulong start, end;
+	CLU_ERRCHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL), "Failed to get profiling info");
+	CLU_ERRCHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL), "Failed to get profiling info");
+	return end - start;
+}
+
+
 void cluSetKernelArguments(const cl_kernel kernel, const cl_uint num_args, ...) {
     //loop through the arguments and call clSetKernelArg for each
     size_t arg_size;
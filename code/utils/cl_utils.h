@@ -44,6 +44,9 @@ if(__err != CL_SUCCESS) { \
 // if supplied, "command_queue" and "context" are filled with an initialized context and command queue on the device
 cl_device_id cluInitDevice(size_t num, cl_context *out_context, cl_command_queue *out_queue);
 
+// returns the number of ocl devices on all platforms, numbered like in cluInitDevice. 0 if no platform is installed
+cl_uint cluGetDeviceCount(void);
+
 // get string with basic information about the ocl device "device" with id "id"
 const char* cluGetDeviceDescription(const cl_device_id device, unsigned id);
 
@@ -63,6 +66,29 @@ const char* cluDeviceTypeString(cl_device_type type);
 
 cl_program cluBuildProgramFromString(cl_context context, cl_device_id device_id, const char* code, const char* options);
 
+// builds program from "code" like cluBuildProgramFromString, but keeps the program binary in directory "cache_dir"
+// binaries are keyed by a hash of source, options, device name and driver version; stale binaries are rebuilt from source
+cl_program cluBuildProgramFromStringCached(cl_context context, cl_device_id device_id, const char* code, const char* options, const char* cache_dir);
+
+// number of programs loaded from (hits) or missing in (misses) the binary cache of this process
+void cluGetBinaryCacheStatistics(unsigned long long *hits, unsigned long long *misses);
+
+// tuning database: one line per device, kernel and problem shape, "device;kernel;shape;parameters;duration_ns"
+// parameters are "NAME=value" pairs separated by blanks, e.g. "TILESIZE=16 WORKGROUPSIZE=64"
+#define CLU_TUNING_DATABASE "cl_tuning.db"
+
+// looks up the parameters tuned for "kernel" and "shape" on "device" in database file "db_file"; returns 1 and copies them to "params" if found, else 0
+int cluTuningLookup(const char* db_file, cl_device_id device, const char* kernel, const char* shape, char* params, size_t params_size);
+
+// stores the parameters tuned for "kernel" and "shape" on "device" in database file "db_file", replacing a previous entry; concurrent stores of processes on the same host are serialized by a lock file "db_file.lock" (linux)
+void cluTuningStore(const char* db_file, cl_device_id device, const char* kernel, const char* shape, const char* params, cl_ulong duration_ns);
+
+// returns the value of parameter "name" in "params" (see cluTuningLookup), or "default_value" if it is not contained
+int cluTuningParameter(const char* params, const char* name, int default_value);
+
+// returns the execution time of a finished command in ns, the command queue needs CL_QUEUE_PROFILING_ENABLE
+cl_ulong cluEventDurationNs(cl_event event);
+
 
 // Martin
 char *ltrim(char *s);